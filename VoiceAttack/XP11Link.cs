@@ -2,6 +2,7 @@ using System;
 using System.IO;
 using System.IO.Pipes;
 using System.Linq;
+using System.Threading;
 
 namespace XP11_VA_Link
 {
@@ -12,6 +13,14 @@ namespace XP11_VA_Link
         private StreamWriter pipeWriter;
         private Logger logger;
         private DatarefFactory factory;
+        private readonly object pipeLock = new object();
+        private Timer keepaliveTimer;
+
+        // must be comfortably shorter than the plugin's idle timeout (5 minutes by default)
+        private static readonly TimeSpan KeepaliveInterval = TimeSpan.FromSeconds(30);
+
+        // commands are spoken by the pilot and expected to happen now, so they jump ahead of bulk reads from other clients
+        private const string CommandPrefix = "interactive:cmd:";
 
         public XP11Link(Logger logger)
         {
@@ -35,12 +44,21 @@ namespace XP11_VA_Link
             pipeReader = new StreamReader(pipe);
             pipeWriter = new StreamWriter(pipe);
             pipeWriter.AutoFlush = true;
+            if (keepaliveTimer == null)
+            {
+                keepaliveTimer = new Timer(SendKeepalive, null, KeepaliveInterval, KeepaliveInterval);
+            }
             logger.Debug("Connection successful");
         }
 
         public void Disconnect()
         {
             logger.Debug("Disconnecting...");
+            if (keepaliveTimer != null)
+            {
+                keepaliveTimer.Dispose();
+                keepaliveTimer = null;
+            }
             pipeReader = null;
             pipeWriter = null;
             pipe = null;
@@ -51,13 +69,39 @@ namespace XP11_VA_Link
             return pipe.IsConnected;
         }
         
+        private string Exchange(string request)
+        {
+            // the keepalive timer shares the pipe, so a request and its reply must not be interleaved with a ping
+            lock (pipeLock)
+            {
+                pipeWriter.Write(request);
+                return pipeReader.ReadLine();
+            }
+        }
+
+        private void SendKeepalive(object state)
+        {
+            try
+            {
+                if (pipeWriter == null || !IsConnected()) { return; }
+                string reply = Exchange("ping");
+                if (reply != "{pong}")
+                {
+                    logger.Warn("Unexpected keepalive reply: " + reply);
+                }
+            }
+            catch (Exception e)
+            {
+                logger.Debug("Keepalive failed: " + e.Message);
+            }
+        }
+
         public DataRef GetDataref(string datarefName)
         {
             Connect();
 
             logger.Debug("Getting dataref...");
-            pipeWriter.Write("get:" + datarefName);
-            string reply = pipeReader.ReadLine();
+            string reply = Exchange("get:" + datarefName);
             logger.Debug("GetDataRef result: " + reply);
 
             if (reply == "{invalid_dataref}")
@@ -73,8 +117,7 @@ namespace XP11_VA_Link
             try
             {
                 logger.Debug("Setting dataref...");
-                pipeWriter.Write("set:" + dataref);
-                string reply = pipeReader.ReadLine();
+                string reply = Exchange("set:" + dataref);
                 logger.Debug("SetDataRef result: " + reply);
                 return reply == "{ok}" ? 0 : 1;
             }
@@ -118,8 +161,7 @@ namespace XP11_VA_Link
 
             string[] commands = command.Split(';');
 
-            pipeWriter.Write(string.Join(";", commands.Select(c => "cmd:" + c + ":begin")));
-            string[] replies = pipeReader.ReadLine().Split(';');
+            string[] replies = Exchange(string.Join(";", commands.Select(c => CommandPrefix + c + ":begin"))).Split(';');
             bool all_good = true;
 
             for (var i = 0; i < replies.Length; i++)
@@ -145,8 +187,7 @@ namespace XP11_VA_Link
 
             string[] commands = command.Split(';');
 
-            pipeWriter.Write(string.Join(";", commands.Select(c => "cmd:" + c + ":end")));
-            string[] replies = pipeReader.ReadLine().Split(';');
+            string[] replies = Exchange(string.Join(";", commands.Select(c => CommandPrefix + c + ":end"))).Split(';');
             bool all_good = true;
 
             for (var i = 0; i < replies.Length; i++)
@@ -172,8 +213,7 @@ namespace XP11_VA_Link
 
             string[] commands = command.Split(';');
 
-            pipeWriter.Write(string.Join(";", commands.Select(c => "cmd:" + c + ":once")));
-            string[] replies = pipeReader.ReadLine().Split(';');
+            string[] replies = Exchange(string.Join(";", commands.Select(c => CommandPrefix + c + ":once"))).Split(';');
             bool all_good = true;
 
             for (var i = 0; i < replies.Length; i++)
@@ -199,8 +239,7 @@ namespace XP11_VA_Link
 
             string[] commands = command.Split(';');
 
-            pipeWriter.Write(string.Join(";", commands.Select(c => "cmd:" + c + ":hold:" + duration_ms)));
-            string[] replies = pipeReader.ReadLine().Split(';');
+            string[] replies = Exchange(string.Join(";", commands.Select(c => CommandPrefix + c + ":hold:" + duration_ms))).Split(';');
             bool all_good = true;
 
             for (var i = 0; i < replies.Length; i++)
@@ -0,0 +1,158 @@
+// CoroutineBench.cpp : how many requests Link keeps in flight on one
+// connection's I/O thread, through the real handlers.
+//
+// Link runs as in the plugin, against the stand-in XPLM and pipes in
+// ../standin. One client sends a message of N gets. Each get is a handler
+// coroutine that hops onto the sim thread through SimAwaiter and the
+// SimScheduler, reads its dataref in the flight loop and hops back to the
+// pipe thread, with its frame from the connection's FramePool. All N are in
+// flight at once on the one I/O thread. For comparison the same N gets are
+// then sent as N messages of one get each, one after another, which is as
+// far as a connection gets with one request in flight at a time.
+//
+// Only requests within one message are in flight together: a connection
+// reads its next message once it has answered the last one.
+//
+// This thread plays the sim. Once a message's handlers are all waiting in
+// the queue, going by xp11va/perf/queue_depth, it runs frames for as long
+// as any of them are still queued, then waits for the response. Each frame
+// moves sim time on by a quarter of a second, so Link's flight loops run on
+// every one, and the frames counted are flight loops, at around 4 a second
+// in X-Plane.
+//
+//     CoroutineBench [largest batch sent one by one, 100]
+//
+// Linux: the CoroutineBench target in ../CMakeLists.txt.
+
+#include "pch.h"
+#include "xp11_va/Link.h"
+#include "xp11_va/Logger.h"
+#include "StandIn.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace xp11_va;
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	constexpr int DATAREFS = 16;
+
+	std::string datarefName(int i) {
+		return "bench/coroutine/value_" + std::to_string(i);
+	}
+
+	void addDatarefs() {
+		for (int i = 0; i < DATAREFS; i++) {
+			XPLMSetDataf(standin::AddDataref(datarefName(i), xplmType_Float), static_cast<float>(i));
+		}
+	}
+
+	struct Result {
+		double ms = 0;
+		uint64_t frames = 0;
+		// replies that weren't a value, such as {timeout}
+		uint64_t errors = 0;
+	};
+
+	uint64_t countErrors(std::string_view response) {
+		uint64_t errors = 0;
+		for (size_t brace = response.find('{'); brace != std::string_view::npos; brace = response.find('{', brace + 1)) {
+			errors++;
+		}
+		return errors;
+	}
+
+	XPLMDataRef queueDepth = nullptr;
+
+	// sends the message and runs frames until its response comes, starting once its requests are all queued
+	bool exchange(standin::PipeClient& client, const std::string& message, size_t requests, std::string& response) {
+		if (!client.Send(message)) { return false; }
+		const auto give_up = Clock::now() + std::chrono::seconds(10);
+		while (static_cast<size_t>(XPLMGetDatai(queueDepth)) < requests && Clock::now() < give_up) {
+			std::this_thread::yield();
+		}
+		// once the queue is empty the rest is the pipe thread's, and frames run then would only be counted
+		while (!client.TryReceive(response)) {
+			if (XPLMGetDatai(queueDepth) > 0) {
+				standin::RunFrame(0.25f);
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+		return true;
+	}
+
+	// all N gets in one message
+	Result batched(standin::PipeClient& client, size_t count) {
+		std::string message;
+		for (size_t i = 0; i < count; i++) {
+			if (i > 0) { message.push_back(';'); }
+			message.append("get:").append(datarefName(static_cast<int>(i % DATAREFS)));
+		}
+
+		std::string response;
+		const auto start_frame = standin::Frames();
+		const auto start = Clock::now();
+		if (!exchange(client, message, count, response)) {
+			std::fprintf(stderr, "no response to a batch of %zu\n", count);
+			std::exit(1);
+		}
+		return { std::chrono::duration<double, std::milli>(Clock::now() - start).count(), standin::Frames() - start_frame, countErrors(response) };
+	}
+
+	// the same gets, a message each, each sent once the last was answered
+	Result oneByOne(standin::PipeClient& client, size_t count) {
+		std::string response;
+		Result result;
+		const auto start_frame = standin::Frames();
+		const auto start = Clock::now();
+		for (size_t i = 0; i < count; i++) {
+			if (!exchange(client, "get:" + datarefName(static_cast<int>(i % DATAREFS)), 1, response)) {
+				std::fprintf(stderr, "no response to get %zu of %zu\n", i, count);
+				std::exit(1);
+			}
+			result.errors += countErrors(response);
+		}
+		result.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		result.frames = standin::Frames() - start_frame;
+		return result;
+	}
+}
+
+int main(int argc, char** argv) {
+	const size_t max_one_by_one = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100;
+
+	standin::SetVerbose(std::getenv("VERBOSE") != nullptr);
+	addDatarefs();
+	Logger::get().Start("/dev/null");
+	{
+		LinkOptions options;
+		// a big batch takes many flight loops, as the frame budget spreads it out
+		options.requestTimeout = std::chrono::seconds(60);
+		Link link(options);
+		link.Start();
+		queueDepth = XPLMFindDataRef("xp11va/perf/queue_depth");
+		auto client = standin::PipeClient::Connect(4096);
+
+		std::printf("%10s %14s %12s %8s %16s %12s %8s\n", "in flight", "one message ms", "flight loops", "errors", "one by one ms", "flight loops", "errors");
+		for (size_t count : { 1, 10, 100, 1000, 10000 }) {
+			const auto together = batched(*client, count);
+			std::printf("%10zu %14.1f %12llu %8llu", count, together.ms, (unsigned long long)together.frames, (unsigned long long)together.errors);
+			if (count <= max_one_by_one) {
+				const auto apart = oneByOne(*client, count);
+				std::printf(" %16.1f %12llu %8llu\n", apart.ms, (unsigned long long)apart.frames, (unsigned long long)apart.errors);
+			}
+			else {
+				std::printf(" %16s %12s %8s\n", "-", "-", "-");
+			}
+		}
+
+		client->Close();
+		link.Stop();
+	}
+	Logger::get().Stop();
+	return 0;
+}
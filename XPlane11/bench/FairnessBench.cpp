@@ -0,0 +1,140 @@
+// FairnessBench.cpp : load test for SimScheduler, with one aggressive client
+// flooding the queue and one latency-sensitive client, like VoiceAttack next
+// to a dashboard polling hundreds of datarefs.
+//
+// A stand-in "sim thread" calls SimScheduler::RunFrame every 1/60s, as
+// Link::onFlightLoop does. The aggressive client keeps thousands of tasks
+// queued, each spinning for a few microseconds as a large array read would.
+// The sensitive client queues a single task every 50ms and records how long
+// it waited to run. Each scenario is run with the clients on their own
+// sessions (fair scheduling) and sharing one session, which puts all of
+// their work in one FIFO queue as before per-client queues existed.
+//
+// Linux:
+//     g++ -std=c++20 -O2 -pthread -I../src -I../../XP11/SDK/CHeaders -include pch.h FairnessBench.cpp ../src/xp11_va/SimScheduler.cpp ../src/xp11_va/LatencyHistogram.cpp
+//
+// Windows: build the same files with the plugin's pch.h.
+
+#include "pch.h"
+#include "xp11_va/SimScheduler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace xp11_va;
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	void spin(std::chrono::microseconds cost) {
+		const auto until = Clock::now() + cost;
+		while (Clock::now() < until) {}
+	}
+
+	struct Scenario {
+		const char* name;
+		bool shareSession;
+		Priority aggressivePriority;
+		Priority sensitivePriority;
+		uint32_t sensitiveWeight;
+	};
+
+	struct Result {
+		double p50ms;
+		double p99ms;
+		double maxms;
+		double aggressivePerFrame;
+	};
+
+	Result run(const Scenario& scenario, std::chrono::seconds duration, std::chrono::microseconds aggressiveCost) {
+		SimScheduler scheduler;
+		auto aggressive = std::make_shared<Session>(1);
+		auto sensitive = scenario.shareSession ? aggressive : std::make_shared<Session>(2);
+		if (!scenario.shareSession) {
+			sensitive->SetWeight(scenario.sensitiveWeight);
+		}
+
+		std::atomic_bool stop{ false };
+		std::atomic<uint64_t> frames{ 0 };
+		std::atomic<uint64_t> aggressiveRan{ 0 };
+		std::atomic<int64_t> outstanding{ 0 };
+
+		std::thread sim([&]() {
+			auto next = Clock::now();
+			while (!stop.load()) {
+				next += std::chrono::microseconds(16667);
+				std::this_thread::sleep_until(next);
+				scheduler.RunFrame();
+				frames++;
+			}
+		});
+
+		// keeps the queue topped up rather than growing it without bound
+		std::thread flood([&]() {
+			while (!stop.load()) {
+				while (outstanding.load() < 5000) {
+					outstanding++;
+					scheduler.Queue(SimScheduler::Task{ aggressive, [&]() -> bool {
+						spin(aggressiveCost);
+						aggressiveRan++;
+						outstanding--;
+						return true;
+						}, [&](const char*) { outstanding--; }, Clock::time_point::max(), scenario.aggressivePriority });
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		});
+
+		std::mutex latenciesMutex;
+		std::vector<double> latencies;
+		const auto end = Clock::now() + duration;
+		while (Clock::now() < end) {
+			const auto queued = Clock::now();
+			scheduler.Queue(SimScheduler::Task{ sensitive, [&, queued]() -> bool {
+				const double ms = std::chrono::duration<double, std::milli>(Clock::now() - queued).count();
+				std::lock_guard<std::mutex> lock(latenciesMutex);
+				latencies.push_back(ms);
+				return true;
+				}, nullptr, Clock::time_point::max(), scenario.sensitivePriority });
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+
+		stop = true;
+		flood.join();
+		sim.join();
+		// drop anything still queued without running it
+		aggressive->End();
+		sensitive->End();
+		scheduler.RunFrame();
+
+		std::lock_guard<std::mutex> lock(latenciesMutex);
+		if (latencies.empty()) {
+			return { -1, -1, -1, aggressiveRan.load() / static_cast<double>(frames.load()) };
+		}
+		std::sort(latencies.begin(), latencies.end());
+		const auto at = [&](double q) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(q * latencies.size()))]; };
+		return { at(0.5), at(0.99), latencies.back(), aggressiveRan.load() / static_cast<double>(frames.load()) };
+	}
+}
+
+int main(int argc, char** argv) {
+	const auto seconds = std::chrono::seconds(argc > 1 ? std::strtol(argv[1], nullptr, 10) : 5);
+	const auto cost = std::chrono::microseconds(argc > 2 ? std::strtol(argv[2], nullptr, 10) : 5);
+
+	const Scenario scenarios[] = {
+		{ "shared FIFO", true, Priority::Normal, Priority::Normal, 1 },
+		{ "fair", false, Priority::Normal, Priority::Normal, 1 },
+		{ "fair, weight 4", false, Priority::Normal, Priority::Normal, 4 },
+		{ "fair, flood is bulk", false, Priority::Bulk, Priority::Normal, 1 },
+		{ "fair, both interactive", false, Priority::Interactive, Priority::Interactive, 1 },
+	};
+
+	std::printf("aggressive client task cost %lldus, %llds per scenario\n", (long long)cost.count(), (long long)seconds.count());
+	std::printf("%-24s %12s %12s %12s %20s\n", "scenario", "p50 ms", "p99 ms", "max ms", "flood tasks/frame");
+	for (const auto& scenario : scenarios) {
+		const auto result = run(scenario, seconds, cost);
+		std::printf("%-24s %12.2f %12.2f %12.2f %20.1f\n", scenario.name, result.p50ms, result.p99ms, result.maxms, result.aggressivePerFrame);
+	}
+	return 0;
+}
@@ -0,0 +1,208 @@
+// ListBoxRingCheck.cpp : checks the ring the log window's listbox keeps its
+// lines in, XPListBoxData_t in ../src/xp11_va/widgets, against a std::deque
+// doing the same.
+//
+// Each case fills a small ring to capacity and past it, so it wraps, then
+// adds, inserts and erases at the front, the middle and the back, as
+// XPListBoxAddItem, XPListBoxInsertItem and XPListBoxDeleteItem do. The items
+// are compared with the deque's after every step. A long run of random steps
+// then covers the orders the cases don't, including clearing and growing
+// again after erasing from a wrapped ring. Finally 100,000 lines are pushed
+// through a full-sized ring, and 1000 more inserted near its front, which
+// only moves the items before them.
+//
+// Linux: the ListBoxRingCheck target in ../CMakeLists.txt. Exits non-zero on
+// the first difference.
+
+#include "pch.h"
+#include "xp11_va/widgets/ListBox.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+
+namespace {
+	// the ring and what it should hold
+	class Checked {
+	public:
+		explicit Checked(size_t capacity) : ring(capacity), capacity(capacity) {}
+
+		void Add(const std::string& item) {
+			bool dropped;
+			ring.Push(dropped) = item;
+			expected.push_back(item);
+			expect(dropped == (expected.size() > capacity), "Push said it dropped the oldest when it shouldn't have, or not when it should");
+			if (expected.size() > capacity) { expected.pop_front(); }
+			compare("add " + item);
+		}
+
+		// at is counted before the oldest is dropped, if the ring is full
+		void Insert(size_t at, const std::string& item) {
+			bool dropped;
+			ring.Insert(at, dropped) = item;
+			expect(dropped == (expected.size() == capacity), "Insert said it dropped the oldest when it shouldn't have, or not when it should");
+			if (dropped) {
+				expected.pop_front();
+				if (at > 0) { at--; }
+			}
+			expected.insert(expected.begin() + at, item);
+			compare("insert " + item + " at " + std::to_string(at));
+		}
+
+		void Erase(size_t at) {
+			ring.Erase(at);
+			expected.erase(expected.begin() + at);
+			compare("erase at " + std::to_string(at));
+		}
+
+		void Clear() {
+			ring.Clear();
+			expected.clear();
+			compare("clear");
+		}
+
+		size_t Size() const { return expected.size(); }
+		bool Wrapped() const { return ring.First != 0; }
+
+	private:
+		XPListBoxData_t ring;
+		const size_t capacity;
+		std::deque<std::string> expected;
+		size_t step = 0;
+
+		void expect(bool ok, const std::string& what) {
+			if (ok) { return; }
+			std::fprintf(stderr, "step %zu, capacity %zu: %s\n", step, capacity, what.c_str());
+			std::exit(1);
+		}
+
+		void compare(const std::string& after) {
+			step++;
+			expect(ring.Size() == expected.size(), "after " + after + " the ring holds " + std::to_string(ring.Size()) + " items, not " + std::to_string(expected.size()));
+			for (size_t i = 0; i < expected.size(); i++) {
+				expect(ring.Item(i) == expected[i], "after " + after + " item " + std::to_string(i) + " is '" + ring.Item(i) + "', not '" + expected[i] + "'");
+			}
+		}
+	};
+
+	std::string item(int n) {
+		return "line " + std::to_string(n);
+	}
+
+	void cases() {
+		for (size_t capacity : { 1, 2, 3, 5, 8 }) {
+			Checked checked(capacity);
+			int next = 0;
+
+			// to capacity, then past it, so the oldest slot is reused and First moves off 0
+			for (size_t i = 0; i < capacity * 2 + 1; i++) {
+				checked.Add(item(next++));
+			}
+			if (capacity > 1 && !checked.Wrapped()) {
+				std::fprintf(stderr, "capacity %zu: the ring didn't wrap\n", capacity);
+				std::exit(1);
+			}
+
+			// inserting into a full, wrapped ring drops the oldest
+			checked.Insert(0, item(next++));
+			checked.Insert(checked.Size() / 2, item(next++));
+			checked.Insert(checked.Size(), item(next++));
+
+			// erasing from both halves of a wrapped ring, which close the gap from different ends
+			checked.Erase(0);
+			if (checked.Size() > 0) { checked.Erase(checked.Size() - 1); }
+			if (checked.Size() > 1) { checked.Erase(checked.Size() / 2); }
+
+			// growing again after erasing, while the ring is still wrapped, then wrapping once more
+			for (size_t i = 0; i < capacity + 2; i++) {
+				checked.Add(item(next++));
+			}
+
+			checked.Clear();
+			for (size_t i = 0; i < capacity + 1; i++) {
+				checked.Add(item(next++));
+			}
+		}
+
+		// growing the vector while the ring is wrapped in it: erasing the oldest moves
+		// First off 0 before the ring has reached its capacity
+		for (size_t capacity : { 4, 8 }) {
+			Checked checked(capacity);
+			int next = 0;
+			checked.Add(item(next++));
+			checked.Add(item(next++));
+			checked.Erase(0);
+			checked.Add(item(next++));
+			checked.Add(item(next++));
+			checked.Erase(0);
+			// and inserting near the front, which takes the slot before First, while growing and after
+			checked.Insert(0, item(next++));
+			checked.Insert(1, item(next++));
+			for (size_t i = 0; i < capacity + 1; i++) {
+				checked.Add(item(next++));
+			}
+			checked.Insert(1, item(next++));
+		}
+	}
+
+	void randomSteps() {
+		std::mt19937 rng(1);
+		for (size_t capacity : { 1, 2, 3, 7, 50 }) {
+			Checked checked(capacity);
+			int next = 0;
+			for (int step = 0; step < 20000; step++) {
+				const auto op = rng() % 100;
+				if (op < 60) {
+					checked.Add(item(next++));
+				}
+				else if (op < 80) {
+					if (checked.Size() > 0) { checked.Erase(rng() % checked.Size()); }
+				}
+				else if (op < 99) {
+					checked.Insert(rng() % (checked.Size() + 1), item(next++));
+				}
+				else {
+					checked.Clear();
+				}
+			}
+		}
+	}
+
+	// the log window's ring, full and wrapping, without the deque
+	void full() {
+		constexpr int LINES = 100000;
+		XPListBoxData_t ring;
+		for (int n = 0; n < LINES + LINES / 2; n++) {
+			bool dropped;
+			ring.Push(dropped) = item(n);
+		}
+		if (ring.Size() != LISTBOX_MAX_ITEMS || ring.Item(0) != item(LINES / 2) || ring.Item(ring.Size() - 1) != item(LINES + LINES / 2 - 1)) {
+			std::fprintf(stderr, "a ring of %d didn't keep the last %d lines\n", LISTBOX_MAX_ITEMS, LISTBOX_MAX_ITEMS);
+			std::exit(1);
+		}
+
+		// near the front of a full ring only the few items before it move, the oldest one going
+		const auto start = std::chrono::steady_clock::now();
+		for (int n = 0; n < 1000; n++) {
+			bool dropped;
+			ring.Insert(2, dropped) = "inserted " + std::to_string(n);
+		}
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		// each drops the one inserted before it, after the first two lines
+		if (ring.Size() != LISTBOX_MAX_ITEMS || ring.Item(0) != "inserted 998" || ring.Item(1) != "inserted 999" || ring.Item(2) != item(LINES / 2 + 2)
+			|| ring.Item(ring.Size() - 1) != item(LINES + LINES / 2 - 1)) {
+			std::fprintf(stderr, "inserting near the front of a full ring of %d lost track of the lines\n", LISTBOX_MAX_ITEMS);
+			std::exit(1);
+		}
+		std::printf("1000 inserts near the front of a full ring of %d: %.2fms\n", LISTBOX_MAX_ITEMS, ms);
+	}
+}
+
+int main() {
+	cases();
+	randomSteps();
+	full();
+	std::printf("XPListBoxData_t matches std::deque\n");
+	return 0;
+}
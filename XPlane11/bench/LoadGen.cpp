@@ -0,0 +1,359 @@
+// LoadGen.cpp : end-to-end load on the link from many clients at once, for
+// sizing it for cockpits where several tools talk to one sim.
+//
+// Each client opens its own connection and sends one message at a time, made
+// up the way XP11Link.cs makes them: a get, a set, an interactive cmd once,
+// an interactive cmd hold, or a keepalive ping, picked at random from the mix
+// given. Every reply is timed and sorted by its code, so a run reports
+// latency percentiles and error counts for each kind of request.
+//
+// At a target rate, clients are open loop: each has a schedule of send times
+// fixed before the run starts, and latency is counted from when a message was
+// due to be sent rather than when it was. A client held up by a slow reply
+// sends late, and the messages it sends late count the time they spent
+// waiting, so a stall shows up in the percentiles instead of quietly lowering
+// the rate (coordinated omission). With a rate of 0, clients are closed loop
+// and send the next message as soon as the last is answered, which measures
+// throughput rather than latency.
+//
+//     LoadGen [--clients 4] [--rate 2] [--seconds 10] [--mix get=70,set=15,cmd=10,hold=5,ping=0]
+//             [--hold-ms 100] [--pipeline 1] [--seed 1] [--frame-rate 60]
+//
+// --rate is messages per second per client. --pipeline is how many messages
+// an open loop client may have waiting for their reply, 1 being what
+// XP11Link.cs does. --frame-rate is for the stand-in only.
+//
+// Clients are built on the client library in ../client.
+//
+// Linux: the LoadGen target in ../CMakeLists.txt. It runs Link in process
+// against the stand-in XPLM, with frames at --frame-rate, and every dataref
+// and command in the mix added to it.
+//
+// Windows: build with the plugin's pch.h, ../src/xp11_va/LatencyHistogram.cpp
+// and ../client/Client.cpp and PipeTransport.cpp,
+// and run it with X-Plane and the plugin running. It connects to the plugin's
+// pipe, so the sets and commands in the mix really happen: the autopilot
+// heading and altitude change, lights toggle and the brakes are held.
+
+#include "pch.h"
+#include "xp11_va/LatencyHistogram.h"
+#include "Client.h"
+
+#ifndef _WIN32
+#include "xp11_va/Link.h"
+#include "xp11_va/Logger.h"
+#include "StandIn.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace xp11_va;
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	/* the traffic */
+
+	enum Kind { Get, Set, Cmd, Hold, Ping, KINDS };
+	const char* KIND_NAMES[KINDS] = { "get", "set", "cmd", "hold", "ping" };
+
+	struct Dataref {
+		const char* name;
+		XPLMDataTypeID type;
+		size_t size;
+	};
+
+	// what a voice command or a panel reads
+	const Dataref GETS[] = {
+		{ "sim/flightmodel/position/indicated_airspeed", xplmType_Float, 1 },
+		{ "sim/cockpit2/gauges/indicators/altitude_ft_pilot", xplmType_Float, 1 },
+		{ "sim/cockpit/switches/gear_handle_status", xplmType_Int, 1 },
+		{ "sim/cockpit2/switches/panel_brightness_ratio", xplmType_FloatArray, 4 },
+		{ "sim/aircraft/view/acf_tailnum", xplmType_Data, 40 },
+	};
+
+	struct SetRequest {
+		const char* name;
+		int type;
+		const char* value;
+	};
+	const SetRequest SETS[] = {
+		{ "sim/cockpit/autopilot/heading_mag", xplmType_Float, "270.0" },
+		{ "sim/cockpit/autopilot/altitude", xplmType_Float, "8000.0" },
+		{ "sim/cockpit2/switches/panel_brightness_ratio", xplmType_FloatArray, "0.8,0.8,0.6,0.6" },
+	};
+	const Dataref SET_DATAREFS[] = {
+		{ "sim/cockpit/autopilot/heading_mag", xplmType_Float, 1 },
+		{ "sim/cockpit/autopilot/altitude", xplmType_Float, 1 },
+	};
+
+	const char* COMMANDS[] = {
+		"sim/lights/landing_lights_toggle",
+		"sim/lights/taxi_lights_toggle",
+	};
+	const char* HELD_COMMAND = "sim/flight_controls/brakes_regular";
+
+	struct Options {
+		int clients = 4;
+		double rate = 2;
+		double seconds = 10;
+		std::array<unsigned, KINDS> mix = { 70, 15, 10, 5, 0 };
+		int holdMs = 100;
+		size_t pipeline = 1;
+		unsigned seed = 1;
+		double frameRate = 60;
+	};
+
+	// get=70,set=15,... kinds left out keep their defaults
+	bool parseMix(const char* text, std::array<unsigned, KINDS>& mix) {
+		std::string_view rest = text;
+		while (!rest.empty()) {
+			const auto entry = rest.substr(0, rest.find(','));
+			rest.remove_prefix(std::min(rest.size(), entry.size() + 1));
+			const auto equals = entry.find('=');
+			if (equals == std::string_view::npos) { return false; }
+			const auto name = entry.substr(0, equals);
+			int kind = 0;
+			while (kind < KINDS && name != KIND_NAMES[kind]) { kind++; }
+			if (kind == KINDS) { return false; }
+			mix[kind] = static_cast<unsigned>(std::strtoul(std::string(entry.substr(equals + 1)).c_str(), nullptr, 10));
+		}
+		return true;
+	}
+
+	bool parseOptions(int argc, char** argv, Options& options) {
+		for (int i = 1; i + 1 < argc; i += 2) {
+			const std::string_view name = argv[i];
+			const char* value = argv[i + 1];
+			if (name == "--clients") { options.clients = std::atoi(value); }
+			else if (name == "--rate") { options.rate = std::strtod(value, nullptr); }
+			else if (name == "--seconds") { options.seconds = std::strtod(value, nullptr); }
+			else if (name == "--mix") { if (!parseMix(value, options.mix)) { return false; } }
+			else if (name == "--hold-ms") { options.holdMs = std::atoi(value); }
+			else if (name == "--pipeline") { options.pipeline = std::strtoul(value, nullptr, 10); }
+			else if (name == "--seed") { options.seed = static_cast<unsigned>(std::strtoul(value, nullptr, 10)); }
+			else if (name == "--frame-rate") { options.frameRate = std::strtod(value, nullptr); }
+			else { return false; }
+		}
+		return argc % 2 == 1 && options.clients > 0 && options.rate >= 0 && options.seconds > 0 && options.pipeline > 0;
+	}
+
+	// a message of the given kind, as XP11Link.cs would send it
+	void makeMessage(Kind kind, std::mt19937& random, const Options& options, client::Batch& batch) {
+		const auto pick = [&](const auto& choices) { return choices[random() % std::size(choices)]; };
+		batch.Clear();
+		switch (kind) {
+		case Get: batch.Get(pick(GETS).name); break;
+		case Set: { const auto& set = pick(SETS); batch.Set(set.name, set.type, set.value); break; }
+		case Cmd: batch.Command(pick(COMMANDS), client::CommandAction::Once); break;
+		case Hold: batch.Command(HELD_COMMAND, client::CommandAction::Hold, std::chrono::milliseconds(options.holdMs)); break;
+		default: batch.Ping(); break;
+		}
+	}
+
+#ifndef _WIN32
+	void addToStandIn() {
+		for (const auto& dataref : GETS) {
+			standin::AddDataref(dataref.name, dataref.type, dataref.size);
+		}
+		for (const auto& dataref : SET_DATAREFS) {
+			standin::AddDataref(dataref.name, dataref.type, dataref.size);
+		}
+		for (const auto* command : COMMANDS) {
+			standin::AddCommand(command);
+		}
+		standin::AddCommand(HELD_COMMAND);
+	}
+#endif
+
+	/* the run */
+
+	struct Results {
+		std::array<LatencyHistogram, KINDS> latency;
+		std::mutex mutex;
+		// replies by kind and code, values counted as "value"
+		std::array<std::map<std::string, uint64_t>, KINDS> replies;
+		uint64_t connectFailures = 0;
+		uint64_t pipeFailures = 0;
+		// messages that fell due before the end of the run but were never sent, because their client was behind
+		uint64_t unsent = 0;
+		// how far behind its schedule any client got
+		Clock::duration maxLag{};
+	};
+
+	// a reply's code, or "value" for a get that returned one
+	std::string_view replyCode(const client::Reply& reply) {
+		return reply.IsCode() ? std::string_view(reply.text) : "value";
+	}
+
+	bool isError(std::string_view code) {
+		return code != "value" && code != "{ok}" && code != "{pong}";
+	}
+
+	// what one client saw, added to by its reader thread
+	struct ClientResults {
+		std::mutex mutex;
+		std::array<std::map<std::string, uint64_t>, KINDS> replies;
+		bool failed = false;
+
+		void Count(Kind kind, const client::Reply& reply) {
+			std::lock_guard lock(mutex);
+			replies[kind][std::string(replyCode(reply))]++;
+			failed |= reply.text == "{pipe_closed}";
+		}
+	};
+
+	void runClient(int index, const Options& options, Clock::time_point start, Clock::time_point end, Results& results) {
+		std::mt19937 random(options.seed * 7919 + index);
+		std::discrete_distribution<int> kinds(options.mix.begin(), options.mix.end());
+
+		auto transport = client::ConnectPipe();
+		if (!transport) {
+			std::lock_guard lock(results.mutex);
+			results.connectFailures++;
+			return;
+		}
+		// outlives the client, whose reader thread fills it in
+		ClientResults mine;
+		client::Client client(std::move(transport), client::ClientOptions{ options.pipeline });
+		Clock::duration maxLag{};
+
+		// clients start at random points in the first interval, so they don't all send in step
+		const auto interval = options.rate > 0
+			? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.rate))
+			: Clock::duration::zero();
+		auto due = start + (interval.count() > 0 ? Clock::duration(random() % interval.count()) : Clock::duration::zero());
+		client::Batch batch;
+		while (due < end && Clock::now() < end && client.IsConnected()) {
+			const auto kind = static_cast<Kind>(kinds(random));
+			makeMessage(kind, random, options, batch);
+
+			if (interval.count() > 0) {
+				// open loop counts from when the message was due. with --pipeline 1, Send waits for the
+				// last reply, and whatever that costs shows up as lag.
+				std::this_thread::sleep_until(due);
+				client.Send(batch, [&results, &mine, kind, due](client::Replies replies) {
+					results.latency[kind].Record(Clock::now() - due);
+					mine.Count(kind, replies.front());
+				});
+				maxLag = std::max(maxLag, Clock::now() - due);
+				due += interval;
+			}
+			else {
+				// closed loop counts from when it went
+				const auto sent = Clock::now();
+				const auto replies = client.Send(batch).get();
+				due = Clock::now();
+				results.latency[kind].Record(due - sent);
+				mine.Count(kind, replies.front());
+			}
+		}
+		// replies come in order, so once this one is in every reply is
+		client.Ping().get();
+		const bool failed = !client.IsConnected() || mine.failed;
+
+		uint64_t unsent = 0;
+		if (interval.count() > 0 && !failed) {
+			for (; due < end; due += interval) { unsent++; }
+		}
+
+		std::lock_guard lock(results.mutex);
+		results.pipeFailures += failed;
+		results.unsent += unsent;
+		results.maxLag = std::max(results.maxLag, maxLag);
+		for (int kind = 0; kind < KINDS; kind++) {
+			for (const auto& [code, count] : mine.replies[kind]) {
+				results.replies[kind][code] += count;
+			}
+		}
+	}
+
+	void report(const Options& options, const Results& results, double seconds) {
+		const auto ms = [](std::chrono::nanoseconds ns) { return ns.count() / 1e6; };
+
+		uint64_t total = 0;
+		for (const auto& latency : results.latency) {
+			total += latency.Count();
+		}
+		if (options.rate > 0) {
+			std::printf("%d clients, open loop at %g messages/s each with up to %zu in flight, %.1fs\n", options.clients, options.rate,
+				options.pipeline, seconds);
+			std::printf("%llu messages, %.0f/s of %g/s asked for, worst lag behind schedule %.1fms\n", static_cast<unsigned long long>(total),
+				total / seconds, options.rate * options.clients, ms(results.maxLag));
+			if (results.unsent > 0) {
+				// these would have waited longer than anything recorded, so the percentiles flatter the link
+				std::printf("%llu messages fell due but were never sent, the link can't keep up with this rate\n",
+					static_cast<unsigned long long>(results.unsent));
+			}
+		}
+		else {
+			std::printf("%d clients, closed loop, %.1fs\n", options.clients, seconds);
+			std::printf("%llu messages, %.0f/s\n", static_cast<unsigned long long>(total), total / seconds);
+		}
+		if (results.connectFailures || results.pipeFailures) {
+			std::printf("%llu clients failed to connect, %llu lost their pipe\n",
+				static_cast<unsigned long long>(results.connectFailures), static_cast<unsigned long long>(results.pipeFailures));
+		}
+
+		std::printf("\n%-6s %10s %10s %10s %10s %10s %10s %10s\n", "", "count", "errors", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+		for (int kind = 0; kind < KINDS; kind++) {
+			const auto& latency = results.latency[kind];
+			if (latency.Count() == 0) { continue; }
+			uint64_t errors = 0;
+			for (const auto& [code, count] : results.replies[kind]) {
+				if (isError(code)) { errors += count; }
+			}
+			std::printf("%-6s %10llu %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", KIND_NAMES[kind],
+				static_cast<unsigned long long>(latency.Count()), static_cast<unsigned long long>(errors),
+				ms(latency.Percentile(0.5)), ms(latency.Percentile(0.9)), ms(latency.Percentile(0.99)), ms(latency.Percentile(0.999)), ms(latency.Max()));
+		}
+
+		std::printf("\nreplies\n");
+		for (int kind = 0; kind < KINDS; kind++) {
+			for (const auto& [code, count] : results.replies[kind]) {
+				std::printf("  %-6s %-28s %10llu\n", KIND_NAMES[kind], code.c_str(), static_cast<unsigned long long>(count));
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		std::fprintf(stderr, "usage: LoadGen [--clients 4] [--rate 2] [--seconds 10] [--mix get=70,set=15,cmd=10,hold=5,ping=0]\n"
+			"               [--hold-ms 100] [--pipeline 1] [--seed 1] [--frame-rate 60]\n");
+		return 2;
+	}
+
+#ifndef _WIN32
+	standin::SetVerbose(std::getenv("VERBOSE") != nullptr);
+	addToStandIn();
+	Logger::get().Start("/dev/null");
+	Link link;
+	standin::Driver driver(options.frameRate);
+	link.Start();
+#endif
+
+	Results results;
+	const auto start = Clock::now();
+	const auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+	std::vector<std::thread> threads;
+	for (int c = 0; c < options.clients; c++) {
+		threads.emplace_back(runClient, c, std::cref(options), start, end, std::ref(results));
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+#ifndef _WIN32
+	link.Stop();
+	driver.Stop();
+	Logger::get().Stop();
+#endif
+
+	report(options, results, seconds);
+	return results.connectFailures || results.pipeFailures ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+// LoggingBench.cpp : what the log calls on Link's hot paths cost, with their
+// level switched off and on.
+//
+// Each case is one of the calls made for every message or every request in
+// Link.cpp, timed in two forms: building the message up front with string
+// concatenation, as Link did before log arguments were formatted lazily,
+// and passing the arguments to the logger, which only formats them once the
+// level check has passed. With the level off the second form should cost a
+// comparison. With it on, both forms end up copying into a ring record, the
+// eager form after allocating and filling a string first.
+//
+// Build it twice to see a level compiled out as well: by default Trace is
+// compiled in, with -DXP11VA_LOG_MIN_LEVEL=1 the Trace cases have no code.
+//
+// Linux:
+//     g++ -std=c++20 -O2 -pthread -DXPLM200 -I../src -I../../XP11/SDK/CHeaders -include pch.h LoggingBench.cpp ../src/xp11_va/Logger.cpp ../src/xp11_va/AllocTracker.cpp
+//
+// Windows: build the same files with the plugin's pch.h.
+
+#include "pch.h"
+#include "xp11_va/Logger.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	const std::string_view REQUEST = "get:sim/flightmodel/position/indicated_airspeed;get:sim/cockpit2/gauges/indicators/altitude_ft_pilot;interactive:cmd:sim/lights/landing_lights_toggle:once";
+	const std::string_view TOKEN = "get:sim/flightmodel/position/indicated_airspeed";
+	const std::string_view RESPONSE = "sim/flightmodel/position/indicated_airspeed:2:143.250000;sim/cockpit2/gauges/indicators/altitude_ft_pilot:2:8500.000000;{ok}";
+	const std::string COMMAND = "sim/lights/landing_lights_toggle";
+
+	struct Case {
+		const char* name;
+		Logger::Level level;
+		void (*eager)(Logger&, size_t);
+		void (*lazy)(Logger&, size_t);
+	};
+
+	const Case cases[] = {
+		{ "Received request (Info)", Logger::Level::Info,
+			[](Logger& log, size_t) { log.Info("Received request: " + std::string(REQUEST)); },
+			[](Logger& log, size_t) { log.Info("Received request: {}", REQUEST); } },
+		{ "Processed into (Info)", Logger::Level::Info,
+			[](Logger& log, size_t i) { log.Info("Processed into " + std::to_string(i & 7) + " requests"); },
+			[](Logger& log, size_t i) { log.Info("Processed into {} requests", i & 7); } },
+		{ "Processed token (Info)", Logger::Level::Info,
+			[](Logger& log, size_t) { log.Info("Processed token: " + std::string(TOKEN)); },
+			[](Logger& log, size_t) { log.Info("Processed token: {}", TOKEN); } },
+		{ "Responded with (Info)", Logger::Level::Info,
+			[](Logger& log, size_t) { log.Info("Responded with: " + std::string(RESPONSE)); },
+			[](Logger& log, size_t) { log.Info("Responded with: {}", RESPONSE); } },
+		{ "Command action (Trace)", Logger::Level::Trace,
+			[](Logger& log, size_t) { log.Trace("Command " + COMMAND + " " + "once"); },
+			[](Logger& log, size_t) { log.Trace("Command {} {}", COMMAND, "once"); } },
+		{ "Command held (Trace)", Logger::Level::Trace,
+			[](Logger& log, size_t) { log.Trace("Command " + COMMAND + " has longer to run yet"); },
+			[](Logger& log, size_t) { log.Trace("Command {} has longer to run yet", COMMAND); } },
+	};
+
+	double nsPerCall(Logger& log, void (*call)(Logger&, size_t), size_t iterations) {
+		const auto start = Clock::now();
+		for (size_t i = 0; i < iterations; i++) {
+			call(log, i);
+		}
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+	}
+
+	// with logging on, calls are made in batches that fit in the ring, and the flusher is given time to empty it
+	// between them, so that what is timed is a push and not a drop
+	constexpr size_t BATCH = 1000;
+	constexpr size_t BATCHES = 10;
+
+	double nsPerLoggedCall(Logger& log, void (*call)(Logger&, size_t)) {
+		Clock::duration spent{};
+		for (size_t batch = 0; batch < BATCHES; batch++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(60));
+			const auto start = Clock::now();
+			for (size_t i = 0; i < BATCH; i++) {
+				call(log, i);
+			}
+			spent += Clock::now() - start;
+		}
+		return std::chrono::duration<double, std::nano>(spent).count() / (BATCH * BATCHES);
+	}
+}
+
+extern "C" void XPLMDebugString(const char*) {}
+
+int main(int argc, char** argv) {
+	const size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+
+	auto& log = Logger::get();
+	// records are written out and thrown away, so with logging on the ring is drained as it would be in the sim
+	log.Start(
+#ifdef _WIN32
+		"NUL"
+#else
+		"/dev/null"
+#endif
+	);
+
+	std::printf("Trace %s, %zu calls per case\n", Logger::COMPILED_MIN_LEVEL > Logger::Level::Trace ? "compiled out" : "compiled in", iterations);
+	std::printf("%-26s %12s %12s %12s %12s\n", "call", "off eager", "off lazy", "on eager", "on lazy");
+	for (const auto& c : cases) {
+		// one level above the call's, so it is filtered out
+		log.SetMinLevel(static_cast<Logger::Level>(static_cast<uint8_t>(c.level) + 1));
+		const double off_eager = nsPerCall(log, c.eager, iterations);
+		const double off_lazy = nsPerCall(log, c.lazy, iterations);
+
+		log.SetMinLevel(c.level);
+		const double on_eager = nsPerLoggedCall(log, c.eager);
+		const double on_lazy = nsPerLoggedCall(log, c.lazy);
+
+		std::printf("%-26s %10.1fns %10.1fns %10.1fns %10.1fns\n", c.name, off_eager, off_lazy, on_eager, on_lazy);
+	}
+
+	log.SetMinLevel(Logger::Level::Warn);
+	// should be none, or the numbers with logging on are partly the cost of dropping
+	std::printf("%llu records dropped with the ring full\n", static_cast<unsigned long long>(log.Dropped()));
+	log.Stop();
+	return 0;
+}
@@ -0,0 +1,255 @@
+// MicroBench.cpp : the hot paths of the protocol and of value conversion,
+// timed one by one with Google Benchmark.
+//
+// - tokenize: splitting messages of 1, 8 and 64 requests
+// - Message: whole messages through Link, from the client's send to its
+//   receive, against the stand-in XPLM with this thread running frames, and
+//   how often a thread had to wait for one of Link's locks per message
+// - EnvData::fromString, fromDataref and AppendTo, for every dataref type
+// - DataCache::Get, hit and miss
+// - Logger calls at a level that is switched off, and one that is on
+//
+// Results are written in Google Benchmark's JSON with
+// --benchmark_out=results.json --benchmark_out_format=json, and
+// compare_baseline.py checks them against the numbers stored in
+// baseline/MicroBench.json, comparing the median of each when run with
+// --benchmark_repetitions. The MicroBenchCompare target in ../CMakeLists.txt
+// does both.
+//
+// Linux: the MicroBench target in ../CMakeLists.txt, built when Google
+// Benchmark is installed.
+
+#include "pch.h"
+#include "xp11_va/DataCache.h"
+#include "xp11_va/EnvData.h"
+#include "xp11_va/Link.h"
+#include "xp11_va/Logger.h"
+#include "StandIn.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+
+namespace xp11_va {
+	std::pmr::vector<Link::Tokens> tokenize(std::string_view, std::pmr::memory_resource*);
+}
+
+using namespace xp11_va;
+
+namespace {
+	const std::string GET = "get:sim/flightmodel/position/indicated_airspeed";
+
+	std::string repeated(const std::string& request, int count) {
+		std::string message;
+		for (int i = 0; i < count; i++) {
+			if (i > 0) { message.push_back(';'); }
+			message.append(request);
+		}
+		return message;
+	}
+
+	// a value for each dataref type, as a client would send it
+	struct TypedValue {
+		XPLMDataTypeID type;
+		const char* typeText;
+		const char* value;
+		const char* dataref;
+	};
+
+	const TypedValue VALUES[] = {
+		{ xplmType_Int, "1", "42", "bench/int" },
+		{ xplmType_Float, "2", "143.25", "bench/float" },
+		{ xplmType_Double, "4", "8500.125", "bench/double" },
+		{ xplmType_FloatArray, "8", "0.5,1.5,2.5,3.5,4.5,5.5,6.5,7.5", "bench/float_array" },
+		{ xplmType_IntArray, "16", "1,2,3,4,5,6,7,8", "bench/int_array" },
+		{ xplmType_Data, "32", "N172SP", "bench/data" },
+	};
+	constexpr int VALUE_TYPES = sizeof(VALUES) / sizeof(VALUES[0]);
+
+	void addDatarefs() {
+		for (const auto& value : VALUES) {
+			const auto ref = standin::AddDataref(value.dataref, value.type, 8);
+			EnvData::fromString(value.dataref, value.typeText, value.value).WriteTo(ref);
+		}
+		standin::AddDataref("sim/flightmodel/position/indicated_airspeed", xplmType_Float);
+		standin::AddCommand("sim/lights/landing_lights_toggle");
+	}
+
+	/* tokenize */
+
+	void BM_Tokenize(benchmark::State& state) {
+		const std::string message = repeated("interactive:" + GET, static_cast<int>(state.range(0)));
+		std::array<std::byte, 64 * 1024> buffer;
+		for (auto _ : state) {
+			std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+			auto commands = tokenize(message, &arena);
+			benchmark::DoNotOptimize(commands.data());
+		}
+		state.SetItemsProcessed(state.iterations() * state.range(0));
+	}
+	BENCHMARK(BM_Tokenize)->Arg(1)->Arg(8)->Arg(64);
+
+	/* whole messages through Link */
+
+	std::shared_ptr<standin::PipeClient> client;
+
+	void roundTrip(std::string_view message, std::string& response) {
+		client->Send(message);
+		// Link's flight loops ask to run every quarter of a second, so every frame here is that long
+		while (!client->TryReceive(response)) {
+			standin::RunFrame(0.25f);
+		}
+	}
+
+	// how many times, in all, a thread has had to wait for one of Link's locks, from stats:locks
+	uint64_t lockWaits() {
+		std::string locks;
+		roundTrip("stats:locks", locks);
+		uint64_t waits = 0;
+		// each entry is name:acquisitions:contended:...
+		for (size_t entry = 0; entry < locks.size();) {
+			const size_t end = std::min(locks.find(',', entry), locks.size());
+			const size_t acquisitions = locks.find(':', entry);
+			const size_t contended = locks.find(':', acquisitions + 1);
+			if (contended < end) {
+				waits += std::strtoull(locks.c_str() + contended + 1, nullptr, 10);
+			}
+			entry = end + 1;
+		}
+		return waits;
+	}
+
+	void BM_Message(benchmark::State& state, const std::string& message) {
+		std::string response;
+		response.reserve(4096);
+		const uint64_t waits = lockWaits();
+		for (auto _ : state) {
+			roundTrip(message, response);
+		}
+		state.SetItemsProcessed(state.iterations());
+		state.counters["lock_waits"] = benchmark::Counter(static_cast<double>(lockWaits() - waits), benchmark::Counter::kAvgIterations);
+	}
+	BENCHMARK_CAPTURE(BM_Message, ping, std::string("ping"));
+	BENCHMARK_CAPTURE(BM_Message, get, GET);
+	BENCHMARK_CAPTURE(BM_Message, get_x8, repeated(GET, 8));
+	BENCHMARK_CAPTURE(BM_Message, set, std::string("set:bench/float:2:120.5"));
+	BENCHMARK_CAPTURE(BM_Message, set_array, std::string("set:bench/float_array:8:0.5,1.5,2.5,3.5,4.5,5.5,6.5,7.5"));
+	BENCHMARK_CAPTURE(BM_Message, cmd, std::string("cmd:sim/lights/landing_lights_toggle:once"));
+
+	/* EnvData */
+
+	void BM_FromString(benchmark::State& state) {
+		const auto& value = VALUES[state.range(0)];
+		state.SetLabel(value.dataref);
+		for (auto _ : state) {
+			auto data = EnvData::fromString(value.dataref, value.typeText, value.value);
+			benchmark::DoNotOptimize(data.arrayElemCount);
+		}
+	}
+	BENCHMARK(BM_FromString)->DenseRange(0, VALUE_TYPES - 1);
+
+	void BM_FromDataref(benchmark::State& state) {
+		const auto& value = VALUES[state.range(0)];
+		const auto ref = XPLMFindDataRef(value.dataref);
+		state.SetLabel(value.dataref);
+		for (auto _ : state) {
+			auto data = EnvData::fromDataref(value.dataref, ref);
+			benchmark::DoNotOptimize(data.arrayElemCount);
+		}
+	}
+	BENCHMARK(BM_FromDataref)->DenseRange(0, VALUE_TYPES - 1);
+
+	void BM_AppendTo(benchmark::State& state) {
+		const auto& value = VALUES[state.range(0)];
+		const auto data = EnvData::fromDataref(value.dataref, XPLMFindDataRef(value.dataref));
+		std::array<std::byte, 16 * 1024> buffer;
+		state.SetLabel(value.dataref);
+		for (auto _ : state) {
+			std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+			std::pmr::string text(&arena);
+			data.AppendTo(text);
+			benchmark::DoNotOptimize(text.data());
+		}
+	}
+	BENCHMARK(BM_AppendTo)->DenseRange(0, VALUE_TYPES - 1);
+
+	/* DataCache */
+
+	void BM_DataCacheHit(benchmark::State& state) {
+		DataCache<std::string, XPLMDataRef> cache([](const std::string& key) { return XPLMFindDataRef(key.c_str()); });
+		const std::string_view name = "sim/flightmodel/position/indicated_airspeed";
+		cache.Get(name);
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(cache.Get(name));
+		}
+	}
+	BENCHMARK(BM_DataCacheHit);
+
+	void BM_DataCacheMiss(benchmark::State& state) {
+		// a miss is the first lookup of a name, so each is new until the cache is cleared
+		constexpr size_t NAMES = 1024;
+		std::vector<std::string> names;
+		for (size_t i = 0; i < NAMES; i++) {
+			names.push_back("sim/bench/missing_" + std::to_string(i));
+		}
+		DataCache<std::string, XPLMDataRef> cache([](const std::string& key) { return XPLMFindDataRef(key.c_str()); });
+		size_t next = 0;
+		for (auto _ : state) {
+			if (next == NAMES) {
+				state.PauseTiming();
+				cache.Clear();
+				next = 0;
+				state.ResumeTiming();
+			}
+			benchmark::DoNotOptimize(cache.Get(std::string_view(names[next++])));
+		}
+	}
+	BENCHMARK(BM_DataCacheMiss);
+
+	/* Logger */
+
+	void BM_LogOff(benchmark::State& state) {
+		auto& log = Logger::get();
+		log.SetMinLevel(Logger::Level::Warn);
+		for (auto _ : state) {
+			log.Info("Received request: {}", std::string_view(GET));
+		}
+	}
+	BENCHMARK(BM_LogOff);
+
+	void BM_LogOn(benchmark::State& state) {
+		auto& log = Logger::get();
+		log.SetMinLevel(Logger::Level::Info);
+		const uint64_t dropped = log.Dropped();
+		for (auto _ : state) {
+			log.Info("Received request: {}", std::string_view(GET));
+		}
+		log.SetMinLevel(Logger::Level::Warn);
+		// once the ring is full a call is a drop rather than a push, which is cheaper, so say what share of them were
+		state.counters["dropped"] = benchmark::Counter(static_cast<double>(log.Dropped() - dropped), benchmark::Counter::kAvgIterations);
+	}
+	BENCHMARK(BM_LogOn);
+}
+
+int main(int argc, char** argv) {
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) { return 1; }
+
+	standin::SetVerbose(std::getenv("VERBOSE") != nullptr);
+	addDatarefs();
+	// records are written out and thrown away, so the ring is drained as it would be in the sim
+	Logger::get().Start("/dev/null");
+	{
+		Link link;
+		link.Start();
+		client = standin::PipeClient::Connect(4096);
+
+		benchmark::RunSpecifiedBenchmarks();
+
+		link.Stop();
+		client.reset();
+	}
+	Logger::get().Stop();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -0,0 +1,367 @@
+// Replay.cpp : plays a capture made with capture:start back into Link,
+// against the stand-in XPLM, to reproduce a session offline and profile it.
+//
+// Every connection in the capture becomes a client of its own, sending the
+// messages it sent in the order it sent them. At original timing each
+// connection opens, and each message is sent, at the same point after the
+// start as in the capture, or as soon as the reply to the previous one is in
+// if that is later. With --fast, every connection starts at once and sends
+// each message as soon as its last reply arrives, with frames run back to
+// back.
+//
+// The stand-in is set up from the capture: each dataref a get or set names,
+// with the type and value from its first recorded get reply, or the type from
+// a set if it was never read. Datarefs and commands that the sim said didn't
+// exist are left out, and datarefs it refused to set are made read only, so
+// errors replay as they happened. Log subscriptions and capture requests are
+// not replayed.
+//
+// It reports latency as recorded and as replayed, and every reply code (a
+// reply in braces) that came back different from the capture.
+//
+//     Replay XP11_VA_Link.capture [--fast] [--frame-rate 60]
+//
+// Linux: the Replay target in ../CMakeLists.txt.
+
+#include "pch.h"
+#include "xp11_va/Capture.h"
+#include "xp11_va/EnvData.h"
+#include "xp11_va/LatencyHistogram.h"
+#include "xp11_va/Link.h"
+#include "xp11_va/Logger.h"
+#include "StandIn.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+
+using namespace xp11_va;
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	// one message from the capture, with the response it got
+	struct Message {
+		std::chrono::nanoseconds sent{};
+		std::chrono::nanoseconds answered{};
+		std::string text;
+		std::string response;
+		bool answeredInCapture = false;
+	};
+
+	struct RecordedConnection {
+		uint64_t id = 0;
+		std::chrono::nanoseconds opened{};
+		std::vector<Message> messages;
+	};
+
+	std::vector<std::string_view> split(std::string_view text, char separator) {
+		std::vector<std::string_view> parts;
+		for (size_t start = 0;;) {
+			const size_t end = text.find(separator, start);
+			parts.push_back(text.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start));
+			if (end == std::string_view::npos) { return parts; }
+			start = end + 1;
+		}
+	}
+
+	std::string_view trimNewline(std::string_view text) {
+		while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) { text.remove_suffix(1); }
+		return text;
+	}
+
+	// a request's parts without the priority and read phase in front of it
+	std::vector<std::string_view> requestParts(std::string_view request) {
+		auto parts = split(request, ':');
+		size_t prefixes = 0;
+		while (prefixes < 2 && parts.size() > prefixes + 1) {
+			const auto prefix = parts[prefixes];
+			if (prefix != "interactive" && prefix != "normal" && prefix != "bulk" && prefix != "before_fm" && prefix != "after_fm") { break; }
+			prefixes++;
+		}
+		parts.erase(parts.begin(), parts.begin() + prefixes);
+		return parts;
+	}
+
+	bool isCode(std::string_view reply) {
+		return reply.size() >= 2 && reply.front() == '{' && reply.back() == '}';
+	}
+
+	/* reading the capture */
+
+	std::vector<RecordedConnection> readCapture(const std::string& path, uint64_t& skipped) {
+		Capture::Reader reader(path);
+		if (!reader.IsOpen()) {
+			std::fprintf(stderr, "%s isn't a capture\n", path.c_str());
+			std::exit(2);
+		}
+
+		std::map<uint64_t, RecordedConnection> connections;
+		// connections that subscribed to the log, which stream from then on and are replayed no further
+		std::set<uint64_t> streaming;
+		Capture::Entry entry;
+		while (reader.Next(entry)) {
+			auto [it, added] = connections.try_emplace(entry.connection);
+			auto& connection = it->second;
+			if (added) {
+				connection.id = entry.connection;
+				connection.opened = entry.time;
+			}
+			if (streaming.count(entry.connection)) { continue; }
+
+			if (entry.kind == Capture::Kind::Message) {
+				bool replayable = true;
+				for (const auto request : split(entry.text, ';')) {
+					const auto parts = requestParts(request);
+					if (parts[0] == "capture") { replayable = false; }
+					if (parts[0] == "logs" && parts.size() > 1 && parts[1] == "subscribe") {
+						replayable = false;
+						streaming.insert(entry.connection);
+					}
+				}
+				if (!replayable) {
+					skipped++;
+					continue;
+				}
+				connection.messages.push_back(Message{ entry.time, {}, std::move(entry.text), {}, false });
+			}
+			else if (entry.kind == Capture::Kind::Response) {
+				// a response whose message came before the capture started, or wasn't replayable, has nothing to pair with
+				if (!connection.messages.empty() && !connection.messages.back().answeredInCapture) {
+					auto& message = connection.messages.back();
+					message.response = std::string(trimNewline(entry.text));
+					message.answered = entry.time;
+					message.answeredInCapture = true;
+				}
+			}
+		}
+
+		std::vector<RecordedConnection> result;
+		for (auto& [id, connection] : connections) {
+			if (!connection.messages.empty()) { result.push_back(std::move(connection)); }
+		}
+		return result;
+	}
+
+	/* setting up the stand-in */
+
+	struct DatarefSeen {
+		std::string type;
+		// from the first get reply, if it had one
+		std::optional<std::string> value;
+		size_t size = 1;
+		bool exists = true;
+		bool writable = true;
+	};
+
+	// gives a dataref the value a get replied with, which is formatted as the one type EnvData::fromString parses it as
+	void seed(const std::string& name, XPLMDataRef ref, XPLMDataTypeID types, std::string_view value) {
+		const char* type = types & xplmType_Double ? "4"
+			: types & xplmType_Float ? "2"
+			: types & xplmType_Int ? "1"
+			: types & xplmType_FloatArray ? "8"
+			: types & xplmType_IntArray ? "16"
+			: "32";
+		// data goes out as its bytes separated by commas, and is set from the bytes alone
+		std::string bytes;
+		if (types == xplmType_Data) {
+			for (size_t i = 0; i < value.size(); i += 2) { bytes.push_back(value[i]); }
+			value = bytes;
+		}
+		try {
+			EnvData::fromString(name, type, value).WriteTo(ref);
+		}
+		catch (const std::exception& e) {
+			std::fprintf(stderr, "couldn't give %s its recorded value: %s\n", name.c_str(), e.what());
+		}
+	}
+
+	void setUpStandIn(const std::vector<RecordedConnection>& connections) {
+		std::map<std::string, DatarefSeen, std::less<>> datarefs;
+		std::map<std::string, bool, std::less<>> commands;
+
+		for (const auto& connection : connections) {
+			for (const auto& message : connection.messages) {
+				const auto requests = split(message.text, ';');
+				const auto replies = split(message.response, ';');
+				for (size_t i = 0; i < requests.size(); i++) {
+					const auto parts = requestParts(requests[i]);
+					const auto reply = message.answeredInCapture && replies.size() == requests.size() ? replies[i] : std::string_view{};
+					if (parts.size() < 2) { continue; }
+
+					if (parts[0] == "cmd") {
+						auto& exists = commands.try_emplace(std::string(parts[1]), true).first->second;
+						if (reply == "{invalid_command}") { exists = false; }
+						continue;
+					}
+					if (parts[0] != "get" && parts[0] != "set") { continue; }
+
+					auto& seen = datarefs.try_emplace(std::string(parts[1])).first->second;
+					if (reply == "{invalid_dataref}") { seen.exists = false; }
+					if (reply == "{dataref_not_writable}") { seen.writable = false; }
+
+					// a get reply is name:type:value, a set is set:name:type:value, and the value runs to the end either way
+					const auto rest = [](std::string_view whole, std::string_view from) {
+						return whole.substr(static_cast<size_t>(from.data() - whole.data()));
+					};
+					std::string_view type, value;
+					if (parts[0] == "get" && !reply.empty() && !isCode(reply)) {
+						const auto reply_parts = split(reply, ':');
+						if (reply_parts.size() < 3 || seen.value) { continue; }
+						type = reply_parts[1];
+						value = rest(reply, reply_parts[2]);
+						seen.value = std::string(value);
+					}
+					else if (parts[0] == "set" && parts.size() >= 4 && seen.type.empty()) {
+						type = parts[2];
+						value = rest(requests[i], parts[3]);
+					}
+					else {
+						continue;
+					}
+					seen.type = std::string(type);
+					seen.size = std::max(seen.size, static_cast<size_t>(std::count(value.begin(), value.end(), ',') + 1));
+				}
+			}
+		}
+
+		size_t added = 0;
+		for (const auto& [name, seen] : datarefs) {
+			// a get that only ever timed out gives nothing to go on, a float is as good a guess as any
+			const auto type = seen.type.empty() ? std::string("2") : seen.type;
+			if (!seen.exists) { continue; }
+			const auto types = static_cast<XPLMDataTypeID>(std::atoi(type.c_str()));
+			const auto ref = standin::AddDataref(name, types, seen.size);
+			if (seen.value) {
+				seed(name, ref, types, *seen.value);
+			}
+			standin::SetWritable(ref, seen.writable);
+			added++;
+		}
+		size_t added_commands = 0;
+		for (const auto& [name, exists] : commands) {
+			if (!exists) { continue; }
+			standin::AddCommand(name);
+			added_commands++;
+		}
+		std::printf("stand-in set up with %zu datarefs and %zu commands\n", added, added_commands);
+	}
+
+	/* replaying */
+
+	struct Results {
+		LatencyHistogram recorded;
+		LatencyHistogram replayed;
+		std::atomic<uint64_t> messages{ 0 };
+		std::atomic<uint64_t> failures{ 0 };
+		std::mutex mutex;
+		// what differed, and how often
+		std::map<std::string, uint64_t> mismatches;
+	};
+
+	void replayConnection(const RecordedConnection& connection, bool fast, Clock::time_point start, Results& results) {
+		if (!fast) { std::this_thread::sleep_until(start + connection.opened); }
+		auto client = standin::PipeClient::Connect(4096);
+
+		std::map<std::string, uint64_t> mismatches;
+		std::string response;
+		for (const auto& message : connection.messages) {
+			if (!fast) { std::this_thread::sleep_until(start + message.sent); }
+			const auto sent = Clock::now();
+			if (!client->Send(message.text) || !client->Receive(response, std::chrono::seconds(30))) {
+				results.failures++;
+				break;
+			}
+			results.replayed.Record(Clock::now() - sent);
+			results.messages++;
+			if (!message.answeredInCapture) { continue; }
+			results.recorded.Record(message.answered - message.sent);
+
+			// values depend on the sim, codes should not
+			const auto then = split(message.response, ';');
+			const auto now = split(trimNewline(response), ';');
+			for (size_t i = 0; i < std::min(then.size(), now.size()); i++) {
+				if ((isCode(then[i]) || isCode(now[i])) && then[i] != now[i]) {
+					mismatches[std::string(isCode(then[i]) ? then[i] : "value") + " -> " + std::string(isCode(now[i]) ? now[i] : "value")]++;
+				}
+			}
+		}
+		client->Close();
+
+		std::lock_guard lock(results.mutex);
+		for (const auto& [what, count] : mismatches) {
+			results.mismatches[what] += count;
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: Replay capture [--fast] [--frame-rate 60]\n");
+		return 2;
+	}
+	bool fast = false;
+	double frame_rate = 60;
+	for (int i = 2; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (arg == "--fast") { fast = true; }
+		else if (arg == "--frame-rate" && i + 1 < argc) { frame_rate = std::strtod(argv[++i], nullptr); }
+	}
+
+	uint64_t skipped = 0;
+	const auto connections = readCapture(argv[1], skipped);
+	size_t total = 0;
+	std::chrono::nanoseconds span{};
+	for (const auto& connection : connections) {
+		total += connection.messages.size();
+		span = std::max(span, connection.messages.back().sent);
+	}
+	std::printf("%zu connections, %zu messages over %.1fs, %llu not replayed\n", connections.size(), total,
+		std::chrono::duration<double>(span).count(), static_cast<unsigned long long>(skipped));
+
+	standin::SetVerbose(std::getenv("VERBOSE") != nullptr);
+	setUpStandIn(connections);
+	Logger::get().Start("/dev/null");
+
+	Results results;
+	double seconds = 0;
+	{
+		Link link;
+		standin::Driver driver(fast ? 0 : frame_rate);
+		link.Start();
+
+		const auto start = Clock::now();
+		std::vector<std::thread> threads;
+		for (const auto& connection : connections) {
+			threads.emplace_back(replayConnection, std::cref(connection), fast, start, std::ref(results));
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		link.Stop();
+		driver.Stop();
+	}
+	Logger::get().Stop();
+
+	const auto ms = [](std::chrono::nanoseconds ns) { return ns.count() / 1e6; };
+	std::printf("replayed %llu messages in %.1fs (%.0f/s)%s\n", static_cast<unsigned long long>(results.messages.load()), seconds,
+		results.messages / seconds, fast ? ", as fast as possible" : "");
+	std::printf("%-10s %10s %10s %10s %10s\n", "latency", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+	for (const auto& [name, latency] : { std::pair<const char*, const LatencyHistogram*>{ "recorded", &results.recorded }, { "replayed", &results.replayed } }) {
+		std::printf("%-10s %10.2f %10.2f %10.2f %10.2f\n", name, ms(latency->Percentile(0.5)), ms(latency->Percentile(0.99)),
+			ms(latency->Percentile(0.999)), ms(latency->Max()));
+	}
+	if (!results.mismatches.empty()) {
+		std::printf("replies that came back different\n");
+		for (const auto& [what, count] : results.mismatches) {
+			std::printf("  %-48s %10llu\n", what.c_str(), static_cast<unsigned long long>(count));
+		}
+	}
+	if (results.failures > 0) {
+		std::printf("%llu connections lost their pipe\n", static_cast<unsigned long long>(results.failures.load()));
+	}
+	return results.failures == 0 ? 0 : 1;
+}
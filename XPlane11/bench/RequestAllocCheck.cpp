@@ -0,0 +1,180 @@
+// RequestAllocCheck.cpp : checks that handling a pipe message makes no heap
+// allocations once a connection has warmed up.
+//
+// Built with XP11VA_TRACK_ALLOCATIONS, so AllocTracker counts every call to
+// global operator new by region. Link is run as in the plugin, against the
+// stand-in XPLM and pipes in ../standin, with this thread playing the sim
+// thread and running frames until each response has been written. Every
+// message is sent a few times first, so that the connection's arena, frame
+// pool and scheduler queues have grown to fit it, then sent again while the
+// totals are watched.
+//
+// Successful requests and error replies must not allocate anywhere. Error
+// replies are logged, and log calls format straight into the logger's ring,
+// so logging them doesn't allocate either. Frames with nothing queued and
+// frames that leave work for later must not allocate either.
+//
+// Linux: the RequestAllocCheck target in ../CMakeLists.txt.
+//
+// Windows: build it with the sources of that target and the plugin's pch.h,
+// WinFutex.cpp in place of LinFutex.cpp, and without XPLM_64.lib. Exits
+// non-zero if any message allocated.
+
+#include "pch.h"
+#include "xp11_va/AllocTracker.h"
+#include "xp11_va/Link.h"
+#include "StandIn.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef XP11VA_TRACK_ALLOCATIONS
+#error RequestAllocCheck needs XP11VA_TRACK_ALLOCATIONS defined
+#endif
+
+using namespace xp11_va;
+
+namespace {
+	XPLMCommandRef testCommand = nullptr;
+	std::shared_ptr<standin::PipeClient> client;
+	// reused for every response, so receiving doesn't allocate once it has grown
+	std::string response;
+
+	void addDatarefs() {
+		XPLMSetDatai(standin::AddDataref("test/int", xplmType_Int), 42);
+		XPLMSetDataf(standin::AddDataref("test/float", xplmType_Float), 1.5f);
+		float values[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+		XPLMSetDatavf(standin::AddDataref("test/float_array", xplmType_FloatArray, 8), values, 0, 8);
+		testCommand = standin::AddCommand("test/command");
+	}
+
+	// Link's flight loops ask to run every quarter of a second, so every frame here is a quarter of a second long
+	void frame() {
+		standin::RunFrame(0.25f);
+	}
+
+	// sends the message and runs frames until it has been answered, like a client that waits for each response
+	const std::string& exchange(const std::string& request) {
+		client->Send(request);
+		while (!client->TryReceive(response)) {
+			frame();
+		}
+		return response;
+	}
+}
+
+namespace {
+	struct Allocations {
+		uint64_t count = 0;
+		uint64_t bytes = 0;
+	};
+
+	Allocations allocatedIn(std::initializer_list<AllocRegion> regions) {
+		Allocations total;
+		for (const auto region : regions) {
+			const auto totals = AllocTracker::Region(region);
+			total.count += totals.allocations;
+			total.bytes += totals.bytes;
+		}
+		return total;
+	}
+
+	const std::initializer_list<AllocRegion> EVERYWHERE = { AllocRegion::Other, AllocRegion::SimThread, AllocRegion::IoThread, AllocRegion::Logger };
+	const std::initializer_list<AllocRegion> SIM_THREAD = { AllocRegion::SimThread };
+
+	constexpr int WARM_UP = 8;
+	constexpr int MEASURED = 100;
+
+	// sends the message until warmed up, then MEASURED more times, and reports what was allocated in the regions given
+	bool check(const std::string& message, std::initializer_list<AllocRegion> regions, const char* where) {
+		for (int i = 0; i < WARM_UP; i++) {
+			exchange(message);
+		}
+
+		const auto before = allocatedIn(regions);
+		for (int i = 0; i < MEASURED; i++) {
+			exchange(message);
+		}
+		const auto after = allocatedIn(regions);
+
+		const bool ok = after.count == before.count;
+		std::printf("%-4s %-10s %-64s %8.2f allocs/msg %10.1f bytes/msg -> %s",
+			ok ? "ok" : "FAIL", where, message.c_str(),
+			(after.count - before.count) / static_cast<double>(MEASURED), (after.bytes - before.bytes) / static_cast<double>(MEASURED),
+			exchange(message).c_str());
+		return ok;
+	}
+
+	bool checkIdleFrames() {
+		const auto before = allocatedIn(SIM_THREAD);
+		for (int i = 0; i < MEASURED; i++) {
+			frame();
+		}
+		const auto after = allocatedIn(SIM_THREAD);
+
+		const bool ok = after.count == before.count;
+		std::printf("%-4s %-10s %-64s %8.2f allocs/frame\n", ok ? "ok" : "FAIL", "sim", "(idle frames)", (after.count - before.count) / static_cast<double>(MEASURED));
+		return ok;
+	}
+}
+
+int main() {
+	const std::string messages[] = {
+		"ping",
+		"get:test/int",
+		"get:test/int;get:test/float;get:test/float_array",
+		"set:test/int:1:7;get:test/int",
+		"set:test/float_array:8:0.5,1.5,2.5,3.5;get:test/float_array",
+		"cmd:test/command:once;ping",
+		"interactive:get:test/int;bulk:after_fm:get:test/float",
+		"opt:request_timeout:5000;opt:weight:2",
+		"stats:latency",
+		"stats:introspect",
+		"stats:locks",
+		// with no frame budget the bulk lane runs one task per frame, so this is spread over three frames
+		"bulk:get:test/int;bulk:get:test/float;bulk:get:test/float_array",
+	};
+	const std::string errors[] = {
+		"get:test/missing;cmd:test/missing:once;nonsense",
+		"set:test/float_array:4:0.5;set:test/missing:1:3",
+	};
+
+	standin::SetVerbose(std::getenv("VERBOSE") != nullptr);
+	addDatarefs();
+	response.reserve(4096);
+	int failures = 0;
+	int checks = 0;
+	{
+		LinkOptions options;
+		options.scheduler.frameBudget = std::chrono::microseconds(0);
+		options.scheduler.minTasksPerLane = 1;
+		Link link(options);
+		link.Start();
+		client = standin::PipeClient::Connect(4096);
+
+		for (const auto& message : messages) {
+			failures += check(message, EVERYWHERE, "anywhere") ? 0 : 1;
+			checks++;
+		}
+		for (const auto& message : errors) {
+			failures += check(message, EVERYWHERE, "anywhere") ? 0 : 1;
+			checks++;
+		}
+		failures += checkIdleFrames() ? 0 : 1;
+		checks++;
+
+		std::printf("stats:alloc -> %s", exchange("stats:alloc").c_str());
+		std::printf("stats:latency -> %s", exchange("stats:latency").c_str());
+		std::printf("stats:introspect -> %s", exchange("stats:introspect").c_str());
+		std::printf("stats:locks -> %s", exchange("stats:locks").c_str());
+		for (const char* name : { "xp11va/perf/loop_us_avg", "xp11va/perf/loop_us_max", "xp11va/perf/tasks_per_frame", "xp11va/perf/queue_depth" }) {
+			const auto ref = XPLMFindDataRef(name);
+			std::printf("%s = %g\n", name, XPLMGetDataRefTypes(ref) == xplmType_Int ? XPLMGetDatai(ref) : XPLMGetDataf(ref));
+		}
+		link.Stop();
+		client.reset();
+	}
+
+	std::printf("%d of %d checks allocated\n", failures, checks);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+// StandInLatency.cpp : how long Link takes to answer a client, and how many
+// messages it gets through, with flight loops run at a given frame rate.
+//
+// Link runs as in the plugin, against the stand-in XPLM and pipes in
+// ../standin. A driver thread plays the sim and runs frames at the rate
+// given. Each client connects, then sends a message of a few gets and a set,
+// waits for the response and sends the next, for as long as the run lasts.
+// Every response is timed from send to receive.
+//
+// Sim time only moves with frames, so the flight loops run on the same
+// frames from run to run. With a frame rate of 0, frames are run back to back
+// and what is measured is Link's own overhead rather than time spent waiting
+// for the next frame.
+//
+//     StandInLatency [frame rate, 60] [clients, 1] [seconds, 5]
+//
+// Linux: the StandInLatency target in ../CMakeLists.txt.
+
+#include "pch.h"
+#include "xp11_va/LatencyHistogram.h"
+#include "xp11_va/Link.h"
+#include "xp11_va/Logger.h"
+#include "StandIn.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace xp11_va;
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	const std::string MESSAGE = "get:sim/flightmodel/position/indicated_airspeed;get:sim/cockpit2/gauges/indicators/altitude_ft_pilot;"
+		"get:sim/cockpit2/switches/panel_brightness_ratio;set:sim/cockpit/autopilot/heading_mag:2:270.0";
+
+	void addDatarefs() {
+		XPLMSetDataf(standin::AddDataref("sim/flightmodel/position/indicated_airspeed", xplmType_Float, 1, false), 143.25f);
+		XPLMSetDataf(standin::AddDataref("sim/cockpit2/gauges/indicators/altitude_ft_pilot", xplmType_Float, 1, false), 8500.0f);
+		standin::AddDataref("sim/cockpit2/switches/panel_brightness_ratio", xplmType_FloatArray, 4);
+		standin::AddDataref("sim/cockpit/autopilot/heading_mag", xplmType_Float);
+	}
+
+	// any reply in braces other than {ok}
+	bool hasError(std::string_view response) {
+		for (size_t brace = response.find('{'); brace != std::string_view::npos; brace = response.find('{', brace + 1)) {
+			if (response.substr(brace, 4) != "{ok}") { return true; }
+		}
+		return false;
+	}
+
+	struct ClientResult {
+		uint64_t messages = 0;
+		uint64_t errors = 0;
+	};
+}
+
+int main(int argc, char** argv) {
+	const double hz = argc > 1 ? std::strtod(argv[1], nullptr) : 60;
+	const int clients = argc > 2 ? std::atoi(argv[2]) : 1;
+	const double seconds = argc > 3 ? std::strtod(argv[3], nullptr) : 5;
+
+	standin::SetVerbose(std::getenv("VERBOSE") != nullptr);
+	addDatarefs();
+	Logger::get().Start("/dev/null");
+
+	LatencyHistogram latency;
+	std::vector<ClientResult> results(clients);
+	uint64_t frames = 0;
+	Clock::duration elapsed{};
+	{
+		Link link;
+		standin::Driver driver(hz);
+		link.Start();
+
+		std::vector<std::thread> threads;
+		const auto start = Clock::now();
+		const auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+		for (int c = 0; c < clients; c++) {
+			threads.emplace_back([&, c]() {
+				auto client = standin::PipeClient::Connect();
+				std::string response;
+				while (Clock::now() < end) {
+					const auto sent = Clock::now();
+					if (!client->Send(MESSAGE) || !client->Receive(response)) {
+						results[c].errors++;
+						break;
+					}
+					latency.Record(Clock::now() - sent);
+					results[c].messages++;
+					if (hasError(response)) { results[c].errors++; }
+				}
+			});
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		elapsed = Clock::now() - start;
+
+		frames = standin::Frames();
+		link.Stop();
+		driver.Stop();
+	}
+	Logger::get().Stop();
+
+	uint64_t messages = 0;
+	uint64_t errors = 0;
+	for (const auto& result : results) {
+		messages += result.messages;
+		errors += result.errors;
+	}
+	const double run_seconds = std::chrono::duration<double>(elapsed).count();
+	const auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1000.0; };
+
+	if (hz > 0) {
+		std::printf("%d clients, frames at %gHz, %.1fs\n", clients, hz, run_seconds);
+	}
+	else {
+		std::printf("%d clients, frames back to back, %.1fs\n", clients, run_seconds);
+	}
+	std::printf("%llu frames, %llu messages (%.0f/s), %llu with errors\n", static_cast<unsigned long long>(frames),
+		static_cast<unsigned long long>(messages), messages / run_seconds, static_cast<unsigned long long>(errors));
+	std::printf("latency p50 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus\n",
+		us(latency.Percentile(0.5)), us(latency.Percentile(0.99)), us(latency.Percentile(0.999)), us(latency.Max()));
+	return errors == 0 ? 0 : 1;
+}
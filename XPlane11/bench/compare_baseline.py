@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+# compare_baseline.py : checks MicroBench results against a stored baseline.
+#
+# Both files are Google Benchmark JSON (--benchmark_out_format=json). Each
+# benchmark in the results is matched with the one of the same name in the
+# baseline and their wall clock times compared, since most of a message
+# through Link is spent on threads other than the benchmark's. Any that is more
+# than the threshold slower is a regression, and the script exits non-zero if
+# there are any. Benchmarks missing from either file are listed but don't fail
+# the check.
+#
+#     MicroBench --benchmark_repetitions=5 --benchmark_out=results.json --benchmark_out_format=json
+#     compare_baseline.py baseline/MicroBench.json results.json [--threshold 0.25]
+#     compare_baseline.py --update baseline/MicroBench.json results.json
+#
+# Timings only compare on the machine the baseline was taken on, so update it
+# there whenever a change is meant to move the numbers. Even there, medians of
+# five repetitions move by up to 20% between runs on a busy machine, which is
+# why the default threshold is 25%; pass a lower one on a quiet machine.
+
+import argparse
+import json
+import shutil
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    # with repetitions the median is compared, since a run disturbed by something else on the machine
+    # moves the mean a long way and the median hardly at all
+    benchmarks = {}
+    medians = set()
+    for b in data.get("benchmarks", []):
+        name = b.get("run_name", b["name"])
+        if b.get("run_type") == "aggregate":
+            if b.get("aggregate_name") == "median":
+                benchmarks[name] = b
+                medians.add(name)
+        elif name not in medians:
+            benchmarks[name] = b
+    return benchmarks
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare MicroBench results with a baseline")
+    parser.add_argument("baseline")
+    parser.add_argument("results")
+    parser.add_argument("--threshold", type=float, default=0.25, help="slowdown that counts as a regression, 0.25 for 25%%")
+    parser.add_argument("--update", action="store_true", help="replace the baseline with the results")
+    args = parser.parse_args()
+
+    if args.update:
+        shutil.copyfile(args.results, args.baseline)
+        print(f"{args.baseline} updated from {args.results}")
+        return 0
+
+    baseline = load(args.baseline)
+    results = load(args.results)
+
+    regressions = 0
+    print(f"{'benchmark':<48} {'baseline':>12} {'now':>12} {'change':>8}")
+    for name, result in results.items():
+        base = baseline.get(name)
+        if base is None:
+            print(f"{name:<48} {'-':>12} {result['real_time']:>10.1f}{result['time_unit']:>2} {'new':>8}")
+            continue
+
+        # time units are the same unless a benchmark changed them, in which case compare in ns
+        scale = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}
+        before = base["real_time"] * scale[base["time_unit"]]
+        now = result["real_time"] * scale[result["time_unit"]]
+        change = (now - before) / before if before > 0 else 0
+        regressed = change > args.threshold
+        regressions += regressed
+        print(f"{name:<48} {before:>10.1f}ns {now:>10.1f}ns {change:>+7.1%}{'  REGRESSED' if regressed else ''}")
+
+    for name in baseline.keys() - results.keys():
+        print(f"{name:<48} missing from the results")
+
+    print(f"{regressions} of {len(results)} benchmarks regressed by more than {args.threshold:.0%}")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,331 @@
+#include "Client.h"
+
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+
+namespace xp11_va::client {
+	struct Dataref::Entry {
+		std::string name;
+		std::chrono::milliseconds ttl{};
+		// learnt from the first get, so a set can give it
+		std::atomic<int> type{ 0 };
+
+		// the last get's reply and when it arrived, guarded by the client's cacheMutex
+		std::optional<Reply> cached;
+		Client::Clock::time_point cachedAt{};
+	};
+
+	namespace {
+		constexpr int FLOAT_TYPE = 2;
+		const char* const PIPE_CLOSED = "{pipe_closed}";
+
+		const char* actionName(CommandAction action) {
+			switch (action) {
+			case CommandAction::Begin: return "begin";
+			case CommandAction::End: return "end";
+			case CommandAction::Once: return "once";
+			default: return "hold";
+			}
+		}
+	}
+
+	Replies ParseResponse(std::string_view response, size_t requests) {
+		while (!response.empty() && (response.back() == '\n' || response.back() == '\r')) { response.remove_suffix(1); }
+
+		Replies replies;
+		replies.reserve(requests);
+		if (requests == 1) {
+			// a lone reply is all of it, even a data value with a ';' in it
+			replies.push_back(Reply{ std::string(response) });
+			return replies;
+		}
+		for (size_t start = 0; replies.size() < requests;) {
+			const size_t end = response.find(';', start);
+			replies.push_back(Reply{ std::string(response.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start)) });
+			if (end == std::string_view::npos) { break; }
+			start = end + 1;
+		}
+		// fewer than asked for means the response wasn't for this message
+		while (replies.size() < requests) {
+			replies.push_back(Reply{ "{malformed_response}" });
+		}
+		return replies;
+	}
+
+	/* Dataref */
+
+	const std::string& Dataref::Name() const {
+		return entry->name;
+	}
+
+	/* Reply */
+
+	int Reply::Type() const {
+		if (IsCode()) { return 0; }
+		const size_t first = text.find(':');
+		if (first == std::string::npos) { return 0; }
+		int type = 0;
+		std::from_chars(text.data() + first + 1, text.data() + text.size(), type);
+		return type;
+	}
+
+	std::string_view Reply::Value() const {
+		if (IsCode()) { return {}; }
+		const size_t first = text.find(':');
+		const size_t second = first == std::string::npos ? first : text.find(':', first + 1);
+		if (second == std::string::npos) { return {}; }
+		return std::string_view(text).substr(second + 1);
+	}
+
+	double Reply::Number() const {
+		return std::strtod(std::string(Value()).c_str(), nullptr);
+	}
+
+	std::vector<double> Reply::Numbers() const {
+		std::vector<double> numbers;
+		const std::string value(Value());
+		for (const char* at = value.c_str(); *at != 0;) {
+			char* end;
+			numbers.push_back(std::strtod(at, &end));
+			if (*end != ',') { break; }
+			at = end + 1;
+		}
+		return numbers;
+	}
+
+	/* Batch */
+
+	Batch& Batch::Get(std::string_view dataref) {
+		return add("get:", dataref);
+	}
+
+	Batch& Batch::Get(const Dataref& dataref) {
+		reads.emplace_back(requests, dataref.entry);
+		return add("get:", dataref.Name());
+	}
+
+	Batch& Batch::Set(std::string_view dataref, int type, std::string_view value) {
+		char number[16];
+		const auto end = std::to_chars(number, number + sizeof(number), type).ptr;
+		add("set:", dataref, ":");
+		message.append(number, end);
+		message.push_back(':');
+		message.append(value);
+		return *this;
+	}
+
+	Batch& Batch::Set(const Dataref& dataref, std::string_view value) {
+		writes.push_back(dataref.entry);
+		const int type = dataref.entry->type.load(std::memory_order_relaxed);
+		return Set(dataref.Name(), type != 0 ? type : FLOAT_TYPE, value);
+	}
+
+	Batch& Batch::Command(std::string_view command, CommandAction action, std::chrono::milliseconds hold) {
+		add("interactive:cmd:", command, ":");
+		message.append(actionName(action));
+		if (action == CommandAction::Hold) {
+			message.push_back(':');
+			message.append(std::to_string(hold.count()));
+		}
+		return *this;
+	}
+
+	Batch& Batch::Ping() {
+		return add("ping", {});
+	}
+
+	Batch& Batch::Raw(std::string_view request) {
+		return add({}, request);
+	}
+
+	void Batch::Clear() {
+		message.clear();
+		requests = 0;
+		reads.clear();
+		writes.clear();
+	}
+
+	Batch& Batch::add(std::string_view prefix, std::string_view request, std::string_view suffix) {
+		if (requests > 0) { message.push_back(';'); }
+		message.append(prefix);
+		message.append(request);
+		message.append(suffix);
+		requests++;
+		return *this;
+	}
+
+	/* Client */
+
+	/* PUBLIC API */
+
+	Client::Client(std::unique_ptr<Transport> t, ClientOptions o) : transport(std::move(t)), options(o) {
+		reader = std::thread([this]() { readResponses(); });
+		writer = std::thread([this]() { writeMessages(); });
+	}
+
+	Client::~Client() {
+		Close();
+	}
+
+	bool Client::IsConnected() const {
+		std::lock_guard lock(pendingMutex);
+		return !closed;
+	}
+
+	Dataref Client::Find(std::string_view name, std::chrono::milliseconds ttl) {
+		std::lock_guard lock(cacheMutex);
+		auto it = cache.find(name);
+		if (it == cache.end()) {
+			auto entry = std::make_shared<Dataref::Entry>();
+			entry->name = std::string(name);
+			it = cache.emplace(entry->name, std::move(entry)).first;
+		}
+		it->second->ttl = ttl;
+		return Dataref(it->second);
+	}
+
+	void Client::Send(const Batch& batch, Callback callback) {
+		if (batch.Empty()) {
+			callback({});
+			return;
+		}
+
+		{
+			std::lock_guard lock(cacheMutex);
+			for (const auto& entry : batch.writes) {
+				entry->cached.reset();
+			}
+		}
+
+		{
+			std::unique_lock lock(pendingMutex);
+			const bool from_callback = std::this_thread::get_id() == reader.get_id();
+			pendingCv.wait(lock, [&]() { return closed || from_callback || pending.size() < options.maxInFlight; });
+			if (closed) {
+				lock.unlock();
+				Pending failed{ std::move(callback), batch.requests, {} };
+				fail(failed);
+				return;
+			}
+			// queued before it is written, so the reader always finds it
+			pending.push_back(Pending{ std::move(callback), batch.requests, batch.reads });
+			outbox.push_back(batch.message);
+		}
+		outboxCv.notify_one();
+	}
+
+	std::future<Replies> Client::Send(const Batch& batch) {
+		auto promise = std::make_shared<std::promise<Replies>>();
+		auto future = promise->get_future();
+		Send(batch, [promise](Replies replies) { promise->set_value(std::move(replies)); });
+		return future;
+	}
+
+	std::future<Reply> Client::Get(const Dataref& dataref) {
+		if (dataref.entry->ttl.count() > 0) {
+			std::lock_guard lock(cacheMutex);
+			if (dataref.entry->cached && Clock::now() - dataref.entry->cachedAt < dataref.entry->ttl) {
+				cacheHits++;
+				std::promise<Reply> promise;
+				promise.set_value(*dataref.entry->cached);
+				return promise.get_future();
+			}
+			cacheMisses++;
+		}
+		return sendOne(Batch().Get(dataref));
+	}
+
+	std::future<Reply> Client::Set(const Dataref& dataref, std::string_view value) {
+		return sendOne(Batch().Set(dataref, value));
+	}
+
+	std::future<Reply> Client::Command(std::string_view command, CommandAction action, std::chrono::milliseconds hold) {
+		return sendOne(Batch().Command(command, action, hold));
+	}
+
+	std::future<Reply> Client::Ping() {
+		return sendOne(Batch().Ping());
+	}
+
+	void Client::Close() {
+		if (transport) { transport->Close(); }
+		if (reader.joinable()) { reader.join(); }
+		if (writer.joinable()) { writer.join(); }
+	}
+
+	/* PRIVATE API */
+
+	void Client::readResponses() {
+		std::string response;
+		while (transport->Receive(response)) {
+			Pending next;
+			{
+				std::lock_guard lock(pendingMutex);
+				// a response nothing asked for, such as a log line, is no use to anyone
+				if (pending.empty()) { continue; }
+				next = std::move(pending.front());
+				pending.pop_front();
+			}
+			pendingCv.notify_all();
+
+			auto replies = ParseResponse(response, next.requests);
+			if (!next.reads.empty()) {
+				const auto now = Clock::now();
+				std::lock_guard lock(cacheMutex);
+				for (const auto& [position, entry] : next.reads) {
+					const auto& reply = replies[position];
+					if (reply.IsCode()) { continue; }
+					entry->type.store(reply.Type(), std::memory_order_relaxed);
+					entry->cached = reply;
+					entry->cachedAt = now;
+				}
+			}
+			next.callback(std::move(replies));
+		}
+
+		std::deque<Pending> failed;
+		{
+			std::lock_guard lock(pendingMutex);
+			closed = true;
+			failed.swap(pending);
+			outbox.clear();
+		}
+		pendingCv.notify_all();
+		outboxCv.notify_all();
+		for (auto& next : failed) {
+			fail(next);
+		}
+	}
+
+	// the reader thread never writes, so a callback that sends can't stop it reading the responses the plugin is
+	// waiting to write before it reads any more
+	void Client::writeMessages() {
+		std::string message;
+		while (true) {
+			{
+				std::unique_lock lock(pendingMutex);
+				outboxCv.wait(lock, [&]() { return closed || !outbox.empty(); });
+				if (closed) { return; }
+				message.swap(outbox.front());
+				outbox.pop_front();
+			}
+			if (!transport->Send(message)) {
+				// the reader sees the pipe close too, and fails whatever is still queued
+				transport->Close();
+				return;
+			}
+		}
+	}
+
+	void Client::fail(Pending& failed) {
+		failed.callback(Replies(failed.requests, Reply{ PIPE_CLOSED }));
+	}
+
+	std::future<Reply> Client::sendOne(const Batch& batch) {
+		auto promise = std::make_shared<std::promise<Reply>>();
+		auto future = promise->get_future();
+		Send(batch, [promise](Replies replies) { promise->set_value(std::move(replies.front())); });
+		return future;
+	}
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/*
+ * A client for the plugin's pipe protocol, for tools that talk to the sim
+ * faster than XP11Link.cs's one request and one ReadLine at a time allows.
+ *
+ * A Client writes messages and reads the responses on threads of its own,
+ * so many messages can be in flight on one connection, and nothing waits on
+ * the pipe in a callback. The plugin answers a connection's messages in the order they
+ * came, which is how each response finds its message. A Batch packs any
+ * number of requests into one message, which the plugin serves in a single
+ * frame.
+ *
+ * It doesn't need the X-Plane SDK. On Windows it opens the plugin's named
+ * pipe for overlapped I/O, so the reader thread's read doesn't hold up the
+ * writes. Linux builds connect to the stand-in XPLM in ../standin instead.
+ */
+namespace xp11_va::client {
+	// one message out, one message in, in order
+	class Transport {
+	public:
+		virtual ~Transport() = default;
+
+		// false once the pipe is closed
+		virtual bool Send(std::string_view message) = 0;
+		// waits for the next message, false once the pipe is closed
+		virtual bool Receive(std::string& message) = 0;
+		// makes a Receive in progress on another thread return false
+		virtual void Close() = 0;
+	};
+
+	// the plugin's named pipe on Windows, the stand-in's on Linux, nullptr if it couldn't connect
+	std::unique_ptr<Transport> ConnectPipe();
+
+	// the reply to one request
+	struct Reply {
+		std::string text;
+
+		// a code in braces, such as {ok} or {invalid_dataref}
+		bool IsCode() const { return text.size() >= 2 && text.front() == '{' && text.back() == '}'; }
+		// any code but {ok} and {pong}
+		bool IsError() const { return IsCode() && text != "{ok}" && text != "{pong}"; }
+
+		// for a get, which replies name:type:value, the type and the value. 0 and empty for anything else.
+		int Type() const;
+		std::string_view Value() const;
+		// the value as a number, or each element of an array as one
+		double Number() const;
+		std::vector<double> Numbers() const;
+	};
+	typedef std::vector<Reply> Replies;
+
+	// a dataref as the cache knows it, cheap to copy around
+	class Dataref {
+	public:
+		Dataref() = default;
+
+		const std::string& Name() const;
+		explicit operator bool() const { return entry != nullptr; }
+
+	private:
+		friend class Client;
+		friend class Batch;
+		struct Entry;
+		explicit Dataref(std::shared_ptr<Entry> e) : entry(std::move(e)) {}
+		std::shared_ptr<Entry> entry;
+	};
+
+	enum class CommandAction {
+		Begin,
+		End,
+		Once,
+		Hold
+	};
+
+	/*
+	 * Requests to send as one message. Replies come back in the order the
+	 * requests were added.
+	 */
+	class Batch {
+	public:
+		Batch& Get(std::string_view dataref);
+		Batch& Get(const Dataref&);
+		// type is the XPLMDataTypeID the plugin checks against, value as the protocol has it, arrays comma separated
+		Batch& Set(std::string_view dataref, int type, std::string_view value);
+		// takes the type from the dataref's last get, or float if it hasn't been read yet
+		Batch& Set(const Dataref&, std::string_view value);
+		// commands go in the interactive lane, as XP11Link.cs sends them
+		Batch& Command(std::string_view command, CommandAction, std::chrono::milliseconds hold = {});
+		Batch& Ping();
+		// any other request, as the protocol has it
+		Batch& Raw(std::string_view request);
+
+		size_t Size() const { return requests; }
+		bool Empty() const { return requests == 0; }
+		const std::string& Message() const { return message; }
+		void Clear();
+
+	private:
+		friend class Client;
+		std::string message;
+		size_t requests = 0;
+		// the datarefs read by this batch, by position, whose cache entries the replies update
+		std::vector<std::pair<size_t, std::shared_ptr<Dataref::Entry>>> reads;
+		// and those it sets, which are dropped from the cache
+		std::vector<std::shared_ptr<Dataref::Entry>> writes;
+
+		Batch& add(std::string_view prefix, std::string_view request, std::string_view suffix = {});
+	};
+
+	struct ClientOptions {
+		// how many messages may be waiting for their response before Send waits
+		size_t maxInFlight = 64;
+	};
+
+	class Client {
+	public:
+		typedef std::chrono::steady_clock Clock;
+		typedef std::function<void(Replies)> Callback;
+
+		explicit Client(std::unique_ptr<Transport>, ClientOptions = {});
+		~Client();
+		Client(const Client&) = delete;
+		Client& operator=(const Client&) = delete;
+
+		// false once the pipe has closed, after which every send fails with {pipe_closed}
+		bool IsConnected() const;
+
+		// looks the dataref up in the local cache, adding it. a ttl above zero lets Get answer
+		// from the cache for that long after a read, for datarefs that change slowly.
+		Dataref Find(std::string_view name, std::chrono::milliseconds ttl = {});
+
+		// queues the batch for the writer thread, then calls the callback with the replies on the client's reader
+		// thread. waits while maxInFlight messages are already waiting, except when called from a callback, which
+		// would wait on itself. a callback mustn't wait for a reply either. on a closed pipe every reply is {pipe_closed}.
+		void Send(const Batch&, Callback);
+		std::future<Replies> Send(const Batch&);
+
+		// one request each, Get answering from the cache when it can
+		std::future<Reply> Get(const Dataref&);
+		std::future<Reply> Set(const Dataref&, std::string_view value);
+		std::future<Reply> Command(std::string_view command, CommandAction, std::chrono::milliseconds hold = {});
+		std::future<Reply> Ping();
+
+		// closes the pipe, completing everything in flight with {pipe_closed}
+		void Close();
+
+		// how many gets were answered from the cache, and how many went to the plugin
+		uint64_t CacheHits() const { return cacheHits.load(std::memory_order_relaxed); }
+		uint64_t CacheMisses() const { return cacheMisses.load(std::memory_order_relaxed); }
+
+	private:
+		struct Pending {
+			Callback callback;
+			size_t requests = 0;
+			std::vector<std::pair<size_t, std::shared_ptr<Dataref::Entry>>> reads;
+		};
+
+		std::unique_ptr<Transport> transport;
+		const ClientOptions options;
+
+		// guards pending and outbox, which are added to together, so pending is in the order the plugin sees them
+		mutable std::mutex pendingMutex;
+		std::condition_variable pendingCv;
+		std::deque<Pending> pending;
+		// messages for the writer thread
+		std::condition_variable outboxCv;
+		std::deque<std::string> outbox;
+		bool closed = false;
+
+		std::mutex cacheMutex;
+		std::map<std::string, std::shared_ptr<Dataref::Entry>, std::less<>> cache;
+		std::atomic<uint64_t> cacheHits{ 0 };
+		std::atomic<uint64_t> cacheMisses{ 0 };
+
+		std::thread reader;
+		std::thread writer;
+
+		void readResponses();
+		void writeMessages();
+		void fail(Pending&);
+		// sends a batch of one request
+		std::future<Reply> sendOne(const Batch&);
+	};
+
+	// splits a response into the replies to each of its message's requests. the plugin has the one framing: requests
+	// separated by ';', and the replies to them the same way with a newline at the end.
+	Replies ParseResponse(std::string_view response, size_t requests);
+}
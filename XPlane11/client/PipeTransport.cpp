@@ -0,0 +1,114 @@
+#include "Client.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+// the stand-in is built with the plugin's headers
+#include "pch.h"
+#include "StandIn.h"
+#endif
+
+namespace xp11_va::client {
+	namespace {
+#ifdef _WIN32
+		const wchar_t* PIPE_NAME = L"\\\\.\\pipe\\{2145AB63-BF83-40A4-8A9D-A358D45AF1C1}";
+
+		// the client end of the plugin's pipe, opened in message mode as XP11Link.cs opens it. the handle is
+		// overlapped, as a synchronous one would run one call at a time, and a write would then wait behind the
+		// reader thread's ReadFile, which waits for the response to that write.
+		class WinPipeTransport : public Transport {
+		public:
+			explicit WinPipeTransport(HANDLE p) : pipe(p) {
+				readEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+				writeEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+			}
+			~WinPipeTransport() override {
+				CloseHandle(pipe);
+				if (readEvent) { CloseHandle(readEvent); }
+				if (writeEvent) { CloseHandle(writeEvent); }
+			}
+
+			bool IsOpen() const { return readEvent != nullptr && writeEvent != nullptr; }
+
+			bool Send(std::string_view message) override {
+				if (closed) { return false; }
+				OVERLAPPED overlapped{};
+				overlapped.hEvent = writeEvent;
+				if (!WriteFile(pipe, message.data(), static_cast<DWORD>(message.size()), nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING) {
+					return false;
+				}
+				DWORD written;
+				return GetOverlappedResult(pipe, &overlapped, &written, TRUE) != 0 && written == message.size();
+			}
+
+			bool Receive(std::string& message) override {
+				message.clear();
+				char buffer[4096];
+				while (!closed) {
+					OVERLAPPED overlapped{};
+					overlapped.hEvent = readEvent;
+					if (!ReadFile(pipe, buffer, sizeof(buffer), nullptr, &overlapped)) {
+						const DWORD error = GetLastError();
+						if (error != ERROR_IO_PENDING && error != ERROR_MORE_DATA) { return false; }
+						// Close may have cancelled what was in progress just before this read started
+						if (error == ERROR_IO_PENDING && closed) { CancelIoEx(pipe, &overlapped); }
+					}
+
+					DWORD read = 0;
+					const bool whole = GetOverlappedResult(pipe, &overlapped, &read, TRUE) != 0;
+					message.append(buffer, read);
+					if (whole) { return true; }
+					// the rest of a message longer than the buffer
+					if (GetLastError() != ERROR_MORE_DATA) { return false; }
+				}
+				return false;
+			}
+
+			void Close() override {
+				closed = true;
+				// a read in progress on the reader thread ends with ERROR_OPERATION_ABORTED
+				CancelIoEx(pipe, nullptr);
+			}
+
+		private:
+			HANDLE pipe;
+			// one each, the reader thread reads while senders write
+			HANDLE readEvent;
+			HANDLE writeEvent;
+			std::atomic_bool closed{ false };
+		};
+#else
+		class StandInTransport : public Transport {
+		public:
+			explicit StandInTransport(std::shared_ptr<standin::PipeClient> p) : pipe(std::move(p)) {}
+
+			bool Send(std::string_view message) override { return pipe->Send(message); }
+			// the stand-in's pipe only waits so long, a year is as good as for ever
+			bool Receive(std::string& message) override { return pipe->Receive(message, std::chrono::hours(24 * 365)); }
+			void Close() override { pipe->Close(); }
+
+		private:
+			std::shared_ptr<standin::PipeClient> pipe;
+		};
+#endif
+	}
+
+	std::unique_ptr<Transport> ConnectPipe() {
+#ifdef _WIN32
+		if (!WaitNamedPipeW(PIPE_NAME, 5000)) { return nullptr; }
+		HANDLE pipe = CreateFileW(PIPE_NAME, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+		if (pipe == INVALID_HANDLE_VALUE) { return nullptr; }
+		DWORD mode = PIPE_READMODE_MESSAGE;
+		if (!SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr)) {
+			CloseHandle(pipe);
+			return nullptr;
+		}
+		auto transport = std::make_unique<WinPipeTransport>(pipe);
+		if (!transport->IsOpen()) { return nullptr; }
+		return transport;
+#else
+		auto pipe = standin::PipeClient::Connect(4096);
+		return pipe ? std::make_unique<StandInTransport>(std::move(pipe)) : nullptr;
+#endif
+	}
+}
@@ -21,6 +21,11 @@ std::string what(const std::exception_ptr& e = std::current_exception()) {
 }
 
 PLUGIN_API int XPluginStart(char* outName, char* outSig, char* outDesc) {
+	// before anything else logs, so nothing is lost if the ring fills up
+	char system_path[512];
+	XPLMGetSystemPath(system_path);
+	logger.Start(std::string(system_path) + "XP11_VA_Link.log");
+
 	logger.Trace("XPluginStart enter");
 	strncpy_s(outName, 255, "XP11/VoiceAttack Connector", 255);
 	strncpy_s(outSig, 255, "ndjsoft.xp11va.connector", 255);
@@ -28,7 +33,10 @@ PLUGIN_API int XPluginStart(char* outName, char* outSig, char* outDesc) {
 
 	// ui = new xp11_va::UI();
 
-	link = std::make_unique<xp11_va::Link>();
+	xp11_va::LinkOptions options;
+	options.tracePath = std::string(system_path) + "XP11_VA_Link.trace.json";
+	options.capturePath = std::string(system_path) + "XP11_VA_Link.capture";
+	link = std::make_unique<xp11_va::Link>(options);
 
 	logger.Info("plugin started");
 
@@ -47,7 +55,7 @@ PLUGIN_API int XPluginEnable(void) {
 	try {
 		link->Start();
 	} catch (...) {
-		logger.Error("Unhandled exception: " + what());
+		logger.Error("Unhandled exception: {}", what());
 	}
 
 	logger.Info("plugin enabled");
@@ -68,7 +76,7 @@ PLUGIN_API void XPluginDisable() {
 	try {
 		link->Stop();
 	} catch (...) {
-		logger.Error("Unhandled exception: " + what());
+		logger.Error("Unhandled exception: {}", what());
 	}
 	
 	logger.Info("plugin disabled");
@@ -89,6 +97,7 @@ PLUGIN_API void XPluginStop() {
 	
 	logger.Info("plugin stopped");
 	logger.Trace("XPluginStop leave");
+	logger.Stop();
 }
 
 #ifdef _WIN32
@@ -7,7 +7,11 @@
 #ifndef PCH_H
 #define PCH_H
 
+#ifdef _WIN32
 #define IBM 1
+#else
+#define LIN 1
+#endif
 
 // add headers that you want to pre-compile here
 #include "framework.h"
@@ -17,13 +21,20 @@
 #include <XPLM/XPLMPlugin.h>
 #include <XPLM/XPLMUtilities.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <future>
 #include <list>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <thread>
 #include <vector>
@@ -0,0 +1,173 @@
+#include "pch.h"
+#include "AllocTracker.h"
+
+#ifdef XP11VA_TRACK_ALLOCATIONS
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#endif
+
+namespace xp11_va {
+	const char* AllocRegionName(AllocRegion region) {
+		switch (region) {
+		case AllocRegion::Other: return "other";
+		case AllocRegion::SimThread: return "sim_thread";
+		case AllocRegion::IoThread: return "io_thread";
+		case AllocRegion::Logger: return "logger";
+		}
+		return "unknown";
+	}
+
+#ifdef XP11VA_TRACK_ALLOCATIONS
+	namespace {
+		struct RegionCounters {
+			std::atomic<uint64_t> allocations{ 0 };
+			std::atomic<uint64_t> bytes{ 0 };
+			std::atomic<uint64_t> frees{ 0 };
+			std::atomic<uint64_t> freedBytes{ 0 };
+		};
+
+		// constant initialized, so they are usable from operator new before any constructors have run
+		std::array<RegionCounters, ALLOC_REGION_COUNT> regions;
+		thread_local AllocRegion currentRegion = AllocRegion::Other;
+		thread_local AllocTracker::Totals threadTotals;
+
+		// every block starts with its size, so delete knows how much is being freed
+		constexpr size_t HEADER_BYTES = alignof(std::max_align_t);
+
+		// over-aligned blocks have the size and where malloc's block starts just before them
+		struct AlignedHeader {
+			std::byte* block;
+			size_t size;
+		};
+
+		void countAllocation(size_t size) noexcept {
+			auto& region = regions[static_cast<size_t>(currentRegion)];
+			region.allocations.fetch_add(1, std::memory_order_relaxed);
+			region.bytes.fetch_add(size, std::memory_order_relaxed);
+			threadTotals.allocations++;
+			threadTotals.bytes += size;
+		}
+
+		void countFree(size_t size) noexcept {
+			auto& region = regions[static_cast<size_t>(currentRegion)];
+			region.frees.fetch_add(1, std::memory_order_relaxed);
+			region.freedBytes.fetch_add(size, std::memory_order_relaxed);
+			threadTotals.frees++;
+			threadTotals.freedBytes += size;
+		}
+
+		void* trackedAllocate(size_t size) noexcept {
+			auto* block = static_cast<std::byte*>(std::malloc(size + HEADER_BYTES));
+			if (!block) { return nullptr; }
+			*reinterpret_cast<size_t*>(block) = size;
+			countAllocation(size);
+			return block + HEADER_BYTES;
+		}
+
+		void trackedFree(void* p) noexcept {
+			if (!p) { return; }
+			auto* block = static_cast<std::byte*>(p) - HEADER_BYTES;
+			countFree(*reinterpret_cast<size_t*>(block));
+			std::free(block);
+		}
+
+		void* trackedAllocate(size_t size, std::align_val_t alignment) noexcept {
+			const auto align = static_cast<size_t>(alignment);
+			auto* block = static_cast<std::byte*>(std::malloc(size + sizeof(AlignedHeader) + align - 1));
+			if (!block) { return nullptr; }
+			const auto start = (reinterpret_cast<uintptr_t>(block) + sizeof(AlignedHeader) + align - 1) & ~(uintptr_t)(align - 1);
+			auto* p = reinterpret_cast<std::byte*>(start);
+			const AlignedHeader header{ block, size };
+			std::memcpy(p - sizeof(AlignedHeader), &header, sizeof(AlignedHeader));
+			countAllocation(size);
+			return p;
+		}
+
+		void trackedFree(void* p, std::align_val_t) noexcept {
+			if (!p) { return; }
+			AlignedHeader header;
+			std::memcpy(&header, static_cast<std::byte*>(p) - sizeof(AlignedHeader), sizeof(AlignedHeader));
+			countFree(header.size);
+			std::free(header.block);
+		}
+
+		template <typename... Alignment>
+		void* trackedNew(size_t size, Alignment... alignment) {
+			while (true) {
+				if (void* p = trackedAllocate(size, alignment...)) { return p; }
+				auto handler = std::get_new_handler();
+				if (!handler) { throw std::bad_alloc(); }
+				handler();
+			}
+		}
+	}
+
+	/* PUBLIC API */
+
+	AllocTracker::Scope::Scope(AllocRegion region) : previous(currentRegion) {
+		currentRegion = region;
+	}
+
+	AllocTracker::Scope::~Scope() {
+		currentRegion = previous;
+	}
+
+	AllocTracker::Totals AllocTracker::Region(AllocRegion region) {
+		const auto& counters = regions[static_cast<size_t>(region)];
+		return {
+			counters.allocations.load(std::memory_order_relaxed),
+			counters.bytes.load(std::memory_order_relaxed),
+			counters.frees.load(std::memory_order_relaxed),
+			counters.freedBytes.load(std::memory_order_relaxed)
+		};
+	}
+
+	AllocTracker::Totals AllocTracker::ThisThread() {
+		return threadTotals;
+	}
+
+	AllocRegion AllocTracker::CurrentRegion() {
+		return currentRegion;
+	}
+#else
+	AllocTracker::Totals AllocTracker::Region(AllocRegion) {
+		return {};
+	}
+
+	AllocTracker::Totals AllocTracker::ThisThread() {
+		return {};
+	}
+
+	AllocRegion AllocTracker::CurrentRegion() {
+		return AllocRegion::Other;
+	}
+#endif
+}
+
+#ifdef XP11VA_TRACK_ALLOCATIONS
+void* operator new(size_t size) { return xp11_va::trackedNew(size); }
+void* operator new[](size_t size) { return xp11_va::trackedNew(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return xp11_va::trackedAllocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return xp11_va::trackedAllocate(size); }
+
+void operator delete(void* p) noexcept { xp11_va::trackedFree(p); }
+void operator delete[](void* p) noexcept { xp11_va::trackedFree(p); }
+void operator delete(void* p, size_t) noexcept { xp11_va::trackedFree(p); }
+void operator delete[](void* p, size_t) noexcept { xp11_va::trackedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { xp11_va::trackedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { xp11_va::trackedFree(p); }
+
+// for alignas types above the default, such as the logger's cache-line aligned ring indices
+void* operator new(size_t size, std::align_val_t alignment) { return xp11_va::trackedNew(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return xp11_va::trackedNew(size, alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return xp11_va::trackedAllocate(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return xp11_va::trackedAllocate(size, alignment); }
+
+void operator delete(void* p, std::align_val_t alignment) noexcept { xp11_va::trackedFree(p, alignment); }
+void operator delete[](void* p, std::align_val_t alignment) noexcept { xp11_va::trackedFree(p, alignment); }
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept { xp11_va::trackedFree(p, alignment); }
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept { xp11_va::trackedFree(p, alignment); }
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept { xp11_va::trackedFree(p, alignment); }
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept { xp11_va::trackedFree(p, alignment); }
+#endif
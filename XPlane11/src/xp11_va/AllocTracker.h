@@ -0,0 +1,66 @@
+#pragma once
+
+namespace xp11_va {
+	// the part of the plugin a thread is working for, its allocations are counted against it
+	enum class AllocRegion : uint8_t {
+		Other,
+		SimThread,
+		IoThread,
+		Logger
+	};
+
+	constexpr size_t ALLOC_REGION_COUNT = 4;
+
+	const char* AllocRegionName(AllocRegion);
+
+	/*
+	 * Counts heap allocations made through global operator new, by the region
+	 * the allocating thread is in and by thread. Frees are counted against the
+	 * region of the thread that frees, which need not be the one that allocated.
+	 *
+	 * Only builds with XP11VA_TRACK_ALLOCATIONS defined replace operator new and
+	 * delete. Elsewhere every total is zero and scopes compile to nothing, so
+	 * the plugin can mark its regions without paying for it in release builds.
+	 */
+	class AllocTracker {
+	public:
+		struct Totals {
+			uint64_t allocations = 0;
+			uint64_t bytes = 0;
+			uint64_t frees = 0;
+			uint64_t freedBytes = 0;
+		};
+
+		// puts the calling thread in a region until the scope ends, scopes may nest
+		class Scope {
+		public:
+#ifdef XP11VA_TRACK_ALLOCATIONS
+			explicit Scope(AllocRegion);
+			~Scope();
+#else
+			explicit Scope(AllocRegion) {}
+#endif
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+#ifdef XP11VA_TRACK_ALLOCATIONS
+		private:
+			AllocRegion previous;
+#endif
+		};
+
+		static constexpr bool Enabled() {
+#ifdef XP11VA_TRACK_ALLOCATIONS
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		// everything counted against the region since the plugin was loaded
+		static Totals Region(AllocRegion);
+		// everything counted on the calling thread since it started, whatever region it was in
+		static Totals ThisThread();
+		static AllocRegion CurrentRegion();
+	};
+}
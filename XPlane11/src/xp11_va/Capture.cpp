@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "Capture.h"
+
+namespace xp11_va {
+	namespace {
+		// an unsigned LEB128 of a 64 bit number takes at most 10 bytes
+		constexpr size_t MAX_NUMBER_BYTES = 10;
+
+		size_t encodeNumber(uint64_t value, char* out) {
+			size_t length = 0;
+			do {
+				uint8_t byte = value & 0x7f;
+				value >>= 7;
+				if (value != 0) { byte |= 0x80; }
+				out[length++] = static_cast<char>(byte);
+			} while (value != 0);
+			return length;
+		}
+	}
+
+	/* PUBLIC API */
+
+	Capture::~Capture() {
+		Stop();
+	}
+
+	bool Capture::Start(const std::string& path) {
+		std::lock_guard lock(mutex);
+		enabled.store(false, std::memory_order_relaxed);
+		if (file.is_open()) { file.close(); }
+
+		file.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!file.write(FILE_MAGIC.data(), FILE_MAGIC.size())) {
+			file.close();
+			return false;
+		}
+		last = Clock::now();
+		records = 0;
+		enabled.store(true, std::memory_order_relaxed);
+		return true;
+	}
+
+	uint64_t Capture::Stop() {
+		std::lock_guard lock(mutex);
+		enabled.store(false, std::memory_order_relaxed);
+		if (file.is_open()) { file.close(); }
+		return records;
+	}
+
+	Capture::Reader::Reader(const std::string& path) : file(path, std::ios::in | std::ios::binary), open(false) {
+		char magic[FILE_MAGIC.size()];
+		open = file.read(magic, sizeof(magic)) && std::string_view(magic, sizeof(magic)) == FILE_MAGIC;
+	}
+
+	bool Capture::Reader::Next(Entry& entry) {
+		char kind;
+		uint64_t connection, delta, length;
+		if (!open || !file.get(kind) || !readNumber(connection) || !readNumber(delta) || !readNumber(length)) {
+			return false;
+		}
+		if (static_cast<uint8_t>(kind) > static_cast<uint8_t>(Kind::Close)) {
+			return false;
+		}
+
+		entry.kind = static_cast<Kind>(kind);
+		entry.connection = connection;
+		time += std::chrono::nanoseconds(delta);
+		entry.time = time;
+		entry.text.resize(length);
+		return length == 0 || static_cast<bool>(file.read(entry.text.data(), length));
+	}
+
+	/* PRIVATE API */
+
+	bool Capture::Reader::readNumber(uint64_t& value) {
+		value = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			char c;
+			if (!file.get(c)) { return false; }
+			const auto byte = static_cast<uint8_t>(c);
+			value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0) { return true; }
+		}
+		return false;
+	}
+
+	void Capture::record(Kind kind, uint64_t connection, std::string_view text) noexcept {
+		std::lock_guard lock(mutex);
+		// stopped while this thread was waiting for the lock
+		if (!file.is_open()) { return; }
+
+		// taken under the lock, so records are in time order and every delta is positive
+		const auto now = Clock::now();
+		const auto delta = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+		last = now;
+
+		char header[1 + 3 * MAX_NUMBER_BYTES];
+		size_t length = 0;
+		header[length++] = static_cast<char>(kind);
+		length += encodeNumber(connection, header + length);
+		length += encodeNumber(static_cast<uint64_t>(delta), header + length);
+		length += encodeNumber(text.size(), header + length);
+
+		if (!file.write(header, length) || !file.write(text.data(), text.size())) {
+			// a full disk shouldn't take the plugin down, the capture just ends here
+			enabled.store(false, std::memory_order_relaxed);
+			file.close();
+			return;
+		}
+		records++;
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace xp11_va {
+	/*
+	 * Records the traffic on every connection to a file: each message a client
+	 * sent, each response written back, and when connections opened and closed,
+	 * with the time and the connection's id. Log lines streamed to a subscriber
+	 * are not recorded. bench/Replay.cpp feeds a capture back into Link against
+	 * the stand-in XPLM.
+	 *
+	 * The file is FILE_MAGIC followed by one record after another, each
+	 *     kind (1 byte), connection id, nanoseconds since the previous record, text length,
+	 *     each of them an unsigned LEB128 after the kind, then the text
+	 *
+	 * Capturing is off until Start is called, and while it is off recording
+	 * costs one relaxed load.
+	 */
+	class Capture {
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		static constexpr std::string_view FILE_MAGIC{ "XP11VAC1", 8 };
+
+		enum class Kind : uint8_t {
+			Open,
+			Message,
+			Response,
+			Close
+		};
+
+		// one record, as read back
+		struct Entry {
+			Kind kind = Kind::Open;
+			uint64_t connection = 0;
+			// since the first record in the file
+			std::chrono::nanoseconds time{};
+			std::string text;
+		};
+
+		// reads a capture back a record at a time
+		class Reader {
+		public:
+			explicit Reader(const std::string& path);
+
+			// false if the file couldn't be opened or isn't a capture
+			bool IsOpen() const { return open; }
+			// false at the end of the file, or at a record cut short when the capture was
+			bool Next(Entry&);
+
+		private:
+			std::ifstream file;
+			bool open;
+			std::chrono::nanoseconds time{};
+
+			bool readNumber(uint64_t&);
+		};
+
+		Capture() = default;
+		~Capture();
+		Capture(const Capture&) = delete;
+		Capture& operator=(const Capture&) = delete;
+
+		bool Enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+		// starts writing to a new file at path, ending any capture already running. returns false if it couldn't be created.
+		bool Start(const std::string& path);
+		// ends the capture and closes the file, returns the number of records written
+		uint64_t Stop();
+
+		void Record(Kind kind, uint64_t connection, std::string_view text = {}) noexcept {
+			if (Enabled()) { record(kind, connection, text); }
+		}
+
+	private:
+		std::atomic_bool enabled{ false };
+		// held while a record is written, and by Start and Stop
+		std::mutex mutex;
+		std::ofstream file;
+		Clock::time_point last{};
+		uint64_t records = 0;
+
+		void record(Kind, uint64_t, std::string_view) noexcept;
+	};
+}
@@ -0,0 +1,59 @@
+#include "pch.h"
+#include "Connection.h"
+
+namespace xp11_va {
+	std::optional<Priority> ParsePriority(std::string_view name) {
+		if (name == "interactive") { return Priority::Interactive; }
+		if (name == "normal") { return Priority::Normal; }
+		if (name == "bulk") { return Priority::Bulk; }
+		return std::nullopt;
+	}
+
+	const char* PriorityName(Priority priority) {
+		switch (priority) {
+		case Priority::Interactive: return "interactive";
+		case Priority::Normal: return "normal";
+		case Priority::Bulk: return "bulk";
+		}
+		return "unknown";
+	}
+
+	/* PUBLIC API */
+
+	Connection::Connection(Id id, std::shared_ptr<Pipe> pipe, std::chrono::milliseconds idleTimeout, std::chrono::milliseconds requestTimeout)
+		: connection_id(id), client_pipe(std::move(pipe)), client_session(std::make_shared<Session>(id)), open(true), finished(false), defaultPriority(Priority::Normal), readAfterFlightModel(false) {
+		idleTimeoutMs = idleTimeout.count();
+		requestTimeoutMs = requestTimeout.count();
+		Touch();
+	}
+
+	Connection::~Connection() {
+		Close();
+		Join();
+	}
+
+	void Connection::Attach(std::unique_ptr<std::thread> t) {
+		thread = std::move(t);
+	}
+
+	void Connection::Close() noexcept {
+		open = false;
+		client_session->End();
+
+		// the pipe thread may be blocked in a read, and may not be by the time the
+		// abort lands, so this is safe (and sometimes necessary) to call repeatedly
+		if (thread && !finished) {
+			client_pipe->Abort(thread->native_handle());
+		}
+	}
+
+	void Connection::Join() {
+		if (thread && thread->joinable()) {
+			thread->join();
+		}
+	}
+
+	Connection::Clock::duration Connection::IdleFor(Clock::time_point now) const {
+		return now - Clock::time_point(Clock::duration(lastActivity.load()));
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Coroutine.h"
+#include "Logger.h"
+#include "Pipe.h"
+#include "RequestArena.h"
+
+namespace xp11_va {
+	/*
+	 * Which lane of the sim thread queue a request's work is put in. The flight
+	 * loop serves lanes in this order, so lower values are served first.
+	 */
+	enum class Priority : uint8_t {
+		Interactive,
+		Normal,
+		Bulk
+	};
+	constexpr size_t PRIORITY_COUNT = 3;
+
+	std::optional<Priority> ParsePriority(std::string_view);
+	const char* PriorityName(Priority);
+
+	/*
+	 * Shared with every piece of work queued on behalf of a connection, so that
+	 * the sim thread can tell whether anybody is still waiting for the result.
+	 * This outlives the Connection itself, which is why it is separate from it.
+	 * It also carries the connection's weight, its share of the sim thread
+	 * relative to other connections with work queued in the same lane.
+	 */
+	class Session {
+	public:
+		static constexpr uint32_t MAX_WEIGHT = 16;
+
+		explicit Session(uint64_t owner) : owner_id(owner), alive(true), weight(1) {}
+
+		uint64_t owner() const { return owner_id; }
+		bool IsAlive() const { return alive; }
+		void End() { alive = false; }
+
+		uint32_t Weight() const { return weight; }
+		void SetWeight(uint32_t w) { weight = w; }
+
+	private:
+		const uint64_t owner_id;
+		std::atomic_bool alive;
+		std::atomic<uint32_t> weight;
+	};
+
+	/*
+	 * All of the state belonging to a single connected client: the pipe, the
+	 * thread servicing it, and the bookkeeping needed to decide when the client
+	 * has gone away. Link owns these, and releases them through the reaper.
+	 */
+	class Connection {
+	public:
+		typedef uint64_t Id;
+		typedef std::chrono::steady_clock Clock;
+
+		// what has passed through the pipe, counted by the pipe thread and readable from any other
+		struct Traffic {
+			std::atomic<uint64_t> bytesIn{ 0 };
+			std::atomic<uint64_t> bytesOut{ 0 };
+			std::atomic<uint64_t> requestsIn{ 0 };
+			std::atomic<uint64_t> requestsOut{ 0 };
+		};
+
+		Connection(Id, std::shared_ptr<Pipe>, std::chrono::milliseconds idleTimeout, std::chrono::milliseconds requestTimeout);
+		~Connection();
+
+		Id id() const { return connection_id; }
+		Pipe& pipe() { return *client_pipe; }
+		const std::shared_ptr<Session>& session() const { return client_session; }
+		FramePool& frames() { return frame_pool; }
+		IoContext& io() { return io_context; }
+		RequestArena& arena() { return request_arena; }
+		Traffic& traffic() { return traffic_counts; }
+		const Traffic& traffic() const { return traffic_counts; }
+
+		void Attach(std::unique_ptr<std::thread>);
+		void Close() noexcept;
+		void Join();
+
+		bool IsOpen() const { return open; }
+		bool IsFinished() const { return finished; }
+		void MarkFinished() { client_session->End(); finished = true; }
+
+		void Touch() noexcept { lastActivity = Clock::now().time_since_epoch().count(); }
+		Clock::duration IdleFor(Clock::time_point) const;
+		bool IsIdle(Clock::time_point now) const { return IdleFor(now) > IdleTimeout(); }
+
+		std::chrono::milliseconds IdleTimeout() const { return std::chrono::milliseconds(idleTimeoutMs.load()); }
+		void SetIdleTimeout(std::chrono::milliseconds timeout) { idleTimeoutMs = timeout.count(); }
+
+		std::chrono::milliseconds RequestTimeout() const { return std::chrono::milliseconds(requestTimeoutMs.load()); }
+		void SetRequestTimeout(std::chrono::milliseconds timeout) { requestTimeoutMs = timeout.count(); }
+		Clock::time_point RequestDeadline() const { return Clock::now() + RequestTimeout(); }
+
+		// used for requests that don't name a priority of their own
+		Priority DefaultPriority() const { return defaultPriority.load(); }
+		void SetDefaultPriority(Priority priority) { defaultPriority = priority; }
+
+		// whether reads wait for this frame's flight model step, rather than reading the previous one's results
+		bool ReadsAfterFlightModel() const { return readAfterFlightModel; }
+		void SetReadsAfterFlightModel(bool after) { readAfterFlightModel = after; }
+
+		// set by logs:subscribe, once the response is written the connection carries nothing but log records.
+		// only used on the pipe thread.
+		const std::shared_ptr<Logger::Subscription>& LogSubscription() const { return log_subscription; }
+		void SetLogSubscription(std::shared_ptr<Logger::Subscription> subscription) { log_subscription = std::move(subscription); }
+
+	private:
+		const Id connection_id;
+		std::shared_ptr<Pipe> client_pipe;
+		std::shared_ptr<Session> client_session;
+		std::unique_ptr<std::thread> thread;
+		// the I/O context is destroyed first, finishing any stragglers, and they free their frames into the pool
+		// and release their hold on the arena
+		FramePool frame_pool;
+		RequestArena request_arena;
+		IoContext io_context;
+
+		std::atomic_bool open;
+		std::atomic_bool finished;
+		std::atomic<Clock::rep> lastActivity;
+		std::atomic<std::chrono::milliseconds::rep> idleTimeoutMs;
+		std::atomic<std::chrono::milliseconds::rep> requestTimeoutMs;
+		std::atomic<Priority> defaultPriority;
+		std::atomic_bool readAfterFlightModel;
+		std::shared_ptr<Logger::Subscription> log_subscription;
+		Traffic traffic_counts;
+	};
+}
@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "Coroutine.h"
+#include "Futex.h"
+
+#include <cstddef>
+
+namespace xp11_va {
+	namespace {
+		struct FrameHeader {
+			FramePool* pool;
+			size_t sizeClass;
+		};
+
+		// keeps the frame itself aligned as operator new would have
+		constexpr size_t HEADER_BYTES = (sizeof(FrameHeader) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+		thread_local FramePool* currentPool = nullptr;
+	}
+
+	/* FramePool */
+
+	FramePool::~FramePool() {
+		for (auto& freeList : freeLists) {
+			for (void* block : freeList) {
+				::operator delete(block);
+			}
+		}
+	}
+
+	void* FramePool::Allocate(size_t size) {
+		const size_t total = size + HEADER_BYTES;
+		const size_t sizeClass = (total - 1) / CLASS_BYTES;
+		FramePool* pool = currentPool;
+
+		void* block = nullptr;
+		if (pool && sizeClass < CLASS_COUNT) {
+			{
+				std::lock_guard<std::mutex> lock(pool->mutex);
+				auto& freeList = pool->freeLists[sizeClass];
+				if (!freeList.empty()) {
+					block = freeList.back();
+					freeList.pop_back();
+				}
+			}
+			if (!block) {
+				block = ::operator new((sizeClass + 1) * CLASS_BYTES);
+			}
+		}
+		else {
+			// too big to pool, or not on a pipe thread
+			pool = nullptr;
+			block = ::operator new(total);
+		}
+
+		auto* header = static_cast<FrameHeader*>(block);
+		header->pool = pool;
+		header->sizeClass = sizeClass;
+		return static_cast<char*>(block) + HEADER_BYTES;
+	}
+
+	void FramePool::Free(void* frame) noexcept {
+		void* block = static_cast<char*>(frame) - HEADER_BYTES;
+		auto* header = static_cast<FrameHeader*>(block);
+
+		if (header->pool) {
+			std::lock_guard<std::mutex> lock(header->pool->mutex);
+			header->pool->freeLists[header->sizeClass].push_back(block);
+		}
+		else {
+			::operator delete(block);
+		}
+	}
+
+	void FramePool::SetCurrent(FramePool* pool) noexcept {
+		currentPool = pool;
+	}
+
+	/* IoContext */
+
+	IoContext::IoContext() : wakeups(0) {
+		posted.reserve(64);
+		running.reserve(64);
+	}
+
+	IoContext::~IoContext() {
+		while (true) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (posted.empty()) { break; }
+			}
+			runPosted();
+		}
+	}
+
+	void IoContext::Post(std::coroutine_handle<> handle) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			posted.push_back(handle);
+		}
+		Wake();
+	}
+
+	void IoContext::Wake() noexcept {
+		wakeups.fetch_add(1, std::memory_order_release);
+		FutexWakeAll(wakeups);
+	}
+
+	bool IoContext::RunUntil(const std::atomic<size_t>& remaining, std::chrono::steady_clock::time_point deadline) {
+		while (remaining.load(std::memory_order_acquire) > 0) {
+			// read before running, so anything posted from here on shows up as a changed value
+			const auto seen = wakeups.load(std::memory_order_acquire);
+			runPosted();
+
+			if (remaining.load(std::memory_order_acquire) == 0) { break; }
+			if (std::chrono::steady_clock::now() >= deadline) { return false; }
+
+			bool idle;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				idle = posted.empty();
+			}
+			if (idle) {
+				FutexWaitUntil(wakeups, seen, deadline);
+			}
+		}
+		return true;
+	}
+
+	void IoContext::Poll() {
+		runPosted();
+	}
+
+	void IoContext::runPosted() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running.swap(posted);
+		}
+
+		for (auto handle : running) {
+			handle.resume();
+		}
+		running.clear();
+	}
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <coroutine>
+#include <utility>
+
+namespace xp11_va {
+	/*
+	 * Coroutine frames for request handlers come from the pool belonging to the
+	 * connection whose I/O thread creates them, so once a connection has warmed
+	 * up a request costs no heap allocations. Frames remember which pool they
+	 * came from, so they can be freed from any thread.
+	 */
+	class FramePool {
+	public:
+		FramePool() = default;
+		FramePool(const FramePool&) = delete;
+		FramePool& operator=(const FramePool&) = delete;
+		~FramePool();
+
+		static void* Allocate(size_t);
+		static void Free(void*) noexcept;
+
+		// frames created on this thread come from this pool, nullptr means the heap
+		static void SetCurrent(FramePool*) noexcept;
+
+	private:
+		static constexpr size_t CLASS_BYTES = 256;
+		static constexpr size_t CLASS_COUNT = 32;
+
+		std::mutex mutex;
+		std::array<std::vector<void*>, CLASS_COUNT> freeLists;
+	};
+
+	/*
+	 * The I/O side of a connection: coroutines waiting to run on the pipe
+	 * thread are posted here, from the sim thread or wherever they were
+	 * cancelled, and run by the pipe thread in RunUntil or Poll.
+	 *
+	 * Nothing runs them while the pipe thread is blocked reading the next
+	 * message. A handler still out when its message timed out, and posted
+	 * after the thread's last Poll, keeps its frame and the arena until the
+	 * client's next message, or until the connection closes.
+	 */
+	class IoContext {
+	public:
+		IoContext();
+		IoContext(const IoContext&) = delete;
+		IoContext& operator=(const IoContext&) = delete;
+		// runs anything still posted, so no frame is leaked
+		~IoContext();
+
+		void Post(std::coroutine_handle<>);
+		void Wake() noexcept;
+
+		// resumes posted coroutines until `done` is true or the deadline passes, returns `done`
+		bool RunUntil(const std::atomic<size_t>& remaining, std::chrono::steady_clock::time_point deadline);
+		// resumes whatever has been posted so far, without waiting
+		void Poll();
+
+		// co_await io.Schedule() moves the rest of the coroutine onto the I/O thread
+		auto Schedule() {
+			struct Awaiter {
+				IoContext& io;
+				bool await_ready() const noexcept { return false; }
+				void await_suspend(std::coroutine_handle<> h) { io.Post(h); }
+				void await_resume() const noexcept {}
+			};
+			return Awaiter{ *this };
+		}
+
+	private:
+		std::mutex mutex;
+		std::vector<std::coroutine_handle<>> posted;
+		std::vector<std::coroutine_handle<>> running;
+		std::atomic<uint32_t> wakeups;
+
+		void runPosted();
+	};
+
+	/*
+	 * A lazily started coroutine producing a T, resumed by whoever co_awaits it.
+	 */
+	template <typename T>
+	class Task {
+	public:
+		struct promise_type {
+			std::optional<T> value;
+			std::exception_ptr error;
+			std::coroutine_handle<> continuation;
+
+			static void* operator new(size_t size) { return FramePool::Allocate(size); }
+			static void operator delete(void* frame) noexcept { FramePool::Free(frame); }
+
+			Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+
+			auto final_suspend() noexcept {
+				struct Final {
+					bool await_ready() const noexcept { return false; }
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+						auto next = h.promise().continuation;
+						return next ? next : std::noop_coroutine();
+					}
+					void await_resume() const noexcept {}
+				};
+				return Final{};
+			}
+
+			template <typename U>
+			void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+			void unhandled_exception() noexcept { error = std::current_exception(); }
+		};
+
+		Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+		~Task() { if (handle) { handle.destroy(); } }
+
+		bool await_ready() const noexcept { return false; }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+			handle.promise().continuation = awaiting;
+			return handle;
+		}
+		T await_resume() {
+			auto& promise = handle.promise();
+			if (promise.error) { std::rethrow_exception(promise.error); }
+			return std::move(*promise.value);
+		}
+
+	private:
+		explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	/*
+	 * A coroutine that starts immediately and frees itself when it finishes,
+	 * used to launch request handlers that nobody co_awaits.
+	 */
+	struct Detached {
+		struct promise_type {
+			static void* operator new(size_t size) { return FramePool::Allocate(size); }
+			static void operator delete(void* frame) noexcept { FramePool::Free(frame); }
+
+			Detached get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+}
@@ -5,22 +5,54 @@
 #include "EnvData.h"
 
 namespace xp11_va {
+	/*
+	 * Remembers what fetch returned for each key, including nothing (a null
+	 * value), so a name that doesn't exist is only looked up once. Only one
+	 * thread may call Get, but the counters can be read from anywhere.
+	 */
 	template <typename Key, typename Value>
 	class DataCache {
 	public:
 		DataCache(std::function<Value(const Key&)> fetch) : fetch(fetch) {}
 
-		std::optional<Value> Get(const Key& key) {
-			if (cache.find(key) == cache.end()) {
-				cache.emplace(key, fetch(key));
+		// takes anything comparable with Key, so looking up a cached entry doesn't need a Key built for it
+		template <typename Lookup>
+		std::optional<Value> Get(const Lookup& key) {
+			auto it = cache.find(key);
+			if (it == cache.end()) {
+				misses.fetch_add(1, std::memory_order_relaxed);
+				Key owned(key);
+				auto value = fetch(owned);
+				it = cache.emplace(std::move(owned), value).first;
+				entries.store(cache.size(), std::memory_order_relaxed);
+				if (value == Value{}) {
+					negative.fetch_add(1, std::memory_order_relaxed);
+				}
 			}
-			return cache[key];
+			else {
+				hits.fetch_add(1, std::memory_order_relaxed);
+			}
+			return it->second;
+		}
+
+		void Clear() {
+			cache.clear();
+			entries = 0;
+			negative = 0;
 		}
 
-		void Clear() { cache.clear(); }
+		size_t Size() const { return entries.load(std::memory_order_relaxed); }
+		// entries for keys that fetch found nothing for
+		size_t Negative() const { return negative.load(std::memory_order_relaxed); }
+		uint64_t Hits() const { return hits.load(std::memory_order_relaxed); }
+		uint64_t Misses() const { return misses.load(std::memory_order_relaxed); }
 
 	private:
-		std::map<Key, Value> cache;
+		std::map<Key, Value, std::less<>> cache;
 		std::function<Value(const Key&)> fetch;
+		std::atomic<size_t> entries{ 0 };
+		std::atomic<size_t> negative{ 0 };
+		std::atomic<uint64_t> hits{ 0 };
+		std::atomic<uint64_t> misses{ 0 };
 	};
 }
\ No newline at end of file
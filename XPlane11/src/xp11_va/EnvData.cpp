@@ -2,35 +2,47 @@
 #include "EnvData.h"
 #include "Logger.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
 namespace xp11_va {
-	EnvData EnvData::fromString(const std::string& dataref_name, const std::string& dataref_type, const std::string& dataref_value) {
-		const auto type = std::strtol(dataref_type.c_str(), nullptr, 10);
+	namespace {
+		template <typename T, typename... Format>
+		void appendNumber(std::pmr::string& out, T value, Format... format) {
+			// long enough for any double in fixed notation
+			char buffer[320];
+			const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, format...);
+			out.append(buffer, result.ptr);
+		}
+	}
+
+	EnvData EnvData::fromString(std::string_view dataref_name, std::string_view dataref_type, std::string_view dataref_value) {
+		const auto type = parseNumber<XPLMDataTypeID>(dataref_type);
 
 		EnvData ed{};
 		ed.name = dataref_name;
 		ed.type = type;
 
-		std::string val;
-
 		switch (type) {
 		case xplmType_Int:
-			ed.intVal = std::strtol(dataref_value.c_str(), nullptr, 10);
+			ed.intVal = parseNumber<int32_t>(dataref_value);
 			break;
 		case xplmType_Float:
-			ed.floatVal = std::strtof(dataref_value.c_str(), nullptr);
+			ed.floatVal = parseNumber<float>(dataref_value);
 			break;
 		case xplmType_Double:
-			ed.doubleVal = std::strtod(dataref_value.c_str(), nullptr);
+			ed.doubleVal = parseNumber<double>(dataref_value);
 			break;
 		case xplmType_FloatArray:
 		{
 			size_t v_start = 0;
 			size_t v_end = dataref_value.find(',', v_start);
 			while (ed.arrayElemCount < MAX_ARRAY_ELEMS) {
-				ed.floatArray[ed.arrayElemCount] = std::strtof(dataref_value.substr(v_start, v_end - v_start).c_str(), nullptr);
+				ed.floatArray[ed.arrayElemCount] = parseNumber<float>(dataref_value.substr(v_start, v_end - v_start));
 				ed.arrayElemCount += 1;
 
-				if (v_end == std::string::npos) { break; }
+				if (v_end == std::string_view::npos) { break; }
 				v_start = v_end + 1;
 				v_end = dataref_value.find(',', v_start);
 			}
@@ -41,18 +53,18 @@ namespace xp11_va {
 			size_t v_start = 0;
 			size_t v_end = dataref_value.find(',', v_start);
 			while (ed.arrayElemCount < MAX_ARRAY_ELEMS) {
-				ed.intArray[ed.arrayElemCount] = std::strtol(dataref_value.substr(v_start, v_end - v_start).c_str(), nullptr, 10);
+				ed.intArray[ed.arrayElemCount] = parseNumber<int32_t>(dataref_value.substr(v_start, v_end - v_start));
 				ed.arrayElemCount += 1;
 
-				if (v_end == std::string::npos) { break; }
+				if (v_end == std::string_view::npos) { break; }
 				v_start = v_end + 1;
 				v_end = dataref_value.find(',', v_start);
 			}
 			break;
 		}
 		case xplmType_Data:
-			ed.arrayElemCount = min(dataref_value.length() * sizeof(std::string::value_type), MAX_ARRAY_ELEMS);
-			memcpy_s(ed.byteArray, MAX_ARRAY_ELEMS, dataref_value.c_str(), ed.arrayElemCount);
+			ed.arrayElemCount = std::min(dataref_value.length() * sizeof(std::string::value_type), MAX_ARRAY_ELEMS);
+			std::memcpy(ed.byteArray, dataref_value.data(), ed.arrayElemCount);
 			break;
 		case xplmType_Unknown:
 		default:
@@ -62,93 +74,121 @@ namespace xp11_va {
 		return ed;
 	}
 
-	EnvData EnvData::fromDataref(const std::string&name, XPLMDataRef ref) {
+	EnvData EnvData::fromDataref(std::string_view name, XPLMDataRef ref) {
 		if (!ref) {
 			throw std::runtime_error("No ref passed in toEnvData");
 		}
 
 		EnvData res{};
 		res.name = name;
+		res.ReadFrom(ref);
+		return res;
+	}
 
+	void EnvData::ReadFrom(XPLMDataRef ref) {
 		const auto idMask = XPLMGetDataRefTypes(ref);
-		res.type = idMask;
+		type = idMask;
+		arrayElemCount = 0;
 
 		if (idMask & xplmType_Int) {
-			res.intVal = XPLMGetDatai(ref);
+			intVal = XPLMGetDatai(ref);
 		}
 		else if (idMask & xplmType_Float) {
-			res.floatVal = XPLMGetDataf(ref);
+			floatVal = XPLMGetDataf(ref);
 		}
 		else if (idMask & xplmType_Double) {
-			res.doubleVal = XPLMGetDatad(ref);
+			doubleVal = XPLMGetDatad(ref);
 		}
 		else if (idMask & xplmType_IntArray) {
-			res.arrayElemCount = XPLMGetDatavi(ref, res.intArray, 0, MAX_ARRAY_ELEMS);
+			arrayElemCount = XPLMGetDatavi(ref, intArray, 0, MAX_ARRAY_ELEMS);
 		}
 		else if (idMask & xplmType_FloatArray) {
-			res.arrayElemCount = XPLMGetDatavf(ref, res.floatArray, 0, MAX_ARRAY_ELEMS);
+			arrayElemCount = XPLMGetDatavf(ref, floatArray, 0, MAX_ARRAY_ELEMS);
 		}
 		else if (idMask & xplmType_Data) {
-			res.arrayElemCount = XPLMGetDatab(ref, res.byteArray, 0, MAX_ARRAY_ELEMS);
+			arrayElemCount = XPLMGetDatab(ref, byteArray, 0, MAX_ARRAY_ELEMS);
 		}
 		else {
 			throw std::runtime_error("Don't know how to get data of type " + std::to_string(idMask));
 		}
-		return res;
 	}
 
-	std::string EnvData::dataToString() {
+	bool EnvData::WriteTo(XPLMDataRef ref) const {
+		switch (type) {
+		case xplmType_Int:
+			XPLMSetDatai(ref, intVal);
+			return true;
+		case xplmType_Float:
+			XPLMSetDataf(ref, floatVal);
+			return true;
+		case xplmType_Double:
+			XPLMSetDatad(ref, doubleVal);
+			return true;
+		case xplmType_FloatArray:
+			XPLMSetDatavf(ref, const_cast<float*>(floatArray), 0, static_cast<int>(arrayElemCount));
+			return true;
+		case xplmType_IntArray:
+			XPLMSetDatavi(ref, const_cast<int32_t*>(intArray), 0, static_cast<int>(arrayElemCount));
+			return true;
+		case xplmType_Data:
+			XPLMSetDatab(ref, const_cast<uint8_t*>(byteArray), 0, static_cast<int>(arrayElemCount));
+			return true;
+		case xplmType_Unknown:
+		default:
+			return false;
+		}
+	}
+
+	void EnvData::AppendTo(std::pmr::string& out) const {
+		out.append(name);
+		out.push_back(':');
+		appendNumber(out, type);
+		out.push_back(':');
+		appendData(out);
+	}
+
+	void EnvData::appendData(std::pmr::string& out) const {
+		// scalars are formatted as std::to_string did, array elements as a default std::ostream does
 		if (type & xplmType_Int) {
-			return std::to_string(intVal);
+			appendNumber(out, intVal);
+			return;
 		}
 
 		if (type & xplmType_Float) {
-			return std::to_string(floatVal);
+			appendNumber(out, floatVal, std::chars_format::fixed, 6);
+			return;
 		}
 
 		if (type & xplmType_Double) {
-			return std::to_string(doubleVal);
+			appendNumber(out, doubleVal, std::chars_format::fixed, 6);
+			return;
 		}
 
 		if (type & xplmType_Data) {
-			std::stringstream ss;
+			// bytes go out as the characters they are
 			for (size_t i = 0; i < arrayElemCount; i++) {
-				if (i < arrayElemCount - 1) {
-					ss << byteArray[i] << ",";
-				}
-				else {
-					ss << byteArray[i];
-				}
+				if (i > 0) { out.push_back(','); }
+				out.push_back(static_cast<char>(byteArray[i]));
 			}
-			return ss.str();
+			return;
 		}
 
 		if (type & xplmType_IntArray) {
-			std::stringstream ss;
 			for (size_t i = 0; i < arrayElemCount; i++) {
-				if (i < arrayElemCount - 1) {
-					ss << intArray[i] << ",";
-				}
-				else {
-					ss << intArray[i];
-				}
+				if (i > 0) { out.push_back(','); }
+				appendNumber(out, intArray[i]);
 			}
-			return ss.str();
+			return;
 		}
 
 		if (type & xplmType_FloatArray) {
-			std::stringstream ss;
 			for (size_t i = 0; i < arrayElemCount; i++) {
-				if (i < arrayElemCount - 1) {
-					ss << floatArray[i] << ",";
-				}
-				else {
-					ss << floatArray[i];
-				}
+				if (i > 0) { out.push_back(','); }
+				appendNumber(out, floatArray[i], std::chars_format::general, 6);
 			}
-			return ss.str();
+			return;
 		}
 
 		throw std::runtime_error("Unknown dataref type id " + std::to_string(type));
 	}
-}
\ No newline at end of file
+}
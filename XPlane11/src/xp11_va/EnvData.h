@@ -1,10 +1,41 @@
 #pragma once
 
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <limits>
+#include <type_traits>
+
 namespace xp11_va {
 	constexpr size_t MAX_ARRAY_ELEMS = 1024;
 
+	// parses a number as strtol and strtod would, without the copy they need to get a terminated string.
+	// leading whitespace and a '+' are skipped, a value out of range is clamped, and anything that doesn't
+	// parse is 0.
+	template <typename T>
+	T parseNumber(std::string_view text) {
+		while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front()))) { text.remove_prefix(1); }
+		// strtol takes one sign, so "+-1" doesn't parse
+		if (text.size() > 1 && text[0] == '+' && text[1] != '-' && text[1] != '+') { text.remove_prefix(1); }
+
+		T value{};
+		const auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+		if (result.ec == std::errc::result_out_of_range) {
+			if constexpr (std::is_integral_v<T>) {
+				return text.front() == '-' ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+			}
+			else {
+				// too big or too small, and strtod is the one that knows what to make of which
+				const std::string terminated(text);
+				return static_cast<T>(std::is_same_v<T, float> ? std::strtof(terminated.c_str(), nullptr) : std::strtod(terminated.c_str(), nullptr));
+			}
+		}
+		return result.ec == std::errc() ? value : T{};
+	}
+
 	struct EnvData {
-		std::string name;
+		// not owned, usually points into the request that named the dataref
+		std::string_view name;
 		XPLMDataTypeID type;
 		size_t arrayElemCount;
 		union {
@@ -16,14 +47,17 @@ namespace xp11_va {
 			uint8_t byteArray[MAX_ARRAY_ELEMS];
 		};
 
-		static EnvData fromString(const std::string&, const std::string&, const std::string&);
-		static EnvData fromDataref(const std::string&, XPLMDataRef);
+		static EnvData fromString(std::string_view, std::string_view, std::string_view);
+		static EnvData fromDataref(std::string_view, XPLMDataRef);
 
-		inline std::string ToString() {
-			return name + ":" + std::to_string(type) + ":" + dataToString();
-		}
+		// only XPLM calls and copies into the value union, so these are all the sim thread needs to do
+		void ReadFrom(XPLMDataRef);
+		bool WriteTo(XPLMDataRef) const;
+
+		// appends name:type:value, formatting in place so the string's allocator is the only one used
+		void AppendTo(std::pmr::string&) const;
 
 	private:
-		std::string dataToString();
+		void appendData(std::pmr::string&) const;
 	};
 }
\ No newline at end of file
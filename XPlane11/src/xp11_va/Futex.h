@@ -0,0 +1,14 @@
+#pragma once
+
+namespace xp11_va {
+	/*
+	 * Thin wrappers around the platform's wait-on-address primitive
+	 * (WaitOnAddress on Windows, futex on Linux). A waiter only sleeps while
+	 * `word` still holds `expected`, so a wake that lands before the wait is
+	 * never lost.
+	 */
+
+	// returns false if the deadline passed while `word` still held `expected`
+	bool FutexWaitUntil(const std::atomic<uint32_t>& word, uint32_t expected, std::chrono::steady_clock::time_point deadline);
+	void FutexWakeAll(std::atomic<uint32_t>& word);
+}
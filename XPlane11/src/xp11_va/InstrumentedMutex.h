@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace xp11_va {
+	// what one lock has cost the threads that take it, readable from any thread while it is in use
+	struct LockStats {
+		std::atomic<uint64_t> acquisitions{ 0 };
+		// acquisitions that found the lock held by another thread and had to wait for it
+		std::atomic<uint64_t> contended{ 0 };
+		std::atomic<uint64_t> waitNs{ 0 };
+		std::atomic<uint64_t> maxWaitNs{ 0 };
+		// from acquiring the lock to releasing it, for recursive locks from the outermost lock to its unlock
+		std::atomic<uint64_t> holdNs{ 0 };
+		std::atomic<uint64_t> maxHoldNs{ 0 };
+	};
+
+	/*
+	 * A mutex, std::mutex or std::recursive_mutex, that counts how often it
+	 * is taken, how often a thread had to wait for it and for how long, and how
+	 * long it is held. It can be used anywhere the mutex it wraps can, except
+	 * with std::condition_variable, which needs a plain std::mutex.
+	 *
+	 * An uncontended lock and unlock costs two clock reads on top of the mutex.
+	 * Only a lock that is already held is waited for and timed.
+	 */
+	template <typename Mutex>
+	class InstrumentedMutex {
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		// name must outlive the mutex, a literal is best
+		explicit InstrumentedMutex(const char* n) : name(n) {}
+		InstrumentedMutex(const InstrumentedMutex&) = delete;
+		InstrumentedMutex& operator=(const InstrumentedMutex&) = delete;
+
+		void lock() {
+			if (!mutex.try_lock()) {
+				const auto start = Clock::now();
+				mutex.lock();
+				stats.contended.fetch_add(1, std::memory_order_relaxed);
+				recordMax(stats.waitNs, stats.maxWaitNs, Clock::now() - start);
+			}
+			acquired();
+		}
+
+		bool try_lock() {
+			if (!mutex.try_lock()) { return false; }
+			acquired();
+			return true;
+		}
+
+		void unlock() {
+			// only the owner gets here, so depth and acquiredAt need no synchronisation
+			if (--depth == 0) {
+				recordMax(stats.holdNs, stats.maxHoldNs, Clock::now() - acquiredAt);
+			}
+			mutex.unlock();
+		}
+
+		const char* Name() const { return name; }
+		const LockStats& Stats() const { return stats; }
+
+	private:
+		Mutex mutex;
+		const char* name;
+		LockStats stats;
+		// only touched by the thread holding the lock
+		uint32_t depth = 0;
+		Clock::time_point acquiredAt{};
+
+		void acquired() {
+			if (depth++ == 0) {
+				stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+				acquiredAt = Clock::now();
+			}
+		}
+
+		static void recordMax(std::atomic<uint64_t>& total, std::atomic<uint64_t>& max, Clock::duration spent) {
+			const uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(spent).count());
+			total.fetch_add(ns, std::memory_order_relaxed);
+			uint64_t highest = max.load(std::memory_order_relaxed);
+			while (ns > highest && !max.compare_exchange_weak(highest, ns, std::memory_order_relaxed)) {}
+		}
+	};
+}
@@ -0,0 +1,64 @@
+#include "pch.h"
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace xp11_va {
+	/* PUBLIC API */
+
+	void LatencyHistogram::Record(std::chrono::nanoseconds duration) noexcept {
+		const uint64_t ns = static_cast<uint64_t>(std::max<std::chrono::nanoseconds::rep>(duration.count(), 0));
+
+		buckets[bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t highest = max.load(std::memory_order_relaxed);
+		while (ns > highest && !max.compare_exchange_weak(highest, ns, std::memory_order_relaxed)) {}
+	}
+
+	std::chrono::nanoseconds LatencyHistogram::Percentile(double fraction) const {
+		// counted here rather than taken from count, so that it agrees with the buckets if others are recording
+		uint64_t total = 0;
+		for (const auto& bucket : buckets) {
+			total += bucket.load(std::memory_order_relaxed);
+		}
+		if (total == 0) {
+			return std::chrono::nanoseconds(0);
+		}
+
+		const uint64_t rank = std::clamp<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * total)), 1, total);
+		uint64_t seen = 0;
+		for (size_t b = 0; b < BUCKETS; b++) {
+			seen += buckets[b].load(std::memory_order_relaxed);
+			if (seen >= rank) {
+				return std::chrono::nanoseconds(std::min(highestIn(b), max.load(std::memory_order_relaxed)));
+			}
+		}
+		return Max();
+	}
+
+	/* PRIVATE API */
+
+	size_t LatencyHistogram::bucketFor(uint64_t ns) noexcept {
+		ns = std::min(ns, (uint64_t(1) << MAX_VALUE_BITS) - 1);
+		if (ns < 2 * SUB_BUCKETS) {
+			return static_cast<size_t>(ns);
+		}
+
+		// keeps the top SUB_BUCKET_BITS + 1 bits, the leading one picks the power of two and the rest the bucket within it
+		const unsigned shift = static_cast<unsigned>(std::bit_width(ns)) - (SUB_BUCKET_BITS + 1);
+		return static_cast<size_t>(shift * SUB_BUCKETS + (ns >> shift));
+	}
+
+	uint64_t LatencyHistogram::highestIn(size_t bucket) noexcept {
+		if (bucket < 2 * SUB_BUCKETS) {
+			return bucket;
+		}
+
+		const unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS) - 1;
+		const uint64_t mantissa = bucket - shift * SUB_BUCKETS;
+		return ((mantissa + 1) << shift) - 1;
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+namespace xp11_va {
+	/*
+	 * Counts durations in buckets laid out the way HdrHistogram does it: exact
+	 * below 32ns, then every power of two split into 16 equal buckets, so any
+	 * duration is counted within about 6% of its value, from nanoseconds up to
+	 * around 18 minutes (anything longer lands in the last bucket).
+	 *
+	 * Recording is a few relaxed atomic adds and never waits, so any thread can
+	 * record while another reads percentiles out of it.
+	 */
+	class LatencyHistogram {
+	public:
+		void Record(std::chrono::nanoseconds) noexcept;
+
+		uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+		std::chrono::nanoseconds Max() const { return std::chrono::nanoseconds(max.load(std::memory_order_relaxed)); }
+		// the duration at or below which fraction (0 to 1) of those recorded fall, rounded up to the top of its bucket
+		std::chrono::nanoseconds Percentile(double fraction) const;
+
+	private:
+		static constexpr unsigned SUB_BUCKET_BITS = 4;
+		static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+		static constexpr unsigned MAX_VALUE_BITS = 40;
+		// exact values below 2 * SUB_BUCKETS, then SUB_BUCKETS for each power of two up to MAX_VALUE_BITS
+		static constexpr size_t BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+		static size_t bucketFor(uint64_t ns) noexcept;
+		static uint64_t highestIn(size_t bucket) noexcept;
+
+		std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+		std::atomic<uint64_t> count{ 0 };
+		std::atomic<uint64_t> max{ 0 };
+	};
+}
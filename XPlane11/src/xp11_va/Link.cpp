@@ -1,31 +1,86 @@
 #include "pch.h"
 #include "Link.h"
+#include "AllocTracker.h"
 #include "Pipe.h"
 #include "Logger.h"
 
 #include <XPLM/XPLMProcessing.h>
 
+#include <charconv>
+
 using namespace std::chrono_literals;
 
 namespace xp11_va {
-	std::vector<std::vector<std::string>> tokenize(const std::string&);
+	std::pmr::vector<Link::Tokens> tokenize(std::string_view, std::pmr::memory_resource*);
 	std::string what();
+	std::string what(const std::exception_ptr&);
+	long parseLong(std::string_view);
+	void appendNumber(std::pmr::string&, uint64_t);
+	void appendDecimal(std::pmr::string&, double);
+
+	// the message DataRefEditor (and DataRefTool) take the name of a plugin's dataref in
+	constexpr int MSG_ADD_DATAREF = 0x01000000;
+	std::optional<Link::SimPhase> parseReadPhase(std::string_view);
+
+	// where the handlers for one message leave their replies, shared with any that outlive the message
+	struct PendingReplies {
+		PendingReplies(size_t count, std::pmr::memory_resource* arena) : results(count, arena), done(count, std::pmr::polymorphic_allocator<std::atomic_bool>(arena)), timelines(count, arena), remaining(count) {}
+
+		std::pmr::vector<std::string_view> results;
+		std::pmr::vector<std::atomic_bool> done;
+		// like results, only read once done is set
+		Link::Timelines timelines;
+		std::atomic<size_t> remaining;
+	};
+
+	Detached runHandler(Task<std::string_view>, std::shared_ptr<PendingReplies>, size_t, Connection&);
+
+	class Link::XplmTimer {
+	public:
+		explicit XplmTimer(std::atomic<uint64_t>& ns) : total(ns), start(std::chrono::steady_clock::now()) {}
+		~XplmTimer() {
+			const auto elapsed = std::chrono::steady_clock::now() - start;
+			total.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<uint64_t>& total;
+		const std::chrono::steady_clock::time_point start;
+	};
 	
 	Logger& logger = Logger::get();
 
 	/* PUBLIC API */
 	
-	Link::Link() : started(false) {
+	Link::Link(LinkOptions opts) : options(opts), started(false), nextConnectionId(1), beforeFlightModel(opts.scheduler, "sim_queue_before_fm"), afterFlightModel(opts.scheduler, "sim_queue_after_fm") {
 		shouldStop = false;
-		flightLoopID = createFlightLoop();
-		XPLMScheduleFlightLoop(flightLoopID, -1, true);
+		connectionsReaped = 0;
+		tasksCancelled = 0;
+		tasksExpired = 0;
+		requestsTimedOut = 0;
+		heldCommands = 0;
+		nextRequestId = 1;
+		xplmNs = 0;
+		// the plugin is made on the sim thread
+		Tracer::NameThisThread("sim");
+		beforeFlightLoopID = createFlightLoop(SimPhase::BeforeFlightModel);
+		afterFlightLoopID = createFlightLoop(SimPhase::AfterFlightModel);
+		XPLMScheduleFlightLoop(beforeFlightLoopID, -1, true);
+		XPLMScheduleFlightLoop(afterFlightLoopID, -1, true);
+		registerPerfDatarefs();
 	}
 
 	Link::~Link() {
 		Stop();
-		if (flightLoopID) {
-			logger.Info("Nuking flight loop");
-			XPLMDestroyFlightLoop(flightLoopID);
+		for (const auto& [name, dataref] : perfDatarefs) {
+			XPLMUnregisterDataAccessor(dataref);
+		}
+
+		logger.Info("Nuking flight loops");
+		for (auto id : { beforeFlightLoopID, afterFlightLoopID }) {
+			if (id) {
+				XPLMDestroyFlightLoop(id);
+			}
 		}
 	}
 
@@ -33,8 +88,11 @@ namespace xp11_va {
 		if (started) {
 			throw std::runtime_error("Link already started");
 		}
+		startedAt = SimScheduler::Clock::now();
+		announcePerfDatarefs();
 
 		connectionThread = std::make_unique<std::thread>(std::thread([this]() {
+			AllocTracker::Scope scope(AllocRegion::IoThread);
 			while (!shouldStop) {
 				connectingPipe = Pipe::get();
 				try {
@@ -42,36 +100,41 @@ namespace xp11_va {
 					if (!connectingPipe->IsConnected()) {
 						continue;
 					}
-					
-					auto pipe_thread = std::make_unique<std::thread>([this, pipe = connectingPipe]() {
-						try {
-							while (!shouldStop) {
-								auto maybe_request = pipe->ReadPipe();
-								if (!maybe_request.has_value()) { break; }
-								
-								const auto request = maybe_request.value();
-								const auto response = processRequest(request);
-
-								if (!pipe->WritePipe(response + "\n")) { break; }
-								logger.Info("Responded with: " + response);
-							}
-						}
-						catch (...) {
-							logger.Error("Error on pipe thread: " + what());
-						}
-
-						logger.Trace("Pipe thread terminating");
-						});
+
+					auto connection = std::make_shared<Connection>(nextConnectionId++, connectingPipe, options.idleTimeout, options.requestTimeout);
+					// the thread only gets a raw pointer, the reaper joins it before the connection is released
+					connection->Attach(std::make_unique<std::thread>([this, conn = connection.get()]() { servePipe(*conn); }));
+
+					size_t active;
 					{
-						std::lock_guard<std::mutex> lock(pipesMutex);
-						pipes.emplace_back(std::make_pair(std::move(pipe_thread), connectingPipe));
+						std::lock_guard<InstrumentedMutex<std::mutex>> lock(connectionsMutex);
+						connections.emplace_back(connection);
+						active = connections.size();
 					}
+					logger.Info("Connection {} opened, {} active", connection->id(), active);
 				}
 				catch (...) {
-					logger.Error("Error on connect thread: " + what());
+					logger.Error("Error on connect thread: {}", what());
 				}
 			}
 		}));
+
+		reaperThread = std::make_unique<std::thread>([this]() {
+			AllocTracker::Scope scope(AllocRegion::IoThread);
+			std::unique_lock<std::mutex> lock(reaperMutex);
+			while (!shouldStop) {
+				reaperCv.wait_for(lock, options.reapInterval);
+				if (shouldStop) { break; }
+
+				try {
+					reapConnections();
+				}
+				catch (...) {
+					logger.Error("Error on reaper thread: {}", what());
+				}
+			}
+		});
+
 		started = true;
 	}
 
@@ -80,22 +143,32 @@ namespace xp11_va {
 		
 		try {
 			shouldStop = true;
-			
-			if (!pipes.empty()) {
-				logger.Info("Killing " + std::to_string(pipes.size()) + " pipes");
-				for (auto& pipe_pair : pipes) {
-					auto& thread = pipe_pair.first;
-					auto& pipe = pipe_pair.second;
-					pipe->Abort(thread->native_handle());
-					std::stringstream ss;
-					ss << "Pipe thread " << thread->get_id() << " killed, joining";
-					logger.Info(ss.str());
-					if (thread->joinable()) {
-						thread->join();
-					}
+
+			if (reaperThread) {
+				reaperCv.notify_all();
+				if (reaperThread->joinable()) {
+					reaperThread->join();
+				}
+				reaperThread.reset();
+			}
+
+			std::vector<std::shared_ptr<Connection>> closing{};
+			{
+				std::lock_guard<InstrumentedMutex<std::mutex>> lock(connectionsMutex);
+				closing.swap(connections);
+			}
+
+			if (!closing.empty()) {
+				logger.Info("Killing {} pipes", closing.size());
+				for (auto& connection : closing) {
+					connection->Close();
+					// this runs on the sim thread, so anything still queued would otherwise never complete
+					cancelSimWork(*connection->session());
+					logger.Info("Connection {} closed, joining", connection->id());
+					connection->Join();
 				}
 				logger.Info("Pipe threads killed, clearing list");
-				pipes.clear();
+				closing.clear();
 			}
 
 			if (connectionThread) {
@@ -110,23 +183,186 @@ namespace xp11_va {
 			}
 			
 			logger.Info("All pipes killed");
+			logSimThreadTime();
+			logLatency();
+			logLocks();
+			if (capture.Enabled()) {
+				logger.Info("Captured {} records to {}", capture.Stop(), options.capturePath);
+			}
 		} catch (...) {
-			logger.Error("Error while stopping pipes: " + what());
+			logger.Error("Error while stopping pipes: {}", what());
 		}
 	}
 
 	/* PRIVATE API */
 
-	XPLMFlightLoopID Link::createFlightLoop() {
+	void Link::servePipe(Connection& connection) {
+		AllocTracker::Scope scope(AllocRegion::IoThread);
+		// handler coroutines started on this thread take their frames from the connection's pool
+		FramePool::SetCurrent(&connection.frames());
+		char thread_name[32];
+		std::snprintf(thread_name, sizeof(thread_name), "connection %llu", static_cast<unsigned long long>(connection.id()));
+		Tracer::NameThisThread(thread_name);
+
+		capture.Record(Capture::Kind::Open, connection.id());
+		try {
+			// reused for every message, so once it has grown to fit the largest one reading doesn't allocate
+			std::string request;
+			while (!shouldStop && connection.IsOpen()) {
+				// handlers that outlived the last message's timeout and have since come back finish
+				// now, rather than waiting out the read for the client's next message
+				connection.io().Poll();
+				{
+					// mostly the connection sitting idle until the client sends, so it is kept apart from the read
+					Tracer::Scope span("pipe_wait", connection.id());
+					if (!connection.pipe().ReadPipe(request)) { break; }
+				}
+				{
+					// taking the message in, from the moment the read returned it
+					Tracer::Scope span("pipe_read", connection.id());
+					connection.Touch();
+					connection.traffic().bytesIn.fetch_add(request.size(), std::memory_order_relaxed);
+					capture.Record(Capture::Kind::Message, connection.id(), request);
+				}
+
+				Timelines timelines(&connection.arena());
+				auto response = processRequest(connection, request, &timelines);
+				response.push_back('\n');
+
+				{
+					Tracer::Scope span("pipe_write", connection.id());
+					if (!connection.pipe().WritePipe(response)) { break; }
+				}
+				connection.traffic().bytesOut.fetch_add(response.size(), std::memory_order_relaxed);
+				capture.Record(Capture::Kind::Response, connection.id(), response);
+				recordLatency(connection, timelines);
+				logger.Info("Responded with: {}", std::string_view(response).substr(0, response.size() - 1));
+
+				if (connection.LogSubscription()) {
+					streamLogs(connection);
+					break;
+				}
+			}
+		}
+		catch (...) {
+			logger.Error("Error on pipe thread: {}", what());
+		}
+
+		logger.Trace("Pipe thread terminating");
+		capture.Record(Capture::Kind::Close, connection.id());
+		FramePool::SetCurrent(nullptr);
+		connection.MarkFinished();
+		// wake the reaper so the thread and pipe are released now, rather than on the next sweep
+		reaperCv.notify_one();
+	}
+
+	void Link::streamLogs(Connection& connection) {
+		const auto subscription = connection.LogSubscription();
+		logger.Info("Connection {} following the log at level {}", connection.id(), Logger::LevelName(subscription->level));
+
+		// the pipe is synchronous, a read would hold up every write behind it, so from here on nothing is read
+		Logger::Record record;
+		char line[Logger::LINE_BYTES];
+		while (!shouldStop && connection.IsOpen()) {
+			if (subscription->Next(record, std::chrono::milliseconds(250))) {
+				const size_t length = Logger::Format(record, line, sizeof(line));
+				if (!connection.pipe().WritePipe(std::string_view(line, length))) { break; }
+				connection.traffic().bytesOut.fetch_add(length, std::memory_order_relaxed);
+			}
+			else if (subscription->IsDropped()) {
+				logger.Warn("Connection {} fell behind the log, dropping it", connection.id());
+				connection.pipe().WritePipe("{log_stream_dropped}\n");
+				break;
+			}
+			else if (!connection.pipe().IsPeerConnected()) {
+				// a quiet log writes nothing that could fail, so a client that has gone is looked for instead
+				logger.Info("Connection {} closed while following the log", connection.id());
+				break;
+			}
+			// there are no requests to show the client is still there, a write or the check above is what does
+			connection.Touch();
+		}
+
+		logger.Unsubscribe(subscription);
+		connection.SetLogSubscription(nullptr);
+	}
+
+	void Link::reapConnections() {
+		const auto now = Connection::Clock::now();
+		std::vector<std::shared_ptr<Connection>> finished{};
+		std::vector<std::shared_ptr<Session>> closed{};
+		size_t idle = 0;
+		size_t active = 0;
+
+		{
+			std::lock_guard<InstrumentedMutex<std::mutex>> lock(connectionsMutex);
+			for (auto it = connections.begin(); it != connections.end();) {
+				auto& connection = *it;
+
+				if (connection->IsOpen() && connection->IsIdle(now)) {
+					const auto idle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(connection->IdleFor(now)).count();
+					logger.Info("Connection {} idle for {}ms, closing", connection->id(), idle_ms);
+					connection->Close();
+					idle++;
+				}
+				else if (!connection->IsOpen()) {
+					// an earlier abort may have landed while the thread was busy, so keep trying
+					connection->Close();
+				}
+
+				if (!connection->IsOpen() || connection->IsFinished()) {
+					closed.push_back(connection->session());
+				}
+
+				if (connection->IsFinished()) {
+					finished.emplace_back(std::move(connection));
+					it = connections.erase(it);
+				}
+				else {
+					++it;
+				}
+			}
+			active = connections.size();
+		}
+
+		// a closed connection's thread may be waiting on queued work, so release that first
+		size_t cancelled = 0;
+		for (auto& session : closed) {
+			cancelled += cancelSimWork(*session);
+		}
+
+		// finished threads are on their way out, so joining them here is quick
+		for (auto& connection : finished) {
+			connection->Join();
+		}
+
+		if (!finished.empty() || idle > 0 || cancelled > 0) {
+			connectionsReaped += finished.size();
+			logger.Info("Reaped {} connections ({} newly idle, {} queued callbacks cancelled), {} active, {} reaped in total",
+				finished.size(), idle, cancelled, active, connectionsReaped.load());
+		}
+	}
+
+	XPLMFlightLoopID Link::createFlightLoop(SimPhase phase) {
 		XPLMCreateFlightLoop_t loop;
 		loop.structSize = sizeof(XPLMCreateFlightLoop_t);
-		loop.phase = xplm_FlightLoop_Phase_BeforeFlightModel;
 		loop.refcon = this;
-		loop.callbackFunc = [](float f1, float f2, int c, void* ref) -> float {
-			if (!ref) { return 0; }
-			auto* us = reinterpret_cast<Link*>(ref);
-			return us->onFlightLoop(f1, f2, c);
-		};
+		if (phase == SimPhase::AfterFlightModel) {
+			loop.phase = xplm_FlightLoop_Phase_AfterFlightModel;
+			loop.callbackFunc = [](float f1, float f2, int c, void* ref) -> float {
+				if (!ref) { return 0; }
+				auto* us = reinterpret_cast<Link*>(ref);
+				return us->onFlightLoop(SimPhase::AfterFlightModel, f1, f2, c);
+			};
+		}
+		else {
+			loop.phase = xplm_FlightLoop_Phase_BeforeFlightModel;
+			loop.callbackFunc = [](float f1, float f2, int c, void* ref) -> float {
+				if (!ref) { return 0; }
+				auto* us = reinterpret_cast<Link*>(ref);
+				return us->onFlightLoop(SimPhase::BeforeFlightModel, f1, f2, c);
+			};
+		}
 
 		XPLMFlightLoopID id = XPLMCreateFlightLoop(&loop);
 		if (!id) {
@@ -136,34 +372,126 @@ namespace xp11_va {
 		return id;
 	}
 
-	float Link::onFlightLoop(float /*elapsedSinceLastCall*/, float /*elapsedSinceLastLoop*/, int count) {
-		std::lock_guard<std::recursive_mutex> lock(callbackMutex);
-		if (!flightLoopCallbacks.empty()) {
-			logger.Info("Running " + std::to_string(flightLoopCallbacks.size()) + " callbacks");
+	float Link::onFlightLoop(SimPhase phase, float /*elapsedSinceLastCall*/, float /*elapsedSinceLastLoop*/, int count) {
+		AllocTracker::Scope scope(AllocRegion::SimThread);
+		Tracer::Scope span(phase == SimPhase::BeforeFlightModel ? "flight_loop_before_fm" : "flight_loop_after_fm");
+		const auto loop_start = SimScheduler::Clock::now();
+		flightLoopRates[static_cast<size_t>(phase)].Count(loop_start);
+		const auto frame = schedulerFor(phase).RunFrame();
 
-			CallbackList remaining{};
+		if (frame.ran > 0) {
+			logger.Info("Ran {} callbacks", frame.ran);
+		}
 
-			while (flightLoopCallbacks.size() > 0) {
-				auto cb = flightLoopCallbacks.front();
-				flightLoopCallbacks.pop_front();
-				// callback returns true when complete, false if needs to run again
-				if (!cb()) { remaining.push_back(cb); }
-			}
+		if (frame.cancelled > 0) {
+			tasksCancelled += frame.cancelled;
+			logger.Info("Dropped {} callbacks for closed connections", frame.cancelled);
+		}
+
+		if (frame.expired > 0) {
+			tasksExpired += frame.expired;
+			logger.Warn("Skipped {} callbacks past their deadline, {} in total", frame.expired, tasksExpired.load());
+		}
+
+		if (frame.deferred > 0) {
+			logger.Info("Frame budget or client quotas used up, {} callbacks left for the next frame", frame.deferred);
+		}
 
-			flightLoopCallbacks = remaining;
+		// the flight loop is the only place X-Plane's log may be written from, whichever thread logged
+		if (phase == SimPhase::BeforeFlightModel) {
+			logger.DrainToSim();
 		}
+
+		loopCost.Record(SimScheduler::Clock::now() - loop_start, frame.ran);
 		return 0.25;
 	}
 
-	void Link::runOnSimThread(const Callback& callback) {
-		std::lock_guard<std::recursive_mutex> lock(callbackMutex);
+	void Link::registerPerfDatarefs() {
+		struct PerfDataref {
+			const char* name;
+			XPLMGetDatai_f readInt;
+			XPLMGetDataf_f readFloat;
+		};
+
+		// X-Plane reads these on the sim thread, the same thread that updates loopCost
+		const PerfDataref perf[] = {
+			{ "xp11va/perf/loop_us_avg", nullptr, [](void* link) -> float { return static_cast<Link*>(link)->loopCost.AverageUs(); } },
+			{ "xp11va/perf/loop_us_max", nullptr, [](void* link) -> float { return static_cast<Link*>(link)->loopCost.MaxUs(); } },
+			{ "xp11va/perf/tasks_per_frame", nullptr, [](void* link) -> float { return static_cast<Link*>(link)->loopCost.TasksPerLoop(); } },
+			{ "xp11va/perf/queue_depth", [](void* link) -> int { return static_cast<int>(static_cast<Link*>(link)->queueDepth()); }, nullptr },
+		};
+
+		for (const auto& dataref : perf) {
+			const XPLMDataRef registered = XPLMRegisterDataAccessor(dataref.name, dataref.readInt ? xplmType_Int : xplmType_Float, 0,
+				dataref.readInt, nullptr, dataref.readFloat, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+				this, nullptr);
+			if (!registered) {
+				logger.Warn("Couldn't register dataref {}", dataref.name);
+				continue;
+			}
+			perfDatarefs.emplace_back(dataref.name, registered);
+		}
+	}
 
-		if (shouldStop) { return; } // do nothing, plugin is terminating
+	void Link::announcePerfDatarefs() {
+		const XPLMPluginID editor = XPLMFindPluginBySignature("xplanesdk.examples.DataRefEditor");
+		if (editor == XPLM_NO_PLUGIN_ID) { return; }
 
-		flightLoopCallbacks.push_back(callback);
+		for (const auto& [name, dataref] : perfDatarefs) {
+			XPLMSendMessageToPlugin(editor, MSG_ADD_DATAREF, const_cast<char*>(name));
+		}
 	}
 
-	std::string Link::processRequest(const std::string& request) {
+	uint64_t Link::queueDepth() const {
+		uint64_t queued = 0;
+		for (const auto* scheduler : { &beforeFlightModel, &afterFlightModel }) {
+			for (size_t lane = 0; lane < PRIORITY_COUNT; lane++) {
+				queued += scheduler->Stats(static_cast<Priority>(lane)).queued.load(std::memory_order_relaxed);
+			}
+		}
+		return queued;
+	}
+
+	void Link::runOnSimThread(SimTask task, SimPhase phase) {
+		if (shouldStop) {
+			// plugin is terminating, the flight loop may never run again
+			if (task.cancel) { task.cancel("{cancelled}"); }
+			return;
+		}
+
+		schedulerFor(phase).Queue(std::move(task));
+	}
+
+	Link::SimAwaiter Link::onSimThread(Connection& connection, RequestSchedule schedule) {
+		return SimAwaiter(*this, connection, schedule);
+	}
+
+	void Link::SimAwaiter::await_suspend(std::coroutine_handle<> handle) {
+		schedule.Mark(RequestMark::Enqueued);
+		// once queued the coroutine may be resumed at any moment, so nothing here touches it afterwards
+		link.runOnSimThread(SimTask{
+			connection.session(),
+			[this, handle]() -> bool {
+				if (schedule.timeline && Tracer::Enabled()) {
+					schedule.timeline->simThread = Tracer::ThisThread();
+				}
+				schedule.Mark(RequestMark::SimStart);
+				handle.resume();
+				return true;
+			},
+			[this, handle](const char* why) { failure = why; connection.io().Post(handle); },
+			schedule.deadline,
+			schedule.priority
+			}, schedule.phase);
+	}
+
+	size_t Link::cancelSimWork(const Session& session) {
+		const size_t cancelled = beforeFlightModel.Cancel(session) + afterFlightModel.Cancel(session);
+		tasksCancelled += cancelled;
+		return cancelled;
+	}
+
+	std::pmr::string Link::processRequest(Connection& connection, std::string_view request, Timelines* timelines) {
 		/* Request format:
 		 * data may be sent to the pipe in the following fashion:
 		 *     request;request;request;...;request
@@ -171,6 +499,15 @@ namespace xp11_va {
 		 * where each request has the following format:
 		 *     request_type:dataref_name[:dataref_type:dataref_value]
 		 *     request_type:command_name:command_action[:command_duration]
+		 *     ping
+		 *     opt:option_name:option_value
+		 *     stats:stat_name
+		 *     logs:logs_action:level
+		 *
+		 * any request may be prefixed with a priority and/or a read phase, which override the connection's defaults for that request:
+		 *     priority:request
+		 *     read_phase:request
+		 *     priority:read_phase:request
 		 *
 		 * For requests dealing with datarefs, valid values for request_type are 'get' and 'set'
 		 *   - dataref_name must be a valid dataref, and must refer to a writable dataref for 'set' commands
@@ -181,246 +518,846 @@ namespace xp11_va {
 		 *   - command_name must correspond to a valid action
 		 *   - command_action must be one of 'begin', 'end', 'once', or 'hold'
 		 *   - command_duration must be an integer number of milliseconds to hold the command active for, and is ignored if command_action is not 'hold'
+		 *
+		 * 'ping' does nothing but keep the connection alive, and replies with '{pong}'
+		 *
+		 * 'opt' changes a setting for this connection only
+		 *   - option_name must be 'idle_timeout', 'request_timeout', 'priority', 'weight' or 'read_phase'
+		 *   - for 'idle_timeout', option_value is the number of milliseconds without a request after which the connection is closed
+		 *   - for 'request_timeout', option_value is the number of milliseconds a request may wait for the sim thread before replying '{timeout}'
+		 *   - for 'priority', option_value is 'interactive', 'normal' or 'bulk', the lane this connection's requests are queued in
+		 *   - for 'weight', option_value is a number from 1 to 16, this connection's share of the sim thread relative to others in the same lane
+		 *   - for 'read_phase', option_value is 'before_fm' or 'after_fm', which side of the flight model step 'get' requests read on
+		 *
+		 * 'stats' reports the plugin's own counters, for every connection
+		 *   - stat_name must be 'alloc', 'latency', 'introspect' or 'locks'
+		 *   - 'alloc' replies with region:allocations:bytes:frees:freed_bytes for each allocation region, comma separated,
+		 *     or '{alloc_tracking_off}' unless the plugin was built with XP11VA_TRACK_ALLOCATIONS
+		 *   - 'latency' replies with kind:stage:count:p50:p99:p99.9 for each of 'get', 'set' and 'cmd' requests and each stage
+		 *     of handling them, comma separated, with the percentiles in nanoseconds
+		 *   - 'introspect' replies with a snapshot of the plugin's state, comma separated name:value... entries for uptime,
+		 *     flight loop calls and rate, sim thread queue lengths, held commands, the dataref and command caches, and the
+		 *     traffic on each open connection
+		 *   - 'locks' replies with name:acquisitions:contended:wait_ns:max_wait_ns:hold_ns:max_hold_ns for each lock shared by
+		 *     the pipe threads and the sim thread, comma separated
+		 *
+		 * 'logs' deals with the plugin's own log
+		 *   - level must be 'trace', 'info', 'warn', 'error', 'critical' or 'fatal'
+		 *   - for 'level', sets the lowest level written to the log files, for every connection
+		 *   - for 'subscribe', replies '{ok}' and from then on writes each log record at or above level to this connection,
+		 *     one line per message. Nothing more is read from the connection. A subscriber that falls too far behind is
+		 *     sent '{log_stream_dropped}' and disconnected.
+		 *
+		 * 'trace' records what the plugin spends its time on, for every connection
+		 *   - 'trace:start[:capacity]' starts recording into a ring of the last capacity spans, emptying it first
+		 *   - 'trace:stop' stops recording, keeping what was recorded
+		 *   - 'trace:write' writes the ring to the trace file as Chrome trace event JSON, replying '{trace_write_failed}'
+		 *     if it couldn't
+		 *
+		 * 'capture' records every message and response on every connection to the capture file, for replaying later
+		 *   - 'capture:start' starts a new capture, replacing the file, replying '{capture_failed}' if it couldn't be created
+		 *   - 'capture:stop' ends the capture and closes the file
 		*/
-		logger.Info("Received request: " + request);
+		const auto received = SimScheduler::Clock::now();
+		auto& arena = connection.arena();
+		// unless a handler from an earlier message is still running, its memory is free to use again
+		arena.Reset();
 
-		std::vector<std::vector<std::string>> commands = tokenize(request);
-		std::vector<std::string> results{};
+		logger.Info("Received request: {}", request);
 
-		logger.Info("Processed into " + std::to_string(commands.size()) + " requests");
+		// handlers keep views into the request, and may outlive the caller's copy of it
+		auto commands = tokenize(arena.Store(request), &arena);
 
-		for (auto& cmd : commands) {
-			if (cmd[0] == "get" || cmd[0] == "set") {
-				// this is a dataref request
-				results.push_back(handleDatarefRequest(cmd));
+		logger.Info("Processed into {} requests", commands.size());
+		connection.traffic().requestsIn.fetch_add(commands.size(), std::memory_order_relaxed);
+
+		// every request in the message is in flight at once, and they all share the message's deadline
+		const RequestSchedule schedule{
+			connection.RequestDeadline(),
+			connection.DefaultPriority(),
+			connection.ReadsAfterFlightModel() ? SimPhase::AfterFlightModel : SimPhase::BeforeFlightModel
+		};
+		auto replies = std::allocate_shared<PendingReplies>(std::pmr::polymorphic_allocator<PendingReplies>(&arena), commands.size(), &arena);
+		const auto parsed = SimScheduler::Clock::now();
+		const uint64_t first_id = nextRequestId.fetch_add(commands.size(), std::memory_order_relaxed);
+
+		for (size_t i = 0; i < commands.size(); i++) {
+			auto& timeline = replies->timelines[i];
+			timeline.marks[static_cast<size_t>(RequestMark::Read)] = received;
+			timeline.marks[static_cast<size_t>(RequestMark::Parsed)] = parsed;
+			timeline.id = first_id + i;
+			if (!commands[i].empty()) {
+				const auto& last = commands[i].back();
+				timeline.text = std::string_view(commands[i].front().data(), last.data() + last.size() - commands[i].front().data());
 			}
-			else if (cmd[0] == "cmd") {
-				// this is an action command
-				results.push_back(handleCommandRequest(cmd));
+			auto request_schedule = schedule;
+			request_schedule.timeline = &timeline;
+
+			arena.Retain();
+			runHandler(handleRequest(connection, std::move(commands[i]), request_schedule), replies, i, connection);
+		}
+
+		if (!connection.io().RunUntil(replies->remaining, schedule.deadline)) {
+			// stragglers finish on this thread later, writing into replies which they keep alive
+			requestsTimedOut++;
+			logger.Warn("Timed out waiting for the sim thread, {} timeouts so far", requestsTimedOut.load());
+		}
+
+		std::pmr::string response(&arena);
+		for (size_t i = 0; i < commands.size(); i++) {
+			const bool done = replies->done[i].load(std::memory_order_acquire);
+			response.append(done ? replies->results[i] : "{timeout}");
+			if (i < commands.size() - 1) {
+				response.push_back(';');
+			}
+
+			if (timelines && done) {
+				timelines->push_back(replies->timelines[i]);
+			}
+		}
+		connection.traffic().requestsOut.fetch_add(commands.size(), std::memory_order_relaxed);
+
+		return response;
+	}
+
+	std::string_view Link::handleOptionRequest(Connection& connection, const Tokens& request) {
+		if (request.size() != 3) {
+			return "{malformed_request}";
+		}
+
+		const auto& option_name = request[1];
+		const auto& option_value = request[2];
+
+		if (option_name == "idle_timeout" || option_name == "request_timeout") {
+			const auto timeout_ms = parseLong(option_value);
+			if (timeout_ms <= 0) {
+				return "{invalid_option_value}";
+			}
+
+			if (option_name == "idle_timeout") {
+				connection.SetIdleTimeout(std::chrono::milliseconds(timeout_ms));
 			}
 			else {
-				logger.Error("Invalid command: " + cmd[0]);
-				results.push_back("{invalid_command}");
+				connection.SetRequestTimeout(std::chrono::milliseconds(timeout_ms));
+			}
+			return "{ok}";
+		}
+
+		if (option_name == "weight") {
+			const auto weight = parseLong(option_value);
+			if (weight <= 0 || weight > Session::MAX_WEIGHT) {
+				return "{invalid_option_value}";
 			}
+
+			connection.session()->SetWeight(static_cast<uint32_t>(weight));
+			return "{ok}";
 		}
 
-		std::stringstream ss;
-		for (auto i = 0; i < results.size(); i++) {
-			ss << results[i];
-			if (i < results.size() - 1) {
-				ss << ';';
+		if (option_name == "read_phase") {
+			const auto phase = parseReadPhase(option_value);
+			if (!phase) {
+				return "{invalid_option_value}";
 			}
+
+			connection.SetReadsAfterFlightModel(*phase == SimPhase::AfterFlightModel);
+			return "{ok}";
 		}
 
-		return ss.str();
+		if (option_name == "priority") {
+			const auto priority = ParsePriority(option_value);
+			if (!priority) {
+				return "{invalid_option_value}";
+			}
+
+			connection.SetDefaultPriority(*priority);
+			return "{ok}";
+		}
+
+		logger.Warn("Invalid option: {}", option_name);
+		return "{invalid_option}";
 	}
 
-	std::string Link::handleDatarefRequest(const std::vector<std::string>& request) {
-		if (request.size() < 1) {
+	std::string_view Link::handleStatsRequest(Connection& connection, const Tokens& request) {
+		if (request.size() != 2) {
 			return "{malformed_request}";
 		}
 
+		const auto& stat_name = request[1];
+		if (stat_name == "alloc") {
+			if (!AllocTracker::Enabled()) {
+				return "{alloc_tracking_off}";
+			}
+
+			std::pmr::string text(&connection.arena());
+			for (size_t r = 0; r < ALLOC_REGION_COUNT; r++) {
+				const auto region = static_cast<AllocRegion>(r);
+				const auto totals = AllocTracker::Region(region);
+				if (r > 0) {
+					text.push_back(',');
+				}
+				text.append(AllocRegionName(region));
+				for (const auto value : { totals.allocations, totals.bytes, totals.frees, totals.freedBytes }) {
+					text.push_back(':');
+					appendNumber(text, value);
+				}
+			}
+			return connection.arena().Store(text);
+		}
+
+		if (stat_name == "introspect") {
+			std::pmr::string text(&connection.arena());
+			appendIntrospection(text);
+			return connection.arena().Store(text);
+		}
+
+		if (stat_name == "latency") {
+			std::pmr::string text(&connection.arena());
+			for (size_t kind = 0; kind < MEASURED_KIND_COUNT; kind++) {
+				for (size_t stage = 0; stage < REQUEST_STAGE_COUNT; stage++) {
+					const auto& histogram = latency[kind][stage];
+					if (!text.empty()) {
+						text.push_back(',');
+					}
+					text.append(kindName(static_cast<RequestKind>(kind)));
+					text.push_back(':');
+					text.append(stageName(stage));
+					text.push_back(':');
+					appendNumber(text, histogram.Count());
+					for (const double fraction : { 0.5, 0.99, 0.999 }) {
+						text.push_back(':');
+						appendNumber(text, static_cast<uint64_t>(histogram.Percentile(fraction).count()));
+					}
+				}
+			}
+
+			// and how long each lane's work waited for its flight loop, whatever the request
+			for (const auto phase : { SimPhase::BeforeFlightModel, SimPhase::AfterFlightModel }) {
+				for (size_t lane = 0; lane < PRIORITY_COUNT; lane++) {
+					const auto& histogram = schedulerFor(phase).Stats(static_cast<Priority>(lane)).wait;
+					text.append(",lane:");
+					text.append(phase == SimPhase::AfterFlightModel ? "after_fm" : "before_fm");
+					text.push_back(':');
+					text.append(PriorityName(static_cast<Priority>(lane)));
+					text.push_back(':');
+					appendNumber(text, histogram.Count());
+					for (const double fraction : { 0.5, 0.99, 0.999 }) {
+						text.push_back(':');
+						appendNumber(text, static_cast<uint64_t>(histogram.Percentile(fraction).count()));
+					}
+					text.push_back(':');
+					appendNumber(text, static_cast<uint64_t>(histogram.Max().count()));
+				}
+			}
+			return connection.arena().Store(text);
+		}
+
+		if (stat_name == "locks") {
+			std::pmr::string text(&connection.arena());
+			for (const auto& [name, stats] : locks()) {
+				if (!text.empty()) {
+					text.push_back(',');
+				}
+				text.append(name);
+				for (const auto* counter : { &stats->acquisitions, &stats->contended, &stats->waitNs, &stats->maxWaitNs, &stats->holdNs, &stats->maxHoldNs }) {
+					text.push_back(':');
+					appendNumber(text, counter->load(std::memory_order_relaxed));
+				}
+			}
+			return connection.arena().Store(text);
+		}
+
+		logger.Warn("Invalid stat: {}", stat_name);
+		return "{invalid_stat}";
+	}
+
+	void Link::appendIntrospection(std::pmr::string& text) {
+		// everything here is a counter that can be read without waiting on the sim thread, and
+		// the only lock taken is the one the connect and reaper threads hold briefly
+		const auto uptime = SimScheduler::Clock::now() - startedAt;
+		text.append("uptime_ms:");
+		appendNumber(text, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(uptime).count()));
+
+		for (const auto phase : { SimPhase::BeforeFlightModel, SimPhase::AfterFlightModel }) {
+			const char* phase_name = phase == SimPhase::AfterFlightModel ? "after_fm" : "before_fm";
+			const auto& rate = flightLoopRates[static_cast<size_t>(phase)];
+			text.append(",flight_loop:");
+			text.append(phase_name);
+			text.push_back(':');
+			appendNumber(text, rate.calls.load(std::memory_order_relaxed));
+			text.push_back(':');
+			appendDecimal(text, rate.hz.load(std::memory_order_relaxed));
+
+			for (size_t lane = 0; lane < PRIORITY_COUNT; lane++) {
+				text.append(",queued:");
+				text.append(phase_name);
+				text.push_back(':');
+				text.append(PriorityName(static_cast<Priority>(lane)));
+				text.push_back(':');
+				appendNumber(text, schedulerFor(phase).Stats(static_cast<Priority>(lane)).queued.load(std::memory_order_relaxed));
+			}
+		}
+
+		text.append(",held_commands:");
+		appendNumber(text, heldCommands.load());
+
+		const auto append_cache = [&text](const char* name, const auto& cache) {
+			text.push_back(',');
+			text.append(name);
+			for (const uint64_t value : { static_cast<uint64_t>(cache.Size()), cache.Hits(), cache.Misses(), static_cast<uint64_t>(cache.Negative()) }) {
+				text.push_back(':');
+				appendNumber(text, value);
+			}
+		};
+		append_cache("ref_cache", refCache);
+		append_cache("cmd_cache", cmdCache);
+
+		std::lock_guard<InstrumentedMutex<std::mutex>> lock(connectionsMutex);
+		for (const auto& connection : connections) {
+			const auto& traffic = connection->traffic();
+			text.append(",connection:");
+			appendNumber(text, connection->id());
+			for (const auto& counter : { &traffic.bytesIn, &traffic.bytesOut, &traffic.requestsIn, &traffic.requestsOut }) {
+				text.push_back(':');
+				appendNumber(text, counter->load(std::memory_order_relaxed));
+			}
+		}
+	}
+
+	std::string_view Link::handleLogsRequest(Connection& connection, const Tokens& request) {
+		if (request.size() != 3) {
+			return "{malformed_request}";
+		}
+
+		const auto level = Logger::ParseLevel(request[2]);
+		if (!level) {
+			return "{invalid_log_level}";
+		}
+
+		const auto& action = request[1];
+		if (action == "level") {
+			logger.SetMinLevel(*level);
+			logger.ForceLog(Logger::Level::Info, "Log level set to {} by connection {}", Logger::LevelName(*level), connection.id());
+			return "{ok}";
+		}
+
+		if (action == "subscribe") {
+			if (!connection.LogSubscription()) {
+				connection.SetLogSubscription(logger.Subscribe(*level));
+			}
+			return "{ok}";
+		}
+
+		logger.Warn("Invalid logs action: {}", action);
+		return "{invalid_logs_action}";
+	}
+
+	std::string_view Link::handleTraceRequest(const Tokens& request) {
+		if (request.size() < 2) {
+			return "{malformed_request}";
+		}
+
+		const auto& action = request[1];
+		if (action == "start") {
+			size_t capacity = Tracer::DEFAULT_CAPACITY;
+			if (request.size() > 2) {
+				const auto [end, error] = std::from_chars(request[2].data(), request[2].data() + request[2].size(), capacity);
+				if (error != std::errc() || end != request[2].data() + request[2].size() || capacity == 0) {
+					return "{malformed_request}";
+				}
+			}
+			Tracer::Start(capacity);
+			logger.Info("Tracing started, keeping the last {} spans", capacity);
+			return "{ok}";
+		}
+
+		if (action == "stop") {
+			Tracer::Stop();
+			logger.Info("Tracing stopped");
+			return "{ok}";
+		}
+
+		if (action == "write") {
+			const long written = Tracer::Write(options.tracePath);
+			if (written < 0) {
+				logger.Warn("Couldn't write a trace to {}", options.tracePath);
+				return "{trace_write_failed}";
+			}
+			logger.Info("Wrote {} spans to {}", written, options.tracePath);
+			return "{ok}";
+		}
+
+		logger.Warn("Invalid trace action: {}", action);
+		return "{invalid_trace_action}";
+	}
+
+	std::string_view Link::handleCaptureRequest(const Tokens& request) {
+		if (request.size() != 2) {
+			return "{malformed_request}";
+		}
+
+		const auto& action = request[1];
+		if (action == "start") {
+			if (!capture.Start(options.capturePath)) {
+				logger.Warn("Couldn't create a capture at {}", options.capturePath);
+				return "{capture_failed}";
+			}
+			logger.Info("Capturing traffic to {}", options.capturePath);
+			return "{ok}";
+		}
+
+		if (action == "stop") {
+			logger.Info("Captured {} records to {}", capture.Stop(), options.capturePath);
+			return "{ok}";
+		}
+
+		logger.Warn("Invalid capture action: {}", action);
+		return "{invalid_capture_action}";
+	}
+
+	Task<std::string_view> Link::handleRequest(Connection& connection, Tokens request, RequestSchedule schedule) {
+		// a leading priority or read phase, in either order, applies to this request only
+		size_t prefixes = 0;
+		for (; prefixes < 2 && request.size() > prefixes + 1; prefixes++) {
+			const auto& prefix = request[prefixes];
+			if (const auto priority = ParsePriority(prefix)) {
+				schedule.priority = *priority;
+			}
+			else if (const auto phase = parseReadPhase(prefix)) {
+				schedule.phase = *phase;
+			}
+			else {
+				break;
+			}
+		}
+		request.erase(request.begin(), request.begin() + prefixes);
+
+		const auto& request_type = request[0];
+		if (schedule.timeline) {
+			schedule.timeline->kind = request_type == "get" ? RequestKind::Get
+				: request_type == "set" ? RequestKind::Set
+				: request_type == "cmd" ? RequestKind::Cmd
+				: RequestKind::Other;
+		}
+
+		if (request_type == "get" || request_type == "set") {
+			// this is a dataref request
+			co_return co_await handleDatarefRequest(connection, std::move(request), schedule);
+		}
+		else if (request_type == "cmd") {
+			// this is an action command
+			co_return co_await handleCommandRequest(connection, std::move(request), schedule);
+		}
+		else if (request_type == "ping") {
+			co_return "{pong}";
+		}
+		else if (request_type == "opt") {
+			co_return handleOptionRequest(connection, request);
+		}
+		else if (request_type == "stats") {
+			co_return handleStatsRequest(connection, request);
+		}
+		else if (request_type == "logs") {
+			co_return handleLogsRequest(connection, request);
+		}
+		else if (request_type == "trace") {
+			co_return handleTraceRequest(request);
+		}
+		else if (request_type == "capture") {
+			co_return handleCaptureRequest(request);
+		}
+
+		logger.Error("Invalid command: {}", request_type);
+		co_return "{invalid_command}";
+	}
+
+	Task<std::string_view> Link::handleDatarefRequest(Connection& connection, Tokens request, RequestSchedule schedule) {
+		if (request.size() < 1) {
+			co_return "{malformed_request}";
+		}
+
 		try {
 			const auto& action = request[0];
 			if (action == "get") {
 				if (request.size() < 2) {
-					return "{malformed_request}";
+					co_return "{malformed_request}";
 				}
-				return getDataref(request);
+				co_return co_await getDataref(connection, request[1], schedule);
 			}
 			else if (action == "set") {
 				if (request.size() != 4) {
-					return "{malformed_request}";
+					co_return "{malformed_request}";
 				}
-				return setDataref(request);
+				co_return co_await setDataref(connection, request[1], request[2], request[3], schedule);
 			}
 			else {
-				throw std::runtime_error("Invalid dataref request action: " + action);
+				throw std::runtime_error("Invalid dataref request action: " + std::string(action));
 			}
 		}
 		catch (...) {
-			return "{error}";
+			co_return "{error}";
 		}
 	}
 
-	std::string Link::getDataref(const std::vector<std::string>& request) {
-		const std::string& dataref_name = request[1];
+	Task<std::string_view> Link::getDataref(Connection& connection, std::string_view dataref_name, RequestSchedule schedule) {
+		EnvData data{};
 
-		std::promise<std::string> get_promise;
-		auto get_future = get_promise.get_future();
+		const auto hop = co_await onSimThread(connection, schedule);
+		if (!hop) {
+			co_return hop.failure;
+		}
 
-		runOnSimThread([this, &get_promise, &dataref_name]() -> bool {
+		// on the sim thread from here, nothing but the lookup and the read
+		const char* failure = nullptr;
+		std::exception_ptr error;
+		try {
+			XplmTimer timer(xplmNs);
 			const XPLMDataRef dataref = refCache.Get(dataref_name).value();
 			if (!dataref) {
-				get_promise.set_value("{invalid_dataref}");
-				return true;
+				failure = "{invalid_dataref}";
 			}
-
-			try {
-				auto data = EnvData::fromDataref(dataref_name, dataref);
-				get_promise.set_value(data.ToString());
-			}
-			catch (...) {
-				get_promise.set_exception(std::current_exception());
+			else {
+				data.ReadFrom(dataref);
 			}
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
 
-			return true;
-			});
+		schedule.Mark(RequestMark::SimEnd);
+		co_await connection.io().Schedule();
+
+		// back on the pipe thread for logging and formatting
+		if (error) {
+			logger.Error("Error getting dataref: {}", what(error));
+			co_return "{get_failed}";
+		}
+		if (failure) {
+			co_return failure;
+		}
 
 		try {
-			return get_future.get();
+			data.name = dataref_name;
+			std::pmr::string text(&connection.arena());
+			text.reserve(dataref_name.size() + 16 + data.arrayElemCount * 12);
+			data.AppendTo(text);
+			co_return connection.arena().Store(text);
 		}
 		catch (...) {
-			logger.Error("Error getting dataref: " + what());
-			return "{get_failed}";
+			logger.Error("Error formatting dataref: {}", what());
+			co_return "{get_failed}";
 		}
 	}
 
-	std::string Link::setDataref(const std::vector<std::string>& request) {
-		const auto& dataref_name = request[1];
-		const auto& dataref_type = request[2];
-		const auto& dataref_value = request[3];
-
-		std::promise<std::string> set_promise;
-		auto set_future = set_promise.get_future();
+	Task<std::string_view> Link::setDataref(Connection& connection, std::string_view dataref_name, std::string_view dataref_type, std::string_view dataref_value, RequestSchedule schedule) {
+		EnvData ed{};
+		try {
+			ed = EnvData::fromString(dataref_name, dataref_type, dataref_value);
+		}
+		catch (...) {
+			logger.Error("Error parsing dataref value: {}", what());
+			co_return "{set_failed}";
+		}
 
-		runOnSimThread([this, &set_promise, dataref_name, dataref_type, dataref_value]() -> bool {
-			auto ed = EnvData::fromString(dataref_name, dataref_type, dataref_value);
+		// written before the flight model, so it uses the new value this frame rather than overwriting it
+		schedule.phase = SimPhase::BeforeFlightModel;
+		const auto hop = co_await onSimThread(connection, schedule);
+		if (!hop) {
+			co_return hop.failure;
+		}
 
+		// on the sim thread from here, nothing but the lookup, the checks and the write
+		const char* reply = "{ok}";
+		XPLMDataTypeID actual_type = xplmType_Unknown;
+		{
+			XplmTimer timer(xplmNs);
 			XPLMDataRef dataref = refCache.Get(ed.name).value();
 			if (!dataref) {
-				set_promise.set_value("{invalid_dataref}");
-				return true;
+				reply = "{invalid_dataref}";
 			}
+			else if (((actual_type = XPLMGetDataRefTypes(dataref)) & ed.type) == 0) {
+				reply = "{dataref_type_mismatch}";
+			}
+			else if (!XPLMCanWriteDataRef(dataref)) {
+				reply = "{dataref_not_writable}";
+			}
+			else if (!ed.WriteTo(dataref)) {
+				reply = "{unknown_type}";
+			}
+		}
 
-			auto type = XPLMGetDataRefTypes(dataref);
-			if ((type & ed.type) == 0) {
-				std::stringstream ss;
-				ss << "Dataref type mismatch, user sent " << ed.type << ", X-Plane expects " << type;
-				logger.Warn(ss.str());
-				set_promise.set_value("{dataref_type_mismatch}");
-				return true;
+		schedule.Mark(RequestMark::SimEnd);
+		co_await connection.io().Schedule();
+
+		if (reply == std::string_view("{dataref_type_mismatch}")) {
+			logger.Warn("Dataref type mismatch, user sent {}, X-Plane expects {}", ed.type, actual_type);
+		}
+		else if (reply == std::string_view("{unknown_type}")) {
+			logger.Warn("Unknown dataref type {}", ed.type);
+		}
+
+		co_return reply;
+	}
+
+	Task<std::string_view> Link::handleCommandRequest(Connection& connection, Tokens request, RequestSchedule schedule) {
+		if (request.size() < 3) { throw "malformed_action"; }
+
+		const std::string_view command_name = request[1];
+		const std::string_view command_action = request[2];
+
+		CommandAction action;
+		long hold_duration = 0;
+		if (command_action == "begin") {
+			action = CommandAction::Begin;
+		}
+		else if (command_action == "end") {
+			action = CommandAction::End;
+		}
+		else if (command_action == "once") {
+			action = CommandAction::Once;
+		}
+		else if (command_action == "hold") {
+			action = CommandAction::Hold;
+			if (request.size() < 4) {
+				logger.Trace("Command {} missing hold duration", command_name);
+				co_return "{missing_hold_duration}";
 			}
+			hold_duration = parseLong(request[3]);
+		}
+		else {
+			logger.Trace("Command action {} invalid", command_action);
+			co_return "{invalid_command_action}";
+		}
 
-			if (XPLMCanWriteDataRef(dataref)) {
-				switch (ed.type) {
-				case xplmType_Int:
-					XPLMSetDatai(dataref, ed.intVal);
-					break;
-				case xplmType_Float:
-					XPLMSetDataf(dataref, ed.floatVal);
-					break;
-				case xplmType_Double:
-					XPLMSetDatad(dataref, ed.doubleVal);
-					break;
-				case xplmType_FloatArray:
-					XPLMSetDatavf(dataref, ed.floatArray, 0, static_cast<int>(ed.arrayElemCount));
+		// as with sets, commands act before the flight model so it sees them this frame
+		schedule.phase = SimPhase::BeforeFlightModel;
+		const auto hop = co_await onSimThread(connection, schedule);
+		if (!hop) {
+			co_return hop.failure;
+		}
+
+		// on the sim thread from here, nothing but the lookup and the command call
+		XPLMCommandRef cmd;
+		const auto held_from = std::chrono::steady_clock::now();
+		{
+			XplmTimer timer(xplmNs);
+			cmd = cmdCache.Get(command_name).value();
+			if (cmd) {
+				switch (action) {
+				case CommandAction::Begin:
+				case CommandAction::Hold:
+					XPLMCommandBegin(cmd);
 					break;
-				case xplmType_IntArray:
-					XPLMSetDatavi(dataref, ed.intArray, 0, static_cast<int>(ed.arrayElemCount));
+				case CommandAction::End:
+					XPLMCommandEnd(cmd);
 					break;
-				case xplmType_Data:
-					XPLMSetDatab(dataref, ed.byteArray, 0, static_cast<int>(ed.arrayElemCount));
+				case CommandAction::Once:
+					XPLMCommandOnce(cmd);
 					break;
-				case xplmType_Unknown:
-				default:
-					logger.Warn("Unknown dataref type " + std::to_string(ed.type));
-					set_promise.set_value("{unknown_type}");
-					return true;
 				}
-				set_promise.set_value("{ok}");
-				return true;
-			}
-			else {
-				set_promise.set_value("{dataref_not_writable}");
 			}
+		}
 
-			return true;
-			});
+		schedule.Mark(RequestMark::SimEnd);
+		co_await connection.io().Schedule();
 
-		try {
-			return set_future.get();
+		if (!cmd) {
+			logger.Warn("Command {} not found", command_name);
+			co_return "{invalid_command}";
 		}
-		catch (...) {
-			logger.Error("Error setting dataref: " + what());
-			return "{set_failed}";
+
+		logger.Trace("Command {} {}", command_name, command_action);
+
+		if (action == CommandAction::Hold) {
+			// not tied to the session, a held command must be released even if the client goes away, and on time
+			heldCommands++;
+			runOnSimThread(SimTask{ nullptr, [this, then = held_from, duration = hold_duration, cmd, command_name = std::string(command_name)]() -> bool {
+				const auto now = std::chrono::steady_clock::now();
+				if (std::chrono::duration_cast<std::chrono::milliseconds>(now - then).count() < duration) {
+					logger.Trace("Command {} has longer to run yet", command_name);
+					return false;
+				}
+
+				logger.Trace("Command {} hold ending", command_name);
+				XplmTimer timer(xplmNs);
+				XPLMCommandEnd(cmd);
+				heldCommands--;
+				return true;
+				}, nullptr, Deadline::max(), Priority::Interactive });
 		}
+
+		co_return "{ok}";
 	}
 
-	std::string Link::handleCommandRequest(const std::vector<std::string>& request) {
-		if (request.size() < 3) { throw "malformed_action"; }
+	void Link::FlightLoopRate::Count(SimScheduler::Clock::time_point now) {
+		const uint64_t total = calls.fetch_add(1, std::memory_order_relaxed) + 1;
+		if (windowStart == SimScheduler::Clock::time_point{}) {
+			windowStart = now;
+			windowCalls = total;
+			return;
+		}
+
+		const auto elapsed = std::chrono::duration<float>(now - windowStart).count();
+		if (elapsed >= 1.0f) {
+			hz.store((total - windowCalls) / elapsed, std::memory_order_relaxed);
+			windowStart = now;
+			windowCalls = total;
+		}
+	}
 
-		const std::string& command_name = request[1];
-		const std::string& command_action = request[2];
-		const std::optional<std::string> command_duration = request.size() >= 4 ? request[3] : std::optional<std::string>{};
+	void Link::logSimThreadTime() {
+		uint64_t tasks = 0;
+		uint64_t task_ns = 0;
+		for (auto* scheduler : { &beforeFlightModel, &afterFlightModel }) {
+			for (size_t lane = 0; lane < PRIORITY_COUNT; lane++) {
+				const auto& stats = scheduler->Stats(static_cast<Priority>(lane));
+				tasks += stats.tasks.load();
+				task_ns += stats.runNs.load();
+			}
+		}
+		if (tasks == 0) { return; }
+
+		logger.ForceLog(Logger::Level::Info, "Sim thread ran {} tasks, {}us per task of which {}us in XPLM calls",
+			tasks, task_ns / 1000.0 / tasks, xplmNs.load() / 1000.0 / tasks);
 
-		std::promise<std::string> cmd_promise;
-		auto cmd_future = cmd_promise.get_future();
+		for (const auto phase : { SimPhase::BeforeFlightModel, SimPhase::AfterFlightModel }) {
+			for (size_t lane = 0; lane < PRIORITY_COUNT; lane++) {
+				const auto& stats = schedulerFor(phase).Stats(static_cast<Priority>(lane));
+				const auto lane_tasks = stats.tasks.load();
+				if (lane_tasks == 0) { continue; }
 
-		runOnSimThread([this, &cmd_promise, command_name, command_action, command_duration]() -> bool {
-			const auto cmd = cmdCache.Get(command_name).value();
-			if (!cmd) {
-				logger.Warn("Command " + command_name + " not found");
-				cmd_promise.set_value("{invalid_command}");
+				logger.ForceLog(Logger::Level::Info, "{} flight model, {} lane: {} tasks, waited {}ms on average and {}ms at most, {} deferred to a later frame",
+					phase == SimPhase::AfterFlightModel ? "After" : "Before", PriorityName(static_cast<Priority>(lane)), lane_tasks,
+					stats.waitNs.load() / 1e6 / lane_tasks, stats.maxWaitNs.load() / 1e6, stats.deferred.load());
 			}
+		}
+	}
 
-			if (command_action == "begin") {
-				logger.Trace("Command " + command_name + " beginning");
-				XPLMCommandBegin(cmd);
+	const char* Link::stageName(size_t stage) {
+		static const char* const names[REQUEST_STAGE_COUNT] = { "parse", "dispatch", "queue", "sim", "encode", "write", "total" };
+		return stage < REQUEST_STAGE_COUNT ? names[stage] : "unknown";
+	}
+
+	const char* Link::kindName(RequestKind kind) {
+		switch (kind) {
+		case RequestKind::Get: return "get";
+		case RequestKind::Set: return "set";
+		case RequestKind::Cmd: return "cmd";
+		case RequestKind::Other: return "other";
+		}
+		return "unknown";
+	}
+
+	void Link::recordLatency(const Connection& connection, Timelines& timelines) {
+		constexpr size_t written = static_cast<size_t>(RequestMark::Written);
+		const auto now = SimScheduler::Clock::now();
+		const bool tracing = Tracer::Enabled();
+
+		for (auto& timeline : timelines) {
+			timeline.marks[written] = now;
+			if (tracing) {
+				traceRequest(connection, timeline);
 			}
-			else if (command_action == "end") {
-				logger.Trace("Command " + command_name + " ending");
-				XPLMCommandEnd(cmd);
+			if (timeline.kind == RequestKind::Other) { continue; }
+			auto& histograms = latency[static_cast<size_t>(timeline.kind)];
+
+			// a stage is only counted when the request reached both ends of it, those that never
+			// went to the sim thread have no queue or sim stage, and their encode stage is skipped too
+			for (size_t stage = 0; stage < written; stage++) {
+				const auto from = timeline.marks[stage];
+				const auto to = timeline.marks[stage + 1];
+				if (from.time_since_epoch().count() != 0 && to.time_since_epoch().count() != 0) {
+					histograms[stage].Record(to - from);
+				}
 			}
-			else if (command_action == "once") {
-				logger.Trace("Command " + command_name + " firing once");
-				XPLMCommandOnce(cmd);
+			histograms[REQUEST_STAGE_COUNT - 1].Record(now - timeline.marks[static_cast<size_t>(RequestMark::Read)]);
+		}
+	}
+
+	void Link::traceRequest(const Connection& connection, const RequestTimeline& timeline) {
+		const auto& marks = timeline.marks;
+		const char* name = kindName(timeline.kind);
+		const auto read = marks[static_cast<size_t>(RequestMark::Read)];
+		const auto written = marks[static_cast<size_t>(RequestMark::Written)];
+
+		// the requests of a message overlap, so each is on a track of its own, with its stages nested inside it
+		Tracer::RecordAsync(name, read, written, connection.id(), timeline.id, timeline.text);
+		for (size_t stage = 0; stage + 1 < REQUEST_MARK_COUNT; stage++) {
+			if (marks[stage].time_since_epoch().count() != 0 && marks[stage + 1].time_since_epoch().count() != 0) {
+				Tracer::RecordAsync(stageName(stage), marks[stage], marks[stage + 1], connection.id(), timeline.id);
 			}
-			else if (command_action == "hold") {
-				logger.Trace("Command " + command_name + " start and hold");
-				if (!command_duration.has_value()) {
-					logger.Trace("Command " + command_name + " missing hold duration");
-					cmd_promise.set_value("{missing_hold_duration}");
-					return true;
-				}
+		}
 
-				const auto hold_duration = std::strtol(command_duration.value().c_str(), nullptr, 10);
+		// and the time it held the sim thread is shown on the sim thread, inside the flight loop it ran in
+		const auto sim_start = marks[static_cast<size_t>(RequestMark::SimStart)];
+		const auto sim_end = marks[static_cast<size_t>(RequestMark::SimEnd)];
+		if (timeline.simThread != 0 && sim_start.time_since_epoch().count() != 0 && sim_end.time_since_epoch().count() != 0) {
+			Tracer::Record(name, sim_start, sim_end, connection.id(), timeline.id, timeline.text, timeline.simThread);
+		}
+	}
 
-				XPLMCommandBegin(cmd);
-				runOnSimThread([then = std::chrono::steady_clock::now(), duration = hold_duration, cmd, command_name]() -> bool {
-					const auto now = std::chrono::steady_clock::now();
-					if (std::chrono::duration_cast<std::chrono::milliseconds>(now - then).count() < duration) {
-						logger.Trace("Command " + command_name + " has longer to run yet");
-						return false;
-					}
+	void Link::logLatency() {
+		for (size_t kind = 0; kind < MEASURED_KIND_COUNT; kind++) {
+			for (size_t stage = 0; stage < REQUEST_STAGE_COUNT; stage++) {
+				const auto& histogram = latency[kind][stage];
+				if (histogram.Count() == 0) { continue; }
 
-					logger.Trace("Command " + command_name + " hold ending");
-					XPLMCommandEnd(cmd);
-					return true;
-					});
-			}
-			else {
-				logger.Trace("Command action " + command_action + " invalid");
-				cmd_promise.set_value("{invalid_command_action}");
+				logger.ForceLog(Logger::Level::Info, "{} requests, {}: {} measured, p50 {}us, p99 {}us, p99.9 {}us, max {}us",
+					kindName(static_cast<RequestKind>(kind)), stageName(stage), histogram.Count(),
+					histogram.Percentile(0.5).count() / 1000.0, histogram.Percentile(0.99).count() / 1000.0,
+					histogram.Percentile(0.999).count() / 1000.0, histogram.Max().count() / 1000.0);
 			}
+		}
+	}
 
-			cmd_promise.set_value("{ok}");
-			return true;
-			});
+	std::array<std::pair<const char*, const LockStats*>, 3> Link::locks() const {
+		return { {
+			{ connectionsMutex.Name(), &connectionsMutex.Stats() },
+			{ beforeFlightModel.Lock().Name(), &beforeFlightModel.Lock().Stats() },
+			{ afterFlightModel.Lock().Name(), &afterFlightModel.Lock().Stats() },
+		} };
+	}
 
-		try {
-			return cmd_future.get();
-		}
-		catch (...) {
-			logger.Error("Error in command: " + what());
-			return "{cmd_failed}";
+	void Link::logLocks() {
+		for (const auto& [name, stats] : locks()) {
+			const uint64_t acquisitions = stats->acquisitions.load();
+			if (acquisitions == 0) { continue; }
+
+			const uint64_t contended = stats->contended.load();
+			logger.ForceLog(Logger::Level::Info, "Lock {}: taken {} times, {} waited for ({}%), {}us waiting (max {}us), {}us held (max {}us)",
+				name, acquisitions, contended, 100.0 * contended / acquisitions,
+				stats->waitNs.load() / 1000.0, stats->maxWaitNs.load() / 1000.0, stats->holdNs.load() / 1000.0, stats->maxHoldNs.load() / 1000.0);
 		}
 	}
 
 	/* HELPER METHODS */
 
 	std::string what() {
-		const auto e = std::current_exception();
+		return what(std::current_exception());
+	}
+
+	long parseLong(std::string_view text) {
+		return parseNumber<long>(text);
+	}
+
+	void appendNumber(std::pmr::string& text, uint64_t value) {
+		char digits[24];
+		const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+		text.append(digits, result.ptr);
+	}
+
+	void appendDecimal(std::pmr::string& text, double value) {
+		char digits[32];
+		const auto result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, 2);
+		text.append(digits, result.ptr);
+	}
+
+	std::optional<Link::SimPhase> parseReadPhase(std::string_view name) {
+		if (name == "before_fm") { return Link::SimPhase::BeforeFlightModel; }
+		if (name == "after_fm") { return Link::SimPhase::AfterFlightModel; }
+		return std::nullopt;
+	}
+
+	std::string what(const std::exception_ptr& e) {
 		if (!e) { throw std::bad_exception(); }
 
 		try { std::rethrow_exception(e); }
@@ -430,38 +1367,54 @@ namespace xp11_va {
 		catch (...) { return "unknown exception type"; }
 	}
 
-	std::vector<std::vector<std::string>> tokenize(const std::string& request) {
-		std::vector<std::vector<std::string>> commands;
+	Detached runHandler(Task<std::string_view> handler, std::shared_ptr<PendingReplies> replies, size_t index, Connection& connection) {
+		std::string_view result;
+		try {
+			result = co_await std::move(handler);
+		}
+		catch (...) {
+			logger.Error("Error in request handler: {}", what());
+			result = "{error}";
+		}
+
+		replies->results[index] = result;
+		replies->timelines[index].Mark(Link::RequestMark::Encoded);
+		replies->done[index].store(true, std::memory_order_release);
+		replies->remaining.fetch_sub(1, std::memory_order_acq_rel);
+		connection.io().Wake();
+		connection.arena().Release();
+	}
+
+	std::pmr::vector<Link::Tokens> tokenize(std::string_view request, std::pmr::memory_resource* arena) {
+		std::pmr::vector<Link::Tokens> commands(arena);
 
-		std::string remaining = request.substr(0);
+		std::string_view remaining = request;
 
 		while (!remaining.empty()) {
 			auto next_semi = remaining.find(';');
-			std::string command = remaining.substr(0, next_semi);
-			if (std::string::npos != next_semi && remaining.size() - 1 > next_semi) {
-				remaining = remaining.substr(remaining.find(';') + 1);
+			const std::string_view command = remaining.substr(0, next_semi);
+			if (std::string_view::npos != next_semi && remaining.size() - 1 > next_semi) {
+				remaining = remaining.substr(next_semi + 1);
 			}
 			else {
-				remaining = "";
+				remaining = {};
 			}
 
-			commands.push_back({});
-			size_t c_idx = commands.size() - 1;
+			auto& tokens = commands.emplace_back();
 
 			size_t t_start = 0,
 				   t_end = command.find(':', t_start);
 			while (true) {
-				std::string token = command.substr(t_start, t_end - t_start);
-				commands[c_idx].push_back(token);
+				tokens.push_back(command.substr(t_start, t_end - t_start));
 
-				if (t_end == std::string::npos) { break; }
+				if (t_end == std::string_view::npos) { break; }
 				t_start = t_end + 1;
 				t_end = command.find(':', t_start);
 			}
 
-			logger.Info("Processed token: " + command);
+			logger.Info("Processed token: {}", command);
 		}
 
 		return commands;
 	}
-}
\ No newline at end of file
+}
@@ -2,49 +2,243 @@
 
 #include <XPLM/XPLMProcessing.h>
 
+#include "Capture.h"
+#include "Connection.h"
+#include "Coroutine.h"
 #include "DataCache.h"
+#include "LatencyHistogram.h"
+#include "LoopCost.h"
 #include "Pipe.h"
+#include "SimScheduler.h"
+#include "Tracer.h"
 
 namespace xp11_va {
+	struct LinkOptions {
+		// connections that have not sent anything (including a ping) for this long are reaped
+		std::chrono::milliseconds idleTimeout{ std::chrono::minutes(5) };
+		// how often the reaper wakes up to look for idle or finished connections
+		std::chrono::milliseconds reapInterval{ std::chrono::seconds(1) };
+		// how long a request waits for the sim thread before replying {timeout}
+		std::chrono::milliseconds requestTimeout{ std::chrono::seconds(5) };
+		// how the flight loop shares its time between lanes and connections
+		SchedulerOptions scheduler{};
+		// where trace:write puts the trace
+		std::string tracePath{ "XP11_VA_Link.trace.json" };
+		// where capture:start records the traffic on every connection
+		std::string capturePath{ "XP11_VA_Link.capture" };
+	};
+
 	class Link {
 	public:
-		typedef std::function<bool()> Callback;
-		typedef std::list<Callback> CallbackList;
+		typedef SimScheduler::Callback Callback;
+		typedef SimScheduler::Clock::time_point Deadline;
+		typedef SimScheduler::Task SimTask;
+		// the parts of one request, views into the message's copy in the connection's arena
+		typedef std::pmr::vector<std::string_view> Tokens;
+
+		// which side of X-Plane's flight model step work runs on, each has its own flight loop and queue
+		enum class SimPhase {
+			// sets and commands made here are seen by the flight model in the same frame
+			BeforeFlightModel,
+			// reads made here see the results of this frame's flight model step
+			AfterFlightModel
+		};
+
+		// the kinds of request whose latency is measured
+		enum class RequestKind : uint8_t {
+			Get,
+			Set,
+			Cmd,
+			// everything else, which never leaves the pipe thread and isn't measured
+			Other
+		};
+		static constexpr size_t MEASURED_KIND_COUNT = 3;
+
+		// the points a request passes on its way through the plugin, in the order it passes them
+		enum class RequestMark : uint8_t {
+			Read,
+			Parsed,
+			Enqueued,
+			SimStart,
+			SimEnd,
+			Encoded,
+			Written
+		};
+		static constexpr size_t REQUEST_MARK_COUNT = 7;
+
+		// the time from each mark to the next one (parse to write), then from the first to the last (total)
+		static constexpr size_t REQUEST_STAGE_COUNT = REQUEST_MARK_COUNT;
+
+		// when one request passed each mark, marks it never reached are left at zero
+		struct RequestTimeline {
+			RequestKind kind = RequestKind::Other;
+			std::array<SimScheduler::Clock::time_point, REQUEST_MARK_COUNT> marks{};
+			// for tracing: the request's number, the Tracer thread it ran on in the flight loop, and its text,
+			// a view into the message that is only valid until the connection's next message
+			uint64_t id = 0;
+			uint32_t simThread = 0;
+			std::string_view text;
+
+			void Mark(RequestMark mark) { marks[static_cast<size_t>(mark)] = SimScheduler::Clock::now(); }
+		};
+		typedef std::pmr::vector<RequestTimeline> Timelines;
+
+		// how the sim thread work for a single request is scheduled
+		struct RequestSchedule {
+			Deadline deadline;
+			Priority priority;
+			SimPhase phase;
+			// where the request's handlers mark their progress, if it is being measured
+			RequestTimeline* timeline = nullptr;
+
+			void Mark(RequestMark mark) const {
+				if (timeline) { timeline->Mark(mark); }
+			}
+		};
+
+		struct SimHop {
+			// nullptr when the coroutine is now running on the sim thread, otherwise the reply to give
+			const char* failure;
+			explicit operator bool() const { return failure == nullptr; }
+		};
+
+		/*
+		 * co_await onSimThread(...) continues the coroutine inside the flight loop,
+		 * without blocking the thread that awaited it. If the work is cancelled or
+		 * expires before the flight loop gets to it, the coroutine continues on the
+		 * connection's I/O thread instead, with the reason in SimHop::failure.
+		 */
+		class SimAwaiter {
+		public:
+			SimAwaiter(Link& l, Connection& c, RequestSchedule s) : link(l), connection(c), schedule(s), failure(nullptr) {}
+
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<>);
+			SimHop await_resume() const noexcept { return { failure }; }
+
+		private:
+			Link& link;
+			Connection& connection;
+			RequestSchedule schedule;
+			const char* failure;
+		};
 		
-		Link();
+		Link(LinkOptions = {});
 		~Link();
 
 		void Start();
 		void Stop();
 
 	private:
+		const LinkOptions options;
 		bool started;
 		std::atomic_bool shouldStop;
 		std::unique_ptr<std::thread> connectionThread;
 		std::shared_ptr<Pipe> connectingPipe;
-		std::vector<std::pair<
-			std::unique_ptr<std::thread>,
-			std::shared_ptr<Pipe>>> pipes;
-		std::mutex pipesMutex;
+		Connection::Id nextConnectionId;
+		std::vector<std::shared_ptr<Connection>> connections;
+		InstrumentedMutex<std::mutex> connectionsMutex{ "connections" };
+
+		std::unique_ptr<std::thread> reaperThread;
+		std::condition_variable reaperCv;
+		std::mutex reaperMutex;
+		std::atomic<uint64_t> connectionsReaped;
+
+		void servePipe(Connection&);
+		// writes the connection's log subscription to its pipe until either end gives up
+		void streamLogs(Connection&);
+		void reapConnections();
 		
-		XPLMFlightLoopID flightLoopID;
-		std::recursive_mutex callbackMutex;
-		CallbackList flightLoopCallbacks;
+		XPLMFlightLoopID beforeFlightLoopID;
+		XPLMFlightLoopID afterFlightLoopID;
+		SimScheduler beforeFlightModel;
+		SimScheduler afterFlightModel;
 		std::atomic<float> totalTimeElapsed;
+		std::atomic<uint64_t> tasksCancelled;
+		std::atomic<uint64_t> tasksExpired;
+		std::atomic<uint64_t> requestsTimedOut;
+		// held commands still waiting to be released
+		std::atomic<uint64_t> heldCommands;
+		std::atomic<uint64_t> nextRequestId;
+		SimScheduler::Clock::time_point startedAt;
+
+		// how often one flight loop is called, worked out by the sim thread about once a second
+		struct FlightLoopRate {
+			std::atomic<uint64_t> calls{ 0 };
+			std::atomic<float> hz{ 0 };
+			// only touched by the sim thread
+			SimScheduler::Clock::time_point windowStart{};
+			uint64_t windowCalls = 0;
+
+			void Count(SimScheduler::Clock::time_point now);
+		};
+		std::array<FlightLoopRate, 2> flightLoopRates;
+
+		// the traffic on every connection, while capture:start is in effect
+		Capture capture;
+
+		// what the flight loops cost X-Plane, published as read-only xp11va/perf/... datarefs
+		LoopCost loopCost;
+		std::vector<std::pair<const char*, XPLMDataRef>> perfDatarefs;
+		void registerPerfDatarefs();
+		// lists them in DataRefEditor, if it is installed, which only shows plugin datarefs it is told about
+		void announcePerfDatarefs();
+		uint64_t queueDepth() const;
 
-		XPLMFlightLoopID createFlightLoop();
-		float onFlightLoop(float, float, int);
-		void runOnSimThread(const Callback&);
+		// time spent inside XPLM calls made by request handlers, written by the sim thread only
+		std::atomic<uint64_t> xplmNs;
+		// adds the time spent in its scope to xplmNs
+		class XplmTimer;
+		void logSimThreadTime();
+
+		// the time requests of each kind spent in each stage, and in total
+		std::array<std::array<LatencyHistogram, REQUEST_STAGE_COUNT>, MEASURED_KIND_COUNT> latency;
+		static const char* stageName(size_t stage);
+		static const char* kindName(RequestKind);
+		// marks the timelines written, adds them to the histograms, and traces them if tracing is on
+		void recordLatency(const Connection&, Timelines&);
+		void traceRequest(const Connection&, const RequestTimeline&);
+		void logLatency();
+		// the locks the pipe threads and the sim thread share, by name
+		std::array<std::pair<const char*, const LockStats*>, 3> locks() const;
+		void logLocks();
+
+		XPLMFlightLoopID createFlightLoop(SimPhase);
+		float onFlightLoop(SimPhase, float, float, int);
+		SimScheduler& schedulerFor(SimPhase phase) { return phase == SimPhase::AfterFlightModel ? afterFlightModel : beforeFlightModel; }
+		void runOnSimThread(SimTask, SimPhase = SimPhase::BeforeFlightModel);
+		SimAwaiter onSimThread(Connection&, RequestSchedule);
+		size_t cancelSimWork(const Session&);
 
 		DataCache<std::string, XPLMDataRef> refCache = { [](const auto& key) -> XPLMDataRef { return XPLMFindDataRef(key.c_str()); } };
 		DataCache<std::string, XPLMCommandRef> cmdCache = { [](const auto& key) -> XPLMCommandRef { return XPLMFindCommand(key.c_str()); } };
 		
-		std::string processRequest(const std::string&);
-		
-		std::string handleDatarefRequest(const std::vector<std::string>&);
-		std::string getDataref(const std::vector<std::string>&);
-		std::string setDataref(const std::vector<std::string>&);
+		// the response is allocated from the connection's arena, and only valid until the next request.
+		// timelines, if given, gets the timeline of each request that finished in time.
+		std::pmr::string processRequest(Connection&, std::string_view, Timelines* timelines = nullptr);
+		std::string_view handleOptionRequest(Connection&, const Tokens&);
+		std::string_view handleStatsRequest(Connection&, const Tokens&);
+		void appendIntrospection(std::pmr::string&);
+		std::string_view handleLogsRequest(Connection&, const Tokens&);
+		std::string_view handleTraceRequest(const Tokens&);
+		std::string_view handleCaptureRequest(const Tokens&);
+
+		// handlers take their arguments by value, they can outlive the request that started them, and the
+		// views they are given stay valid because the arena is not reset until every handler has finished.
+		// replies are either literals or stored in the arena.
+		Task<std::string_view> handleRequest(Connection&, Tokens, RequestSchedule);
+
+		Task<std::string_view> handleDatarefRequest(Connection&, Tokens, RequestSchedule);
+		Task<std::string_view> getDataref(Connection&, std::string_view, RequestSchedule);
+		Task<std::string_view> setDataref(Connection&, std::string_view, std::string_view, std::string_view, RequestSchedule);
+
+		enum class CommandAction {
+			Begin,
+			End,
+			Once,
+			Hold
+		};
 
-		std::string handleCommandRequest(const std::vector<std::string>&);
+		Task<std::string_view> handleCommandRequest(Connection&, Tokens, RequestSchedule);
 	};
 }
@@ -0,0 +1,88 @@
+#pragma once
+
+namespace xp11_va {
+	/*
+	 * A bounded queue of fixed-size entries that any number of threads may push
+	 * to and pop from without locking. Each slot carries a sequence number
+	 * that says whether it is ready to be written or to be read, so a push
+	 * only has to claim a position and a pop only has to claim a filled slot.
+	 * Entries are built and copied out in place, nothing here allocates.
+	 *
+	 * A push onto a full ring fails instead of waiting, it is up to the caller
+	 * to drop the entry and count it.
+	 */
+	template <typename T, size_t Capacity>
+	class LogRing {
+		static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+	public:
+		LogRing() {
+			for (size_t i = 0; i < Capacity; i++) {
+				slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+		LogRing(const LogRing&) = delete;
+		LogRing& operator=(const LogRing&) = delete;
+
+		// fill is called with the claimed slot's entry, returns false if the ring was full
+		template <typename Fill>
+		bool TryPush(Fill&& fill) {
+			size_t position = pushPosition.load(std::memory_order_relaxed);
+			while (true) {
+				auto& slot = slots[position & (Capacity - 1)];
+				const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+				const auto lag = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+
+				if (lag == 0) {
+					if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						fill(slot.entry);
+						slot.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (lag < 0) {
+					// the slot a full lap behind has not been read yet
+					return false;
+				}
+				else {
+					position = pushPosition.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool TryPop(T& out) {
+			size_t position = popPosition.load(std::memory_order_relaxed);
+			while (true) {
+				auto& slot = slots[position & (Capacity - 1)];
+				const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+				const auto lag = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+
+				if (lag == 0) {
+					if (popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						out = slot.entry;
+						slot.sequence.store(position + Capacity, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (lag < 0) {
+					// nothing has been written here since the last lap
+					return false;
+				}
+				else {
+					position = popPosition.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+	private:
+		struct Slot {
+			std::atomic<size_t> sequence;
+			T entry;
+		};
+
+		std::array<Slot, Capacity> slots;
+		// kept on separate cache lines, producers and consumers otherwise keep stealing it from each other
+		alignas(64) std::atomic<size_t> pushPosition{ 0 };
+		alignas(64) std::atomic<size_t> popPosition{ 0 };
+	};
+}
@@ -1,20 +1,263 @@
 #include "pch.h"
 #include "Logger.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
 Logger* Logger::instance = nullptr;
 
+namespace {
+	// how long the flusher sleeps once it has emptied the ring
+	constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(50);
+	// until a client changes it with logs:level
+	constexpr auto DEFAULT_LEVEL = Logger::Level::Warn;
+
+	const char* levelTag(Logger::Level level) {
+		switch (level) {
+		case Logger::Level::Trace: return "TRACE   ";
+		case Logger::Level::Info: return "INFO    ";
+		case Logger::Level::Warn: return "WARN    ";
+		case Logger::Level::Error: return "ERROR   ";
+		case Logger::Level::Critical: return "CRITICAL";
+		case Logger::Level::Fatal: return "FATAL   ";
+		}
+		return "        ";
+	}
+}
+
 Logger& Logger::get() {
 	if (Logger::instance == nullptr) {
-		Logger::Level minLevel =
-#ifdef _DEBUG
-			Logger::Level::Trace;
-#else
-			Logger::Level::Warn;
-#endif
-
-		Logger::instance = new Logger(minLevel);
-		Logger::instance->ForceLog(Logger::instance->minLevel, "Logger initialized at this minlevel");
+		Logger::instance = new Logger(DEFAULT_LEVEL);
+		Logger::instance->ForceLog(DEFAULT_LEVEL, "Logger initialized at level {}", LevelName(DEFAULT_LEVEL));
 	}
 
 	return *Logger::instance;
 }
+
+std::optional<Logger::Level> Logger::ParseLevel(std::string_view name) {
+	for (uint8_t l = static_cast<uint8_t>(Level::Trace); l <= static_cast<uint8_t>(Level::Fatal); l++) {
+		if (name == LevelName(static_cast<Level>(l))) {
+			return static_cast<Level>(l);
+		}
+	}
+	return std::nullopt;
+}
+
+const char* Logger::LevelName(Level level) {
+	switch (level) {
+	case Level::Trace: return "trace";
+	case Level::Info: return "info";
+	case Level::Warn: return "warn";
+	case Level::Error: return "error";
+	case Level::Critical: return "critical";
+	case Level::Fatal: return "fatal";
+	}
+	return "unknown";
+}
+
+void Logger::SetMinLevel(Level l) {
+	std::lock_guard<std::mutex> lock(subscribersMutex);
+	sinkLevel = l;
+	updateMinLevel();
+}
+
+void Logger::Start(const std::string& path) {
+	if (flusher) { return; }
+
+	file.open(path, std::ios::out | std::ios::trunc);
+	if (!file) {
+		Error("Couldn't open log file {}, logging to X-Plane's log only", path);
+	}
+
+	stopping = false;
+	flusher = std::make_unique<std::thread>([this]() {
+		xp11_va::AllocTracker::Scope scope(xp11_va::AllocRegion::Logger);
+		while (!stopping.load()) {
+			flush();
+			std::this_thread::sleep_for(FLUSH_INTERVAL);
+		}
+	});
+}
+
+void Logger::Stop() noexcept {
+	if (flusher) {
+		stopping = true;
+		if (flusher->joinable()) {
+			flusher->join();
+		}
+		flusher.reset();
+	}
+
+	// the flusher is gone, so this thread can take over its side of both rings
+	flush();
+	if (file.is_open()) {
+		file.close();
+	}
+	while (DrainToSim(SIM_RECORDS) > 0) {}
+}
+
+std::shared_ptr<Logger::Subscription> Logger::Subscribe(Level level) {
+	auto subscription = std::make_shared<Subscription>(level);
+
+	std::lock_guard<std::mutex> lock(subscribersMutex);
+	subscribers.push_back(subscription);
+	updateMinLevel();
+	return subscription;
+}
+
+void Logger::Unsubscribe(const std::shared_ptr<Subscription>& subscription) {
+	std::lock_guard<std::mutex> lock(subscribersMutex);
+	subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), subscription), subscribers.end());
+	updateMinLevel();
+}
+
+bool Logger::Subscription::Next(Record& out, std::chrono::milliseconds timeout) {
+	if (records.TryPop(out)) { return true; }
+
+	std::unique_lock<std::mutex> lock(mutex);
+	bool popped = false;
+	cv.wait_for(lock, timeout, [&]() {
+		popped = records.TryPop(out);
+		return popped || dropped.load();
+	});
+	return popped;
+}
+
+size_t Logger::DrainToSim(size_t max) noexcept {
+	xp11_va::AllocTracker::Scope scope(xp11_va::AllocRegion::Logger);
+
+	Record record;
+	char line[LINE_BYTES];
+	size_t drained = 0;
+	while (drained < max && simRing.TryPop(record)) {
+		Format(record, line, sizeof(line));
+		XPLMDebugString(line);
+		drained++;
+	}
+	return drained;
+}
+
+size_t Logger::Format(const Record& record, char* line, size_t size) noexcept {
+	const int length = std::snprintf(line, size, "[XP11_VA_Link :: %llu :: %s]: %.*s%s\n",
+		static_cast<unsigned long long>(record.thread), levelTag(record.level),
+		static_cast<int>(record.length), record.text, record.truncated ? "..." : "");
+	return static_cast<size_t>(std::clamp(length, 0, static_cast<int>(size - 1)));
+}
+
+/* PRIVATE API */
+
+size_t Logger::RecordWriter::AppendUntilField(std::string_view format) noexcept {
+	size_t copied = 0;
+	for (size_t i = 0; i < format.size(); i++) {
+		const char c = format[i];
+		if (c != '{' && c != '}') { continue; }
+
+		Append(format.substr(copied, i - copied));
+		if (c == '{' && i + 1 < format.size() && format[i + 1] == '}') {
+			return i + 2;
+		}
+		// a doubled brace is one literal brace, a lone one is kept as it is
+		Append(format.substr(i, 1));
+		if (i + 1 < format.size() && format[i + 1] == c) { i++; }
+		copied = i + 1;
+	}
+
+	Append(format.substr(copied));
+	return std::string_view::npos;
+}
+
+uint64_t Logger::threadNumber() {
+	// worked out once per thread, as it allocates
+	thread_local const uint64_t number = []() -> uint64_t {
+		try {
+			std::ostringstream ss;
+			ss << std::this_thread::get_id();
+			return std::stoull(ss.str());
+		}
+		catch (...) {
+			return 0;
+		}
+	}();
+	return number;
+}
+
+void Logger::flush() noexcept {
+	// held throughout, so subscribers and levels stay put while records are handed out
+	std::lock_guard<std::mutex> lock(subscribersMutex);
+
+	Record record;
+	bool wrote = false;
+	while (ring.TryPop(record)) {
+		write(record);
+		wrote = true;
+	}
+	reportDropped();
+
+	if (wrote) {
+		for (const auto& subscription : subscribers) {
+			// taking the lock, however briefly, means a subscriber can't miss this between checking and waiting
+			{ std::lock_guard<std::mutex> waiting(subscription->mutex); }
+			subscription->cv.notify_all();
+		}
+	}
+
+	if (wrote && file.is_open()) {
+		file.flush();
+	}
+}
+
+void Logger::write(const Record& record) noexcept {
+	publish(record);
+
+	// a subscriber at a lower level is why this was logged, the files only want the level set for them
+	if (!record.forced && record.level < sinkLevel.load()) { return; }
+
+	if (file.is_open()) {
+		char line[LINE_BYTES];
+		const size_t length = Format(record, line, sizeof(line));
+		file.write(line, length);
+	}
+
+	const bool passed_on = simRing.TryPush([&](Record& waiting) { waiting = record; });
+	if (!passed_on) {
+		simDropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void Logger::publish(const Record& record) noexcept {
+	for (const auto& subscription : subscribers) {
+		if (record.level < subscription->level || subscription->dropped.load()) { continue; }
+
+		if (!subscription->records.TryPush([&](Record& waiting) { waiting = record; })) {
+			// too slow to keep up, waiting for it would hold up everyone else
+			subscription->dropped = true;
+		}
+	}
+}
+
+void Logger::reportDropped() noexcept {
+	const uint64_t lost = dropped.load(std::memory_order_relaxed);
+	const uint64_t sim_lost = simDropped.load(std::memory_order_relaxed);
+	if (lost == reportedDropped && sim_lost == reportedSimDropped) { return; }
+
+	Record record{ Level::Warn, true, false, 0, threadNumber(), {} };
+	const int length = std::snprintf(record.text, sizeof(record.text),
+		"Log ring full, dropped %llu records (%llu in total), and %llu more only from X-Plane's log",
+		static_cast<unsigned long long>(lost - reportedDropped), static_cast<unsigned long long>(lost),
+		static_cast<unsigned long long>(sim_lost - reportedSimDropped));
+	record.length = static_cast<uint16_t>(std::clamp(length, 0, static_cast<int>(sizeof(record.text) - 1)));
+
+	write(record);
+	reportedDropped = lost;
+	// while the sim isn't draining, the report itself won't fit either, and that is not worth another report
+	reportedSimDropped = simDropped.load(std::memory_order_relaxed);
+}
+
+void Logger::updateMinLevel() noexcept {
+	Level lowest = sinkLevel.load();
+	for (const auto& subscription : subscribers) {
+		lowest = std::min(lowest, subscription->level);
+	}
+	minLevel = lowest;
+}
@@ -1,12 +1,51 @@
 #ifndef __LOGGER_H__
 #define __LOGGER_H__
 
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <type_traits>
 #include <vector>
 #include <XPLM/XPLMUtilities.h>
 
+#include "AllocTracker.h"
+#include "LogRing.h"
+
+// log calls below this level are compiled out, whatever the level is set to at runtime
+#ifndef XP11VA_LOG_MIN_LEVEL
+#ifdef _DEBUG
+#define XP11VA_LOG_MIN_LEVEL 0
+#else
+#define XP11VA_LOG_MIN_LEVEL 1
+#endif
+#endif
+
 using LogCallback = std::function<void(const std::string&)>;
 
+/*
+ * Logging never waits on anything. A log call copies the message into a
+ * fixed-size record in a lock-free ring and returns; if the ring is full the
+ * record is dropped and counted instead. A background thread writes the
+ * records out to the log file and passes them on to the sim thread, which
+ * writes them to X-Plane's log from the flight loop, as XPLM may only be
+ * called from there.
+ *
+ * Messages are formatted straight into the record, and only once the level
+ * has been checked, so a call whose level is off costs a comparison. Given
+ * arguments, each {} in the message is replaced by the next one ({{ and }}
+ * for literal braces); without any, the message is used as it is. Arguments
+ * can be strings, numbers, bools, chars and enums.
+ *
+ * Clients can subscribe to the log. Each subscription has a ring of its own,
+ * which the background thread copies records at or above the subscription's
+ * level into. A subscriber that lets its ring fill up is dropped, it never
+ * holds up the thread or anyone logging.
+ */
 class Logger {
 public:
 	enum class Level : uint8_t {
@@ -17,65 +56,228 @@ public:
 		Critical,
 		Fatal
 	};
-	
+
+	// one log call as it waits to be written, longer messages are cut short
+	struct Record {
+		static constexpr size_t MAX_TEXT = 480;
+
+		Level level;
+		// logged with ForceLog, so written out whatever the level
+		bool forced;
+		bool truncated;
+		uint16_t length;
+		uint64_t thread;
+		char text[MAX_TEXT];
+	};
+
+	static constexpr Level COMPILED_MIN_LEVEL = static_cast<Level>(XP11VA_LOG_MIN_LEVEL);
+	// room for the prefix and the truncation mark as well as the text
+	static constexpr size_t LINE_BYTES = Record::MAX_TEXT + 64;
+	static constexpr size_t SUBSCRIBER_RECORDS = 256;
+
+	// a client following the log, see Subscribe
+	class Subscription {
+	public:
+		explicit Subscription(Level l) : level(l) {}
+
+		const Level level;
+
+		// waits up to timeout for the next record, returns false if none came
+		bool Next(Record& out, std::chrono::milliseconds timeout);
+		// the next record if one is waiting, without locking, for a subscriber that drains the ring now and then
+		bool TryNext(Record& out) { return records.TryPop(out); }
+		// set once the subscriber fell a whole ring behind, records stop coming after that
+		bool IsDropped() const { return dropped.load(); }
+
+	private:
+		friend class Logger;
+
+		xp11_va::LogRing<Record, SUBSCRIBER_RECORDS> records;
+		std::atomic_bool dropped{ false };
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
+
 	static Logger& get();
+	static std::optional<Level> ParseLevel(std::string_view);
+	static const char* LevelName(Level);
 
-	void SetMinLevel(Level l) { this->minLevel = l; }
+	// the level written to the log files, subscribers may still see lower levels while they are attached
+	void SetMinLevel(Level l);
+	Level MinLevel() const { return sinkLevel.load(); }
+	// lets callers skip work, beyond formatting, that is only needed for a message that would be dropped
+	bool Enabled(Level l) const { return l >= COMPILED_MIN_LEVEL && l >= minLevel.load(std::memory_order_relaxed); }
 
-	void Trace(const std::string& msg)    noexcept { log(Level::Trace,    msg); }
-	void Info(const std::string& msg)     noexcept { log(Level::Info,     msg); }
-	void Warn(const std::string& msg)     noexcept { log(Level::Warn,     msg); }
-	void Error(const std::string& msg)    noexcept { log(Level::Error,    msg); }
-	void Critical(const std::string& msg) noexcept { log(Level::Critical, msg); }
-	void Fatal(const std::string& msg)    noexcept { log(Level::Fatal,    msg); }
+	template <typename... Args> void Trace(std::string_view msg, const Args&... args)    noexcept { log<Level::Trace>(msg, args...); }
+	template <typename... Args> void Info(std::string_view msg, const Args&... args)     noexcept { log<Level::Info>(msg, args...); }
+	template <typename... Args> void Warn(std::string_view msg, const Args&... args)     noexcept { log<Level::Warn>(msg, args...); }
+	template <typename... Args> void Error(std::string_view msg, const Args&... args)    noexcept { log<Level::Error>(msg, args...); }
+	template <typename... Args> void Critical(std::string_view msg, const Args&... args) noexcept { log<Level::Critical>(msg, args...); }
+	template <typename... Args> void Fatal(std::string_view msg, const Args&... args)    noexcept { log<Level::Fatal>(msg, args...); }
 
-	void ForceLog(Level level, const std::string& msg) noexcept {
-		ignoreMinLevel = true;
-		log(level, msg);
-		ignoreMinLevel = false;
-	}
+	// logs whatever the minimum level is, even below the compiled minimum
+	template <typename... Args>
+	void ForceLog(Level level, std::string_view msg, const Args&... args) noexcept { push(level, true, msg, args...); }
+
+	// starts writing records to the file from a background thread, until then they wait in the ring
+	void Start(const std::string& path);
+	// writes out everything logged so far and closes the file, call on the sim thread
+	void Stop() noexcept;
+	// writes up to max waiting records to X-Plane's log, call on the sim thread only
+	size_t DrainToSim(size_t max = 64) noexcept;
+
+	// records lost because the ring was full when they were logged
+	uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+	// starts copying records at or above level to a new subscription, from the next flush on
+	std::shared_ptr<Subscription> Subscribe(Level level);
+	void Unsubscribe(const std::shared_ptr<Subscription>&);
+
+	// formats the record as one line of the log, including the newline, and returns its length
+	static size_t Format(const Record&, char*, size_t) noexcept;
 
 private:
 	static Logger* instance;
-	Logger(const Level l) : minLevel(l) {}
+	Logger(const Level l) : minLevel(l), sinkLevel(l) {}
+
+	static constexpr size_t RING_RECORDS = 1024;
+	static constexpr size_t SIM_RECORDS = 256;
 
 private:
-	Level minLevel;
-	bool ignoreMinLevel = false;
-
-	void log(const Level l, const std::string& message) noexcept {
-		if (!ignoreMinLevel && l < minLevel) { return; }
-
-		std::stringstream ss;
-		ss << "[XP11_VA_Link :: ";
-		ss << std::this_thread::get_id();
-		ss << " :: ";
-
-		switch (l) {
-		case Level::Trace:
-			ss << "TRACE   ]";
-			break;
-		case Level::Info:
-			ss << "INFO    ]";
-			break;
-		case Level::Warn:
-			ss << "WARN    ]";
-			break;
-		case Level::Error:
-			ss << "ERROR   ]";
-			break;
-		case Level::Critical:
-			ss << "CRITICAL]";
-			break;
-		case Level::Fatal:
-			ss << "FATAL   ]";
-			break;
+	// the lowest level anyone wants, log calls below it return straight away
+	std::atomic<Level> minLevel;
+	// the lowest level written to the files
+	std::atomic<Level> sinkLevel;
+	xp11_va::LogRing<Record, RING_RECORDS> ring;
+	// records already in the file, waiting for the flight loop
+	xp11_va::LogRing<Record, SIM_RECORDS> simRing;
+	std::atomic<uint64_t> dropped{ 0 };
+	// records that made it to the file but not to X-Plane's log
+	std::atomic<uint64_t> simDropped{ 0 };
+
+	// only touched by the flusher, or by Stop once the flusher has finished
+	std::ofstream file;
+	uint64_t reportedDropped = 0;
+	uint64_t reportedSimDropped = 0;
+
+	std::unique_ptr<std::thread> flusher;
+	std::atomic_bool stopping{ false };
+
+	// held by the flusher while it copies records out, and to change the list or the levels
+	std::mutex subscribersMutex;
+	std::vector<std::shared_ptr<Subscription>> subscribers;
+
+	// fills a record's text, cutting it short once it is full
+	class RecordWriter {
+	public:
+		explicit RecordWriter(Record& r) : record(r) {
+			record.length = 0;
+			record.truncated = false;
+		}
+
+		void Append(std::string_view text) noexcept {
+			const size_t room = Record::MAX_TEXT - record.length;
+			if (text.size() > room) { record.truncated = true; }
+
+			const size_t count = std::min(room, text.size());
+			std::memcpy(record.text + record.length, text.data(), count);
+			record.length = static_cast<uint16_t>(record.length + count);
 		}
 
-		ss << ": " << message << std::endl;
+		// appends the format up to its next {}, and returns what follows it, or npos if there are none left
+		size_t AppendUntilField(std::string_view format) noexcept;
+
+	private:
+		Record& record;
+	};
 
-		XPLMDebugString(ss.str().c_str());
+	template <Level L, typename... Args>
+	void log(std::string_view message, const Args&... args) noexcept {
+		if constexpr (L >= COMPILED_MIN_LEVEL) {
+			if (L < minLevel.load(std::memory_order_relaxed)) { return; }
+			push(L, false, message, args...);
+		}
 	}
+
+	template <typename... Args>
+	void push(Level level, bool forced, std::string_view message, const Args&... args) noexcept {
+		xp11_va::AllocTracker::Scope scope(xp11_va::AllocRegion::Logger);
+
+		const uint64_t thread = threadNumber();
+		const bool pushed = ring.TryPush([&](Record& record) {
+			record.level = level;
+			record.forced = forced;
+			record.thread = thread;
+			RecordWriter out(record);
+			if constexpr (sizeof...(Args) == 0) {
+				out.Append(message);
+			}
+			else {
+				formatInto(out, message, args...);
+			}
+		});
+
+		if (!pushed) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	static void formatInto(RecordWriter& out, std::string_view format) noexcept {
+		// no arguments left, so any further {} are copied as they are
+		while (true) {
+			const size_t next = out.AppendUntilField(format);
+			if (next == std::string_view::npos) { return; }
+			out.Append("{}");
+			format.remove_prefix(next);
+		}
+	}
+
+	template <typename First, typename... Rest>
+	static void formatInto(RecordWriter& out, std::string_view format, const First& first, const Rest&... rest) noexcept {
+		const size_t next = out.AppendUntilField(format);
+		if (next == std::string_view::npos) { return; }
+
+		appendArgument(out, first);
+		formatInto(out, format.substr(next), rest...);
+	}
+
+	template <typename T>
+	static void appendArgument(RecordWriter& out, const T& value) noexcept {
+		if constexpr (std::is_same_v<T, bool>) {
+			out.Append(value ? "true" : "false");
+		}
+		else if constexpr (std::is_same_v<T, char>) {
+			out.Append(std::string_view(&value, 1));
+		}
+		else if constexpr (std::is_enum_v<T>) {
+			appendArgument(out, static_cast<std::underlying_type_t<T>>(value));
+		}
+		else if constexpr (std::is_floating_point_v<T>) {
+			char digits[32];
+			const auto result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+			out.Append(std::string_view(digits, result.ptr - digits));
+		}
+		else if constexpr (std::is_arithmetic_v<T>) {
+			char digits[24];
+			const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+			out.Append(std::string_view(digits, result.ptr - digits));
+		}
+		else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+			out.Append(std::string_view(value));
+		}
+		else {
+			static_assert(sizeof(T) == 0, "Logger can't format this type");
+		}
+	}
+
+	// the number the calling thread's std::thread::id prints as
+	static uint64_t threadNumber();
+	void flush() noexcept;
+	void write(const Record&) noexcept;
+	void publish(const Record&) noexcept;
+	void reportDropped() noexcept;
+	// call with subscribersMutex held
+	void updateMinLevel() noexcept;
 };
 
-#endif
\ No newline at end of file
+#endif
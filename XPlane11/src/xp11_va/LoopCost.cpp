@@ -0,0 +1,38 @@
+#include "pch.h"
+#include "LoopCost.h"
+
+#include <algorithm>
+
+namespace xp11_va {
+	/* PUBLIC API */
+
+	void LoopCost::Record(std::chrono::nanoseconds spent, size_t tasks) {
+		auto& sample = samples[next];
+		totalNs -= sample.ns;
+		totalTasks -= sample.tasks;
+
+		sample.ns = static_cast<uint64_t>(std::max<std::chrono::nanoseconds::rep>(spent.count(), 0));
+		sample.tasks = static_cast<uint32_t>(tasks);
+		totalNs += sample.ns;
+		totalTasks += sample.tasks;
+
+		next = (next + 1) % WINDOW;
+		filled = std::min(filled + 1, WINDOW);
+	}
+
+	float LoopCost::AverageUs() const {
+		return filled == 0 ? 0.0f : totalNs / 1000.0f / filled;
+	}
+
+	float LoopCost::MaxUs() const {
+		uint64_t max = 0;
+		for (size_t i = 0; i < filled; i++) {
+			max = std::max(max, samples[i].ns);
+		}
+		return max / 1000.0f;
+	}
+
+	float LoopCost::TasksPerLoop() const {
+		return filled == 0 ? 0.0f : static_cast<float>(totalTasks) / filled;
+	}
+}
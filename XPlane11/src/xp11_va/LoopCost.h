@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+
+namespace xp11_va {
+	/*
+	 * What the flight loops cost X-Plane: the wall time spent in each call and
+	 * the tasks it ran, kept for the last WINDOW calls so averages and maxima
+	 * follow what the link is doing now rather than since the sim started.
+	 *
+	 * Only the sim thread may use it, which is also the thread X-Plane reads
+	 * datarefs on, so nothing here is atomic.
+	 */
+	class LoopCost {
+	public:
+		static constexpr size_t WINDOW = 32;
+
+		void Record(std::chrono::nanoseconds spent, size_t tasks);
+
+		float AverageUs() const;
+		float MaxUs() const;
+		float TasksPerLoop() const;
+
+	private:
+		struct Sample {
+			uint64_t ns;
+			uint32_t tasks;
+		};
+
+		std::array<Sample, WINDOW> samples{};
+		size_t next = 0;
+		size_t filled = 0;
+		// of the samples in the window, kept up to date as they are replaced
+		uint64_t totalNs = 0;
+		uint64_t totalTasks = 0;
+	};
+}
@@ -11,8 +11,11 @@ namespace xp11_va {
 
 		virtual void Connect() = 0;
 		virtual bool IsConnected() = 0;
-		virtual std::optional<std::string> ReadPipe() = 0;
-		virtual bool WritePipe(std::string) = 0;
+		// reads the next message into the string, reusing its storage, returns false if the read was aborted
+		virtual bool ReadPipe(std::string&) = 0;
+		virtual bool WritePipe(std::string_view) = 0;
+		// false once the client has closed its end, found without reading or writing
+		virtual bool IsPeerConnected() = 0;
 		virtual void Abort(std::thread::native_handle_type) = 0;
 	};
 }
\ No newline at end of file
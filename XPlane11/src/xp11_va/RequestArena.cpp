@@ -0,0 +1,66 @@
+#include "pch.h"
+#include "RequestArena.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace xp11_va {
+	/* PUBLIC API */
+
+	RequestArena::RequestArena(size_t firstBlockBytes) : current(0), used(0), retained(0) {
+		blocks.reserve(8);
+		blocks.push_back({ static_cast<std::byte*>(::operator new(firstBlockBytes)), firstBlockBytes });
+	}
+
+	RequestArena::~RequestArena() {
+		for (auto& block : blocks) {
+			::operator delete(block.data);
+		}
+	}
+
+	bool RequestArena::Reset() noexcept {
+		if (retained > 0) { return false; }
+
+		current = 0;
+		used = 0;
+		return true;
+	}
+
+	std::string_view RequestArena::Store(std::string_view text) {
+		auto* copy = static_cast<char*>(allocate(text.size() + 1, 1));
+		std::memcpy(copy, text.data(), text.size());
+		// some of the parsing done on stored text still relies on it being terminated
+		copy[text.size()] = 0;
+		return { copy, text.size() };
+	}
+
+	size_t RequestArena::Capacity() const {
+		size_t capacity = 0;
+		for (const auto& block : blocks) {
+			capacity += block.size;
+		}
+		return capacity;
+	}
+
+	/* PRIVATE API */
+
+	void* RequestArena::do_allocate(size_t bytes, size_t alignment) {
+		while (true) {
+			auto& block = blocks[current];
+			const auto base = reinterpret_cast<uintptr_t>(block.data);
+			const auto start = (base + used + alignment - 1) & ~(uintptr_t(alignment) - 1);
+			if (start + bytes <= base + block.size) {
+				used = start + bytes - base;
+				return reinterpret_cast<void*>(start);
+			}
+
+			// move on to the next block, which a reset arena already has, otherwise grow
+			if (current + 1 == blocks.size()) {
+				const size_t size = std::max(block.size * 2, bytes + alignment);
+				blocks.push_back({ static_cast<std::byte*>(::operator new(size)), size });
+			}
+			current++;
+			used = 0;
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory_resource>
+#include <string_view>
+
+namespace xp11_va {
+	/*
+	 * Backs everything handling one pipe message needs only until its response
+	 * is written: the copy of the request, its tokens, the replies and the
+	 * joined response. Memory is handed out by bumping a pointer and is only
+	 * taken back all at once by Reset, which keeps the blocks for the next
+	 * message, so once a connection has handled its largest message the
+	 * request path makes no heap allocations.
+	 *
+	 * Only the connection's I/O thread may allocate from it.
+	 */
+	class RequestArena : public std::pmr::memory_resource {
+	public:
+		explicit RequestArena(size_t firstBlockBytes = 16 * 1024);
+		RequestArena(const RequestArena&) = delete;
+		RequestArena& operator=(const RequestArena&) = delete;
+		~RequestArena();
+
+		// a handler still running from an earlier message keeps that message's memory from being reused
+		void Retain() noexcept { retained++; }
+		void Release() noexcept { retained--; }
+
+		// takes back everything allocated so far unless something is retained, returns whether it did
+		bool Reset() noexcept;
+
+		// copies the text into the arena, the copy is valid until the next reset
+		std::string_view Store(std::string_view);
+
+		size_t Capacity() const;
+
+	private:
+		struct Block {
+			std::byte* data;
+			size_t size;
+		};
+
+		// blocks are never freed before the arena is, so a reset arena can be refilled without allocating
+		std::vector<Block> blocks;
+		size_t current;
+		size_t used;
+		size_t retained;
+
+		void* do_allocate(size_t, size_t) override;
+		void do_deallocate(void*, size_t, size_t) noexcept override {}
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+	};
+}
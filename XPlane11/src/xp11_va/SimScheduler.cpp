@@ -0,0 +1,211 @@
+#include "pch.h"
+#include "SimScheduler.h"
+
+#include <algorithm>
+
+namespace xp11_va {
+	/* PUBLIC API */
+
+	SimScheduler::SimScheduler(SchedulerOptions opts, const char* lockName) : options(opts), mutex(lockName) {
+		incoming.reserve(64);
+		arriving.reserve(64);
+	}
+
+	void SimScheduler::Queue(Task task) {
+		std::lock_guard<Mutex> lock(mutex);
+		task.queuedAt = Clock::now();
+		laneStats[static_cast<size_t>(task.priority)].queued.fetch_add(1, std::memory_order_relaxed);
+		incoming.push_back(std::move(task));
+	}
+
+	size_t SimScheduler::Cancel(const Session& session) {
+		std::lock_guard<Mutex> lock(mutex);
+
+		size_t cancelled = 0;
+		for (auto it = incoming.begin(); it != incoming.end();) {
+			if (it->session.get() == &session) {
+				if (it->cancel) { it->cancel("{cancelled}"); }
+				laneStats[static_cast<size_t>(it->priority)].queued.fetch_sub(1, std::memory_order_relaxed);
+				it = incoming.erase(it);
+				cancelled++;
+			}
+			else {
+				++it;
+			}
+		}
+
+		for (size_t l = 0; l < PRIORITY_COUNT; l++) {
+			auto& lane = lanes[l];
+			const auto entry = lane.clients.find(session.owner());
+			if (entry == lane.clients.end() || entry->second.session.get() != &session) { continue; }
+
+			auto& client = entry->second;
+			for (size_t i = client.head; i < client.tasks.size(); i++) {
+				if (client.tasks[i].cancel) { client.tasks[i].cancel("{cancelled}"); }
+			}
+			cancelled += client.tasks.size() - client.head;
+			lane.queued -= client.tasks.size() - client.head;
+			laneStats[l].queued.fetch_sub(client.tasks.size() - client.head, std::memory_order_relaxed);
+
+			const auto active = std::find(lane.active.begin(), lane.active.end(), &client);
+			if (active != lane.active.end()) {
+				const auto index = static_cast<size_t>(active - lane.active.begin());
+				lane.active.erase(active);
+				if (index < lane.cursor) { lane.cursor--; }
+			}
+			lane.clients.erase(entry);
+		}
+
+		return cancelled;
+	}
+
+	SimScheduler::FrameResult SimScheduler::RunFrame() {
+		std::lock_guard<Mutex> lock(mutex);
+		FrameResult result;
+
+		// anything queued while this frame runs, including tasks that need another frame, lands in the emptied list
+		arriving.swap(incoming);
+		for (auto& task : arriving) {
+			admit(std::move(task));
+		}
+		arriving.clear();
+
+		const auto frame_start = Clock::now();
+
+		// higher lanes first, so interactive work never waits behind bulk work
+		for (size_t l = 0; l < PRIORITY_COUNT; l++) {
+			auto& lane = lanes[l];
+			auto& stats = laneStats[l];
+			if (lane.queued == 0) { continue; }
+
+			// interactive work is only limited by client quotas, the rest also by the frame budget
+			const bool budgeted = l != static_cast<size_t>(Priority::Interactive);
+			size_t lane_ran = 0;
+			bool quotas_lifted = false;
+			const auto out_of_budget = [&]() {
+				return budgeted && lane_ran >= options.minTasksPerLane && Clock::now() - frame_start > options.frameBudget;
+			};
+			// work that belongs to no client, such as hold releases, has nobody to make way for
+			const auto at_quota = [&](const ClientQueue& client) {
+				return !quotas_lifted && client.session && options.clientQuota > 0 && client.ranThisFrame >= options.clientQuota;
+			};
+
+			for (auto* client : lane.active) {
+				client->ranThisFrame = 0;
+			}
+
+			// a client still paying off an expensive task runs nothing this round, but is not idle, the
+			// rounds go on until it has earned another turn or every client left has used its quota
+			size_t idle_visits = 0;
+			while (!lane.active.empty() && !out_of_budget()) {
+				if (idle_visits >= lane.active.size()) {
+					// quotas only hold a client back for the others' sake
+					quotas_lifted = true;
+					idle_visits = 0;
+				}
+
+				if (lane.cursor >= lane.active.size()) { lane.cursor = 0; }
+				auto& client = *lane.active[lane.cursor];
+
+				if (at_quota(client)) {
+					lane.cursor++;
+					idle_visits++;
+					continue;
+				}
+
+				const uint32_t weight = client.session ? client.session->Weight() : 1;
+				client.deficitNs += weight * std::chrono::duration_cast<std::chrono::nanoseconds>(options.quantum).count();
+
+				size_t ran = 0;
+				bool interrupted = false;
+				while (!client.Empty() && client.deficitNs > 0 && !at_quota(client)) {
+					if (out_of_budget()) {
+						interrupted = true;
+						break;
+					}
+
+					Task task = std::move(client.tasks[client.head++]);
+					lane.queued--;
+					stats.queued.fetch_sub(1, std::memory_order_relaxed);
+
+					client.deficitNs -= std::chrono::duration_cast<std::chrono::nanoseconds>(runTask(task, stats, result)).count();
+					client.ranThisFrame++;
+					lane_ran++;
+					ran++;
+				}
+				if (ran > 0) { idle_visits = 0; }
+
+				if (client.Empty()) {
+					// an empty queue gives up what is left of its deficit, as in any deficit round robin
+					client.tasks.clear();
+					client.head = 0;
+					client.deficitNs = 0;
+					lane.active.erase(lane.active.begin() + lane.cursor);
+				}
+				else if (!interrupted) {
+					// otherwise the budget ran out part way through this client's turn, and it carries on first next frame
+					lane.cursor++;
+				}
+			}
+
+			result.deferred += lane.queued;
+			stats.deferred.fetch_add(lane.queued, std::memory_order_relaxed);
+		}
+
+		return result;
+	}
+
+	/* PRIVATE API */
+
+	void SimScheduler::admit(Task task) {
+		auto& lane = lanes[static_cast<size_t>(task.priority)];
+		const uint64_t owner = task.session ? task.session->owner() : 0;
+
+		auto& client = lane.clients[owner];
+		if (client.Empty()) {
+			client.session = task.session;
+			lane.active.push_back(&client);
+		}
+		client.tasks.push_back(std::move(task));
+		lane.queued++;
+	}
+
+	SimScheduler::Clock::duration SimScheduler::runTask(Task& task, LaneStats& stats, FrameResult& result) {
+		const auto started = Clock::now();
+
+		// nobody is waiting for this any more, don't spend frame time on it
+		if (task.session && !task.session->IsAlive()) {
+			if (task.cancel) { task.cancel("{cancelled}"); }
+			result.cancelled++;
+			return Clock::duration::zero();
+		}
+
+		// the requester has already given up and replied {timeout}
+		if (task.deadline < started) {
+			if (task.cancel) { task.cancel("{timeout}"); }
+			result.expired++;
+			return Clock::duration::zero();
+		}
+
+		const auto wait_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(started - task.queuedAt).count());
+		stats.waitNs.fetch_add(wait_ns, std::memory_order_relaxed);
+		stats.wait.Record(std::chrono::nanoseconds(wait_ns));
+		// only the sim thread writes these, so there is no race between the load and the store
+		if (wait_ns > stats.maxWaitNs.load(std::memory_order_relaxed)) {
+			stats.maxWaitNs.store(wait_ns, std::memory_order_relaxed);
+		}
+
+		const bool finished = task.run();
+		const auto elapsed = Clock::now() - started;
+		stats.tasks.fetch_add(1, std::memory_order_relaxed);
+		stats.runNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+		result.ran++;
+
+		if (!finished) {
+			task.queuedAt = Clock::now();
+			stats.queued.fetch_add(1, std::memory_order_relaxed);
+			incoming.push_back(std::move(task));
+		}
+		return elapsed;
+	}
+}
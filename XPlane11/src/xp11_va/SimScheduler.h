@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Connection.h"
+#include "InstrumentedMutex.h"
+#include "LatencyHistogram.h"
+
+namespace xp11_va {
+	struct SchedulerOptions {
+		// once a frame has spent this long on queued work, normal and bulk work waits for the next frame
+		std::chrono::microseconds frameBudget{ 2000 };
+		// normal and bulk lanes always get this many tasks per frame, however busy the lanes above them are
+		size_t minTasksPerLane{ 4 };
+		// sim thread time a client of weight 1 is given each round, before it has to let the next client go
+		std::chrono::microseconds quantum{ 50 };
+		// the most tasks one client may run in one lane in a single frame while other clients in the lane
+		// are still waiting, 0 for no limit; work that belongs to no client is never limited
+		size_t clientQuota{ 64 };
+	};
+
+	/*
+	 * The queue of work waiting for the flight loop. Work is split into lanes
+	 * by priority, and within a lane into one queue per client, which are
+	 * served by deficit round robin: each round a client is given its weight
+	 * times the quantum of sim thread time, and may keep running tasks until
+	 * it has spent it. A client flooding the queue therefore only delays the
+	 * others by about one quantum per round, and by no more than its quota per
+	 * frame while they still have work. Normal and bulk lanes also stop for the
+	 * frame once the frame budget is spent, after a few tasks each so that they
+	 * are never starved. The interactive lane always runs to empty.
+	 *
+	 * Everything here runs under one lock that RunFrame holds throughout, so
+	 * Queue and Cancel wait for a frame in progress to finish.
+	 */
+	class SimScheduler {
+	public:
+		typedef std::chrono::steady_clock Clock;
+		typedef std::function<bool()> Callback;
+
+		struct Task {
+			// work for a session that has ended is cancelled instead of run, nullptr means always run
+			std::shared_ptr<Session> session;
+			// returns true when complete, false if it needs to run again next frame
+			Callback run;
+			// completes anything waiting on the task with the given reply, called in place of run
+			std::function<void(const char*)> cancel;
+			// work that has not started by this time is cancelled with {timeout}
+			Clock::time_point deadline = Clock::time_point::max();
+			Priority priority = Priority::Normal;
+			// set by Queue, for measuring how long the task waited for the flight loop
+			Clock::time_point queuedAt{};
+		};
+
+		// what happened to the work looked at by one call to RunFrame
+		struct FrameResult {
+			size_t ran = 0;
+			size_t cancelled = 0;
+			size_t expired = 0;
+			// left for a later frame by the frame budget or a client's quota
+			size_t deferred = 0;
+		};
+
+		struct LaneStats {
+			std::atomic<uint64_t> tasks{ 0 };
+			// time spent running tasks, as opposed to waiting for them
+			std::atomic<uint64_t> runNs{ 0 };
+			// between being queued and being run
+			std::atomic<uint64_t> waitNs{ 0 };
+			std::atomic<uint64_t> maxWaitNs{ 0 };
+			// the same waits, for percentiles
+			LatencyHistogram wait;
+			// times a task was left for a later frame
+			std::atomic<uint64_t> deferred{ 0 };
+			// tasks waiting right now, including those queued since the last frame, readable without the lock
+			std::atomic<uint64_t> queued{ 0 };
+		};
+
+		typedef InstrumentedMutex<std::recursive_mutex> Mutex;
+
+		// lockName is what the scheduler's lock is reported as, it must outlive the scheduler
+		explicit SimScheduler(SchedulerOptions = {}, const char* lockName = "sim_queue");
+		SimScheduler(const SimScheduler&) = delete;
+		SimScheduler& operator=(const SimScheduler&) = delete;
+
+		// queued work is first looked at in the next call to RunFrame, even when queued by a running task
+		void Queue(Task);
+		// cancels everything queued for the session with {cancelled}, returns how many there were
+		size_t Cancel(const Session&);
+		// runs as much of the queued work as this frame allows, on the calling (sim) thread
+		FrameResult RunFrame();
+
+		const LaneStats& Stats(Priority priority) const { return laneStats[static_cast<size_t>(priority)]; }
+		const Mutex& Lock() const { return mutex; }
+
+	private:
+		// kept, with their storage, until the session is cancelled, so steady traffic doesn't allocate
+		struct ClientQueue {
+			std::shared_ptr<Session> session;
+			// tasks before head have been taken, the vector is cleared once they all have
+			std::vector<Task> tasks;
+			size_t head = 0;
+			// sim thread time this client may still spend in the current round, can go negative
+			int64_t deficitNs = 0;
+			size_t ranThisFrame = 0;
+
+			bool Empty() const { return head == tasks.size(); }
+		};
+
+		struct Lane {
+			// keyed by session owner, 0 for work that does not belong to a client
+			std::map<uint64_t, ClientQueue> clients;
+			// clients with work queued, served in turn starting from the cursor
+			std::vector<ClientQueue*> active;
+			size_t cursor = 0;
+			size_t queued = 0;
+		};
+
+		const SchedulerOptions options;
+		Mutex mutex;
+		// work queued since the last frame started
+		std::vector<Task> incoming;
+		// swapped with incoming at the start of each frame, so both keep their capacity
+		std::vector<Task> arriving;
+		std::array<Lane, PRIORITY_COUNT> lanes;
+		std::array<LaneStats, PRIORITY_COUNT> laneStats;
+
+		void admit(Task);
+		// runs the task, or cancels it if it is no longer wanted, and returns how long it ran for
+		Clock::duration runTask(Task&, LaneStats&, FrameResult&);
+	};
+}
@@ -0,0 +1,213 @@
+#include "pch.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace xp11_va {
+	namespace {
+		struct Span {
+			const char* name;
+			Tracer::Clock::time_point start;
+			Tracer::Clock::time_point end;
+			uint64_t connection;
+			uint64_t request;
+			uint32_t thread;
+			bool async;
+			uint8_t detailLength;
+			char detail[Tracer::DETAIL_BYTES];
+		};
+
+		constexpr size_t MAX_NAMED_THREADS = 256;
+		constexpr size_t THREAD_NAME_BYTES = 32;
+
+		// held by Start, Stop and Write, which may be called from any connection
+		std::mutex controlMutex;
+		std::unique_ptr<Span[]> spans;
+		size_t ringSize = 0;
+		std::atomic<uint64_t> head{ 0 };
+		// threads part way through recording a span, the ring is only touched once this drops to zero
+		std::atomic<uint32_t> writers{ 0 };
+		Tracer::Clock::time_point origin;
+
+		std::atomic<uint32_t> nextThread{ 1 };
+		std::array<std::array<char, THREAD_NAME_BYTES>, MAX_NAMED_THREADS> threadNames{};
+
+		void appendEscaped(std::string& out, std::string_view text) {
+			for (const char c : text) {
+				if (c == '"' || c == '\\') {
+					out.push_back('\\');
+					out.push_back(c);
+				}
+				else if (static_cast<unsigned char>(c) < 0x20) {
+					char escaped[8];
+					std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+					out.append(escaped);
+				}
+				else {
+					out.push_back(c);
+				}
+			}
+		}
+
+		// microseconds since tracing started, which is what trace viewers expect
+		void appendMicros(std::string& out, Tracer::Clock::duration since) {
+			char digits[32];
+			const int length = std::snprintf(digits, sizeof(digits), "%.3f", std::chrono::duration<double, std::micro>(since).count());
+			out.append(digits, std::max(length, 0));
+		}
+	}
+
+	std::atomic_bool Tracer::enabled{ false };
+
+	/* PUBLIC API */
+
+	void Tracer::Start(size_t capacity) {
+		std::lock_guard<std::mutex> lock(controlMutex);
+		pause();
+
+		// a power of two, so a span's slot is its position masked
+		size_t size = 1;
+		while (size < std::max<size_t>(capacity, 2)) { size <<= 1; }
+		if (size != ringSize) {
+			spans = std::make_unique<Span[]>(size);
+			ringSize = size;
+		}
+		head = 0;
+		origin = Clock::now();
+
+		enabled = true;
+	}
+
+	void Tracer::Stop() {
+		std::lock_guard<std::mutex> lock(controlMutex);
+		pause();
+	}
+
+	long Tracer::Write(const std::string& path) {
+		std::lock_guard<std::mutex> lock(controlMutex);
+
+		const bool was = pause();
+		const uint64_t recorded = head.load();
+		const uint64_t first = recorded > ringSize ? recorded - ringSize : 0;
+
+		// built up front so the ring is only held for as long as formatting takes, not for the file write
+		std::string json;
+		json.reserve(static_cast<size_t>(recorded - first) * 160 + 1024);
+		json.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+		const uint32_t threads = std::min<uint32_t>(nextThread.load(), MAX_NAMED_THREADS);
+		bool first_event = true;
+		for (uint32_t t = 1; t < threads; t++) {
+			if (threadNames[t][0] == '\0') { continue; }
+			if (!first_event) { json.append(",\n"); }
+			first_event = false;
+			json.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+			json.append(std::to_string(t));
+			json.append(",\"args\":{\"name\":\"");
+			appendEscaped(json, threadNames[t].data());
+			json.append("\"}}");
+		}
+
+		for (uint64_t i = first; i < recorded; i++) {
+			const Span& span = spans[i & (ringSize - 1)];
+			if (!first_event) { json.append(",\n"); }
+			first_event = false;
+
+			json.append("{\"name\":\"");
+			appendEscaped(json, span.name);
+			json.append(span.async ? "\",\"cat\":\"request\",\"ph\":\"b\",\"id\":" : "\",\"cat\":\"xp11va\",\"ph\":\"X\",\"dur\":");
+			if (span.async) {
+				json.append(std::to_string(span.request));
+			}
+			else {
+				appendMicros(json, span.end - span.start);
+			}
+			json.append(",\"pid\":1,\"tid\":");
+			json.append(std::to_string(span.thread));
+			json.append(",\"ts\":");
+			appendMicros(json, span.start - origin);
+			json.append(",\"args\":{\"connection\":");
+			json.append(std::to_string(span.connection));
+			json.append(",\"request\":");
+			json.append(std::to_string(span.request));
+			if (span.detailLength > 0) {
+				json.append(",\"detail\":\"");
+				appendEscaped(json, std::string_view(span.detail, span.detailLength));
+				json.push_back('"');
+			}
+			json.append("}}");
+
+			// async events have no duration, they are a begin and an end with the same id
+			if (span.async) {
+				json.append(",\n{\"name\":\"");
+				appendEscaped(json, span.name);
+				json.append("\",\"cat\":\"request\",\"ph\":\"e\",\"id\":");
+				json.append(std::to_string(span.request));
+				json.append(",\"pid\":1,\"tid\":");
+				json.append(std::to_string(span.thread));
+				json.append(",\"ts\":");
+				appendMicros(json, span.end - origin);
+				json.push_back('}');
+			}
+		}
+		json.append("\n]}\n");
+
+		if (was) { enabled = true; }
+
+		std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+		file.write(json.data(), static_cast<std::streamsize>(json.size()));
+		if (!file) { return -1; }
+		return static_cast<long>(recorded - first);
+	}
+
+	uint32_t Tracer::ThisThread() noexcept {
+		thread_local const uint32_t number = nextThread.fetch_add(1, std::memory_order_relaxed);
+		return number;
+	}
+
+	void Tracer::NameThisThread(std::string_view name) {
+		std::lock_guard<std::mutex> lock(controlMutex);
+		const uint32_t thread = ThisThread();
+		if (thread >= MAX_NAMED_THREADS || threadNames[thread][0] != '\0') { return; }
+
+		const size_t length = std::min(name.size(), THREAD_NAME_BYTES - 1);
+		std::memcpy(threadNames[thread].data(), name.data(), length);
+		threadNames[thread][length] = '\0';
+	}
+
+	/* PRIVATE API */
+
+	bool Tracer::pause() {
+		const bool was = enabled.exchange(false);
+		while (writers.load() > 0) {
+			std::this_thread::yield();
+		}
+		return was;
+	}
+
+	void Tracer::record(const char* name, Clock::time_point start, Clock::time_point end,
+		uint64_t connection, uint64_t request, std::string_view detail, uint32_t thread, bool async) noexcept {
+		if (!Enabled()) { return; }
+
+		// pause clears enabled and then waits for writers, so either it sees this one or this one sees it cleared
+		writers.fetch_add(1);
+		if (enabled.load()) {
+			Span& span = spans[head.fetch_add(1, std::memory_order_relaxed) & (ringSize - 1)];
+			span.name = name;
+			span.start = start;
+			span.end = end;
+			span.connection = connection;
+			span.request = request;
+			span.thread = thread;
+			span.async = async;
+			span.detailLength = static_cast<uint8_t>(std::min(detail.size(), DETAIL_BYTES));
+			if (span.detailLength > 0) {
+				std::memcpy(span.detail, detail.data(), span.detailLength);
+			}
+		}
+		writers.fetch_sub(1);
+	}
+}
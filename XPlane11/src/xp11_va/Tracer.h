@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace xp11_va {
+	/*
+	 * Records spans of time, each with the thread it ran on and the connection
+	 * and request it belongs to, into a ring allocated when tracing starts.
+	 * Once the ring is full the oldest spans are overwritten, so it always
+	 * holds the most recent stretch of activity. Write turns the ring into
+	 * Chrome trace event JSON, which chrome://tracing and ui.perfetto.dev both
+	 * open.
+	 *
+	 * Tracing is off until Start is called, and while it is off recording a
+	 * span costs one relaxed load.
+	 */
+	class Tracer {
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+		// how much of a span's detail text is kept, the rest is cut off
+		static constexpr size_t DETAIL_BYTES = 48;
+
+		// times its own lifetime, if tracing was on when it was made
+		class Scope {
+		public:
+			explicit Scope(const char* n, uint64_t c = 0) : name(n), connection(c), start(Enabled() ? Clock::now() : Clock::time_point{}) {}
+			~Scope() {
+				if (start != Clock::time_point{}) {
+					Record(name, start, Clock::now(), connection);
+				}
+			}
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+		private:
+			const char* name;
+			const uint64_t connection;
+			const Clock::time_point start;
+		};
+
+		static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+		// starts recording into a ring of at least capacity spans, emptying it first
+		static void Start(size_t capacity = DEFAULT_CAPACITY);
+		// stops recording, what was recorded stays in the ring until the next Start
+		static void Stop();
+		// writes the ring to the file as a trace, returns the number of spans written or -1 if it couldn't be written.
+		// recording pauses while it writes.
+		static long Write(const std::string& path);
+
+		// name must outlive the tracer, a literal is best
+		static void Record(const char* name, Clock::time_point start, Clock::time_point end,
+			uint64_t connection = 0, uint64_t request = 0, std::string_view detail = {}, uint32_t thread = ThisThread()) noexcept {
+			record(name, start, end, connection, request, detail, thread, false);
+		}
+		// for spans that overlap others on the same thread, such as the requests of one message, which
+		// are shown on a track of their own for the request, nested under any other span of the same request
+		static void RecordAsync(const char* name, Clock::time_point start, Clock::time_point end,
+			uint64_t connection, uint64_t request, std::string_view detail = {}) noexcept {
+			record(name, start, end, connection, request, detail, ThisThread(), true);
+		}
+
+		// a small number for the calling thread, as shown in the trace
+		static uint32_t ThisThread() noexcept;
+		// the name the calling thread is shown with, the first one given sticks. takes a lock, so call it once per thread.
+		static void NameThisThread(std::string_view);
+
+	private:
+		static std::atomic_bool enabled;
+
+		// stops new spans being recorded and waits for those already being recorded, returns whether tracing was on
+		static bool pause();
+		static void record(const char*, Clock::time_point, Clock::time_point, uint64_t, uint64_t, std::string_view, uint32_t, bool async) noexcept;
+	};
+}
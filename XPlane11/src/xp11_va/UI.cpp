@@ -21,6 +21,10 @@ namespace xp11_va {
 	}
 
 	UI::~UI() {
+		if (log_subscription) {
+			logger.Unsubscribe(log_subscription);
+		}
+
 		if (nullptr != menu_id) {
 			XPLMDestroyMenu(menu_id);
 		}
@@ -30,6 +34,35 @@ namespace xp11_va {
 		}
 	}
 
+	void UI::ShowLog() noexcept {
+		if (!log_subscription) {
+			log_subscription = logger.Subscribe(logger.MinLevel());
+		}
+		XPLMSetWindowIsVisible(window_id, 1);
+	}
+
+	void UI::DrainLog() noexcept {
+		if (nullptr == listbox_id || !log_subscription) { return; }
+
+		if (log_subscription->IsDropped()) {
+			// a hidden window isn't drawn, so nothing drained the subscription while it was closed
+			logger.Unsubscribe(log_subscription);
+			log_subscription = logger.Subscribe(logger.MinLevel());
+			XPListBoxAddItem(listbox_id, "... lines logged while this window was closed are in the log file");
+		}
+
+		// the subscription's ring holds fewer records than a frame can take, so it is emptied every time
+		Logger::Record record;
+		char line[Logger::LINE_BYTES];
+		XPListBoxAddItems(listbox_id, [&](std::string& item) {
+			if (!log_subscription->TryNext(record)) { return false; }
+			size_t length = Logger::Format(record, line, sizeof(line));
+			if (length > 0 && line[length - 1] == '\n') { length--; }
+			item.assign(line, length);
+			return true;
+		});
+	}
+
 	bool UI::setupMenu() noexcept {
 		menu_container_idx = XPLMAppendMenuItem(XPLMFindPluginsMenu(), plugin_name, 0, 0);
 		menu_id = XPLMCreateMenu(plugin_name, XPLMFindPluginsMenu(), menu_container_idx, menu_handler, this);
@@ -91,7 +124,7 @@ namespace xp11_va {
 		Logger::get().Trace("menu_handler called");
 		if (strcmp("show_log", (const char*)in_item_ref) == 0) {
 			UI* ui = (UI*)in_menu_ref;
-			XPLMSetWindowIsVisible(ui->windowId(), 1);
+			ui->ShowLog();
 		}
 	}
 
@@ -100,7 +133,8 @@ namespace xp11_va {
 
 		XPLMSetGraphicsState(0, 0, 0, 0, 1, 1, 0);
 		XPLMGetWindowGeometry(window_id, &left, &top, &right, &bottom);
-		
+
+		((UI*)in_refcon)->DrainLog();
 	}
 
 	int mouse_handler(XPLMWindowID, int, int, XPLMMouseStatus, void*) {
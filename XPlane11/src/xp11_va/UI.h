@@ -16,9 +16,14 @@ namespace xp11_va {
 		XPLMWindowID windowId() const { return window_id; }
 		XPLMMenuID menuId() const { return menu_id; }
 
+		void ShowLog() noexcept;
+		// moves the lines logged since the last frame into the listbox, call from the window's draw
+		void DrainLog() noexcept;
+
 	private:
 		Logger& logger;
-		LogCallback logger_callback;
+		// follows the log while the window is up, at the level written to the log file
+		std::shared_ptr<Logger::Subscription> log_subscription;
 
 		int menu_container_idx = -1;
 		XPLMMenuID menu_id = nullptr;
@@ -0,0 +1,33 @@
+#include "pch.h"
+#include "xp11_va/Futex.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <ctime>
+
+namespace xp11_va {
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+
+	bool FutexWaitUntil(const std::atomic<uint32_t>& word, uint32_t expected, std::chrono::steady_clock::time_point deadline) {
+		while (word.load(std::memory_order_acquire) == expected) {
+			const auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+			if (remaining.count() <= 0) {
+				return false;
+			}
+
+			timespec ts{};
+			ts.tv_sec = static_cast<time_t>(remaining.count() / 1000000000);
+			ts.tv_nsec = static_cast<long>(remaining.count() % 1000000000);
+
+			// may return early, spuriously, on EAGAIN or on timeout, the loop sorts out which
+			syscall(SYS_futex, const_cast<std::atomic<uint32_t>*>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+		}
+		return true;
+	}
+
+	void FutexWakeAll(std::atomic<uint32_t>& word) {
+		syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+	}
+}
@@ -0,0 +1,25 @@
+#include "pch.h"
+#include "xp11_va/Futex.h"
+
+#include <Windows.h>
+
+namespace xp11_va {
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "WaitOnAddress needs a plain 32-bit word");
+
+	bool FutexWaitUntil(const std::atomic<uint32_t>& word, uint32_t expected, std::chrono::steady_clock::time_point deadline) {
+		while (word.load(std::memory_order_acquire) == expected) {
+			const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+			if (remaining.count() <= 0) {
+				return false;
+			}
+
+			// may return early, spuriously or on timeout, the loop sorts out which
+			WaitOnAddress(const_cast<std::atomic<uint32_t>*>(&word), &expected, sizeof(expected), static_cast<DWORD>(remaining.count()) + 1);
+		}
+		return true;
+	}
+
+	void FutexWakeAll(std::atomic<uint32_t>& word) {
+		WakeByAddressAll(&word);
+	}
+}
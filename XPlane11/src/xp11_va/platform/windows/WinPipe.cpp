@@ -66,7 +66,7 @@ namespace xp11_va::platform::windows {
 		return connected;
 	}
 	
-	std::optional<std::string> WinPipe::ReadPipe() {
+	bool WinPipe::ReadPipe(std::string& request) {
 		if (!connected) {
 			throw std::runtime_error("Attempt to read from non-connected pipe!");
 		}
@@ -80,11 +80,12 @@ namespace xp11_va::platform::windows {
 			} else {
 				buffer[BUFFER_SIZE - 1] = 0;
 			}
-			return buffer;
+			request.assign(buffer);
+			return true;
 		}
 
 		if (GetLastError() == ERROR_OPERATION_ABORTED) {
-			return {};
+			return false;
 		}
 
 		if (GetLastError() == ERROR_BROKEN_PIPE) {
@@ -94,7 +95,7 @@ namespace xp11_va::platform::windows {
 		throw std::runtime_error("Error reading from pipe: " + lastErrorToString());
 	}
 
-	bool WinPipe::WritePipe(std::string msg) {
+	bool WinPipe::WritePipe(std::string_view msg) {
 		if (!connected) {
 			throw std::runtime_error("Attempt to write to non-connected pipe!");
 		}
@@ -102,7 +103,7 @@ namespace xp11_va::platform::windows {
 		DWORD bytesToWrite = static_cast<DWORD>(msg.length() * sizeof(std::string::value_type));
 		DWORD bytesWritten;
 
-		if (WriteFile(pipe, msg.c_str(), bytesToWrite, &bytesWritten, nullptr)) {
+		if (WriteFile(pipe, msg.data(), bytesToWrite, &bytesWritten, nullptr)) {
 			return true;
 		}
 
@@ -117,6 +118,11 @@ namespace xp11_va::platform::windows {
 		throw std::runtime_error("Error writing to pipe: " + lastErrorToString());
 	}
 
+	bool WinPipe::IsPeerConnected() {
+		// peeking at nothing fails with ERROR_BROKEN_PIPE once the client has gone
+		return connected && (PeekNamedPipe(pipe, nullptr, 0, nullptr, nullptr, nullptr) || GetLastError() != ERROR_BROKEN_PIPE);
+	}
+
 	void WinPipe::Abort(std::thread::native_handle_type handle) {
 		CancelSynchronousIo(handle);
 	}
@@ -13,8 +13,9 @@ namespace xp11_va::platform::windows {
 
 		void Connect() override;
 		bool IsConnected() override;
-		std::optional<std::string> ReadPipe() override;
-		bool WritePipe(std::string) override;
+		bool ReadPipe(std::string&) override;
+		bool WritePipe(std::string_view) override;
+		bool IsPeerConnected() override;
 		void Abort(std::thread::native_handle_type) override;
 		
 	private:
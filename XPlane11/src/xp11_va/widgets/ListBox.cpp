@@ -5,6 +5,8 @@
 #include <XPLM/XPLMGraphics.h>
 #include <Widgets/XPUIGraphics.h>
 #include <gl/GL.h>
+#include <algorithm>
+#include <cstring>
 
 // To create a listbox, make a new widget with our listbox proc as the widget proc.
 XPWidgetID           XPCreateListBox(
@@ -128,6 +130,42 @@ void	SetAlphaLevels(float inAlphaLevel)
 	gAlphaLevel = inAlphaLevel;
 }
 
+// Sets the scrollbar's range to the rows that don't fit, after items were added
+// or removed. A list scrolled to the bottom stays there, so new items show as
+// they come; otherwise the top row stays on the item it showed, unless that
+// item was dropped off the front of the ring. The selection moves with its item.
+static void XPListBoxUpdateScrollBar(XPWidgetID inWidget, XPListBoxData_t* pListBoxData, size_t inDropped)
+{
+	int	OldMax = XPGetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarMax, NULL);
+	int	SliderPosition = XPGetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarSliderPosition, NULL);
+	int	MaxListBoxItems = XPGetWidgetProperty(inWidget, xpProperty_ListBoxMaxListBoxItems, NULL);
+	int	CurrentItem = XPGetWidgetProperty(inWidget, xpProperty_ListBoxCurrentItem, NULL);
+
+	int	Max = std::max(0, (int)pListBoxData->Size() - MaxListBoxItems);
+	if (SliderPosition > 0)
+	{
+		int	TopItem = std::max(0, OldMax - SliderPosition - (int)inDropped);
+		SliderPosition = std::clamp(Max - TopItem, 0, Max);
+	}
+	if ((inDropped > 0) && (CurrentItem != -1))
+	{
+		CurrentItem = std::max(-1, CurrentItem - (int)inDropped);
+		XPSetWidgetProperty(inWidget, xpProperty_ListBoxCurrentItem, CurrentItem);
+	}
+
+	XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarMax, Max);
+	XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarSliderPosition, SliderPosition);
+}
+
+// Scrolls back to the first item, after the list was filled anew.
+static void XPListBoxScrollToTop(XPWidgetID inWidget, XPListBoxData_t* pListBoxData)
+{
+	int	MaxListBoxItems = XPGetWidgetProperty(inWidget, xpProperty_ListBoxMaxListBoxItems, NULL);
+	int	Max = std::max(0, (int)pListBoxData->Size() - MaxListBoxItems);
+	XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarMax, Max);
+	XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarSliderPosition, Max);
+}
+
 // This widget Proc implements the actual listbox.
 
 int		XPListBoxProc(
@@ -164,15 +202,15 @@ int		XPListBoxProc(
 			// Allocate mem for the structure.
 			pListBoxData = new XPListBoxData_t;
 			XPGetWidgetDescriptor(inWidget, Buffer, sizeof(Buffer));
-			XPListBoxFillWithData(pListBoxData, Buffer, (Right - Left - 20));
+			XPListBoxFillWithData(pListBoxData, Buffer);
 			XPSetWidgetProperty(inWidget, xpProperty_ListBoxData, (intptr_t)pListBoxData);
 			XPSetWidgetProperty(inWidget, xpProperty_ListBoxCurrentItem, 0);
 			Min = 0;
-			Max = pListBoxData->Items.size();
+			MaxListBoxItems = (Top - Bottom) / LISTBOX_ITEM_HEIGHT;
+			Max = std::max(0, (int)pListBoxData->Size() - MaxListBoxItems);
 			ScrollBarSlop = 0;
 			Highlighted = false;
 			SliderPosition = Max;
-			MaxListBoxItems = (Top - Bottom) / LISTBOX_ITEM_HEIGHT;
 			ScrollBarPageAmount = MaxListBoxItems;
 			XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarSliderPosition, SliderPosition);
 			XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarMin, Min);
@@ -182,6 +220,11 @@ int		XPListBoxProc(
 			XPSetWidgetProperty(inWidget, xpProperty_ListBoxHighlighted, Highlighted);
 			return 1;
 
+		case xpMsg_Destroy:
+			XPSetWidgetProperty(inWidget, xpProperty_ListBoxData, 0);
+			delete pListBoxData;
+			return 1;
+
 		case xpMsg_DescriptorChanged:
 			return 1;
 
@@ -190,11 +233,9 @@ int		XPListBoxProc(
 			{
 				XPSetWidgetProperty(inWidget, xpProperty_ListBoxAddItem, 0);
 				XPGetWidgetDescriptor(inWidget, Buffer, sizeof(Buffer));
-				XPListBoxAddItem(pListBoxData, Buffer, (Right - Left - 20));
-				Max = pListBoxData->Items.size();
-				SliderPosition = Max;
-				XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarSliderPosition, SliderPosition);
-				XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarMax, Max);
+				size_t Dropped = pListBoxData->Size() == pListBoxData->Capacity ? 1 : 0;
+				XPListBoxAddItem(pListBoxData, Buffer);
+				XPListBoxUpdateScrollBar(inWidget, pListBoxData, Dropped);
 			}
 
 			if (XPGetWidgetProperty(inWidget, xpProperty_ListBoxAddItemsWithClear, NULL))
@@ -202,11 +243,8 @@ int		XPListBoxProc(
 				XPSetWidgetProperty(inWidget, xpProperty_ListBoxAddItemsWithClear, 0);
 				XPGetWidgetDescriptor(inWidget, Buffer, sizeof(Buffer));
 				XPListBoxClear(pListBoxData);
-				XPListBoxFillWithData(pListBoxData, Buffer, (Right - Left - 20));
-				Max = pListBoxData->Items.size();
-				SliderPosition = Max;
-				XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarSliderPosition, SliderPosition);
-				XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarMax, Max);
+				XPListBoxFillWithData(pListBoxData, Buffer);
+				XPListBoxScrollToTop(inWidget, pListBoxData);
 			}
 
 			if (XPGetWidgetProperty(inWidget, xpProperty_ListBoxClear, NULL))
@@ -214,24 +252,29 @@ int		XPListBoxProc(
 				XPSetWidgetProperty(inWidget, xpProperty_ListBoxClear, 0);
 				XPSetWidgetProperty(inWidget, xpProperty_ListBoxCurrentItem, 0);
 				XPListBoxClear(pListBoxData);
-				Max = pListBoxData->Items.size();
-				SliderPosition = Max;
-				XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarSliderPosition, SliderPosition);
-				XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarMax, Max);
+				XPListBoxScrollToTop(inWidget, pListBoxData);
 			}
 
 			if (XPGetWidgetProperty(inWidget, xpProperty_ListBoxInsertItem, NULL))
 			{
 				XPSetWidgetProperty(inWidget, xpProperty_ListBoxInsertItem, 0);
 				XPGetWidgetDescriptor(inWidget, Buffer, sizeof(Buffer));
-				XPListBoxInsertItem(pListBoxData, Buffer, (Right - Left - 20), CurrentItem);
+				if ((CurrentItem >= 0) && (CurrentItem <= (int)pListBoxData->Size()))
+				{
+					size_t Dropped = pListBoxData->Size() == pListBoxData->Capacity ? 1 : 0;
+					XPListBoxInsertItem(pListBoxData, Buffer, CurrentItem);
+					XPListBoxUpdateScrollBar(inWidget, pListBoxData, Dropped);
+				}
 			}
 
 			if (XPGetWidgetProperty(inWidget, xpProperty_ListBoxDeleteItem, NULL))
 			{
 				XPSetWidgetProperty(inWidget, xpProperty_ListBoxDeleteItem, 0);
-				if ((pListBoxData->Items.size() > 0) && (pListBoxData->Items.size() > CurrentItem))
+				if ((CurrentItem >= 0) && (CurrentItem < (int)pListBoxData->Size()))
+				{
 					XPListBoxDeleteItem(pListBoxData, CurrentItem);
+					XPListBoxUpdateScrollBar(inWidget, pListBoxData, 0);
+				}
 			}
 			return 1;
 
@@ -247,51 +290,46 @@ int		XPListBoxProc(
 			XPLMBindTexture2d(XPLMGetTexture(xplm_Tex_GeneralInterface), 0);
 			glColor4f(1.0, 1.0, 1.0, 1.0);
 				
-			unsigned int ItemNumber;
 			XPLMSetGraphicsState(0, 0, 0,  0, 0,  0, 0);
 
-			// Now draw each item.
+			// Only the rows that fit are drawn, however many items there are.
+			float	text[3];
+			SetupAmbientColor(xpColor_ListText, text);
+
+			int		FontWidth, FontHeight;
+			XPLMGetFontDimensions(xplmFont_Basic, &FontWidth, &FontHeight, NULL);
+			size_t	MaxChars = std::min((size_t)std::max(0, ((Right - 20) - Left) / std::max(1, FontWidth)), (size_t)511);
+
 			ListBoxIndex = Max - SliderPosition;
-			ItemNumber = 0;
-			while (ItemNumber < MaxListBoxItems)
+			for (int ItemNumber = 0; (ItemNumber < MaxListBoxItems) && (ListBoxIndex < (int)pListBoxData->Size()); ItemNumber++, ListBoxIndex++)
 			{
-				if (ListBoxIndex < pListBoxData->Items.size())
-				{
-					// Calculate the item rect in global coordinates.
-					int ItemTop    = Top - (ItemNumber * LISTBOX_ITEM_HEIGHT);
-					int ItemBottom = Top - ((ItemNumber * LISTBOX_ITEM_HEIGHT) + LISTBOX_ITEM_HEIGHT);
+				// Calculate the item rect in global coordinates.
+				int ItemTop    = Top - (ItemNumber * LISTBOX_ITEM_HEIGHT);
+				int ItemBottom = Top - ((ItemNumber * LISTBOX_ITEM_HEIGHT) + LISTBOX_ITEM_HEIGHT);
 
-					// If we are hilited, draw the hilite bkgnd.
-					if (CurrentItem == ListBoxIndex)
-					{
-						SetAlphaLevels(0.25);
-						XPLMSetGraphicsState(0, 0, 0,  0, 1, 0, 0);
-						SetupAmbientColor(xpColor_MenuHilite, NULL);
-						SetAlphaLevels(1.0);
-						glBegin(GL_QUADS);
-						glVertex2i(Left, ItemTop);
-						glVertex2i(Right-20, ItemTop);
-						glVertex2i(Right-20, ItemBottom);
-						glVertex2i(Left, ItemBottom);
-						glEnd();						
-					}
-					
-					float	text[3];
-					SetupAmbientColor(xpColor_ListText, text);
-					
-					char	Buffer[512];
-					int		FontWidth, FontHeight;
-					int		ListBoxWidth = (Right - 20) - Left;
-					strncpy_s(Buffer, 512, pListBoxData->Items[ListBoxIndex].c_str(), pListBoxData->Items[ListBoxIndex++].length());
-					XPLMGetFontDimensions(xplmFont_Basic, &FontWidth, &FontHeight, NULL);
-					int		MaxChars = ListBoxWidth / FontWidth;
-					Buffer[MaxChars] = 0;
-
-					XPLMDrawString(text,
-								Left, ItemBottom + 2,
-								const_cast<char *>(Buffer), NULL, xplmFont_Basic);
+				// If we are hilited, draw the hilite bkgnd.
+				if (CurrentItem == ListBoxIndex)
+				{
+					SetAlphaLevels(0.25);
+					XPLMSetGraphicsState(0, 0, 0,  0, 1, 0, 0);
+					SetupAmbientColor(xpColor_MenuHilite, NULL);
+					SetAlphaLevels(1.0);
+					glBegin(GL_QUADS);
+					glVertex2i(Left, ItemTop);
+					glVertex2i(Right-20, ItemTop);
+					glVertex2i(Right-20, ItemBottom);
+					glVertex2i(Left, ItemBottom);
+					glEnd();
 				}
-				ItemNumber++;
+
+				// Only as much of the item as fits is copied.
+				const std::string& Item = pListBoxData->Item(ListBoxIndex);
+				char	Line[512];
+				size_t	Length = std::min(Item.size(), MaxChars);
+				std::memcpy(Line, Item.data(), Length);
+				Line[Length] = 0;
+
+				XPLMDrawString(text, Left, ItemBottom + 2, Line, NULL, xplmFont_Basic);
 			}
 		}
 			return 1;
@@ -305,10 +343,10 @@ int		XPListBoxProc(
 
 			if (IN_RECT(MOUSE_X(inParam1), MOUSE_Y(inParam1), Left, Top, Right-20, Bottom))
 			{
-				if (pListBoxData->Items.size() > 0)
+				if (pListBoxData->Size() > 0)
 				{
-					if (CurrentItem != -1)
-						XPSetWidgetDescriptor(inWidget, pListBoxData->Items[CurrentItem].c_str());
+					if ((CurrentItem != -1) && (CurrentItem < (int)pListBoxData->Size()))
+						XPSetWidgetDescriptor(inWidget, pListBoxData->Item(CurrentItem).c_str());
 					else
 						XPSetWidgetDescriptor(inWidget, "");
 					XPSendMessageToWidget(inWidget, xpMessage_ListBoxItemSelected, xpMode_UpChain, (intptr_t) inWidget, (intptr_t) CurrentItem);
@@ -319,14 +357,14 @@ int		XPListBoxProc(
 		case xpMsg_MouseDown:
 			if (IN_RECT(MOUSE_X(inParam1), MOUSE_Y(inParam1), Left, Top, Right-20, Bottom))
 			{
-				if (pListBoxData->Items.size() > 0)
+				if (pListBoxData->Size() > 0)
 				{
 					XPLMGetMouseLocation(&x, &y);
 					ListBoxDataOffset = XPListBoxGetItemNumber(pListBoxData, x - Left, Top - y);	
 					if (ListBoxDataOffset != -1)
 					{
 						ListBoxDataOffset += (Max - SliderPosition);
-						if (ListBoxDataOffset < pListBoxData->Items.size())
+						if (ListBoxDataOffset < (int)pListBoxData->Size())
 							XPSetWidgetProperty(inWidget, xpProperty_ListBoxCurrentItem, ListBoxDataOffset);
 					}
 				}
@@ -439,47 +477,45 @@ int		XPListBoxProc(
 		}
 		return 1;
 
+	case xpMsg_MouseWheel:
+		if (IN_RECT(MOUSE_X(inParam1), MOUSE_Y(inParam1), Left, Top, Right, Bottom))
+		{
+			SliderPosition += ((XPMouseState_t*)inParam1)->delta * LISTBOX_WHEEL_ROWS;
+			SliderPosition = std::clamp(SliderPosition, Min, Max);
+			XPSetWidgetProperty(inWidget, xpProperty_ListBoxScrollBarSliderPosition, SliderPosition);
+		}
+		return 1;
+
 		default:
 			return 0;
 	}	
 }
 
-// This routine finds the item that is in a given point, or returns -1 if there is none.
-// It simply trolls through all the items.
+// This routine finds the row that is at a given point, relative to the top left
+// of the list, or returns -1 if there is none. Every row is the same height, so
+// it is worked out rather than searched for.
 int XPListBoxGetItemNumber(XPListBoxData_t * pListBoxData, int inX, int inY)
 {
-	for (unsigned int n = 0; n < pListBoxData->Items.size(); ++n)
-	{
-		if ((inX >= pListBoxData->Lefts[n]) && (inX < pListBoxData->Rights[n]) &&
-			(inY >= (n * LISTBOX_ITEM_HEIGHT)) && (inY < ((n * LISTBOX_ITEM_HEIGHT) + LISTBOX_ITEM_HEIGHT)))
-		{
-			return n;
-		}
-	}
-	return -1;	
+	if ((inX < 0) || (inY < 0))
+		return -1;
+
+	int n = inY / LISTBOX_ITEM_HEIGHT;
+	return (n < (int)pListBoxData->Size()) ? n : -1;
 }
 
-void XPListBoxFillWithData(XPListBoxData_t *pListBoxData, const char *inItems, int Width)
+// The items are separated by semicolons.
+void XPListBoxFillWithData(XPListBoxData_t *pListBoxData, const char *inItems)
 {
-	std::string	Items(inItems);
+	std::string_view	Items(inItems);
 	while (!Items.empty())
 	{
-		std::string::size_type split = Items.find(';');
-		if (split == Items.npos)
-		{
-			split = Items.size();
-		}
-
-		std::string	Item = Items.substr(0, split);
+		std::string_view::size_type split = Items.find(';');
+		bool	dropped;
+		pListBoxData->Push(dropped).assign(Items.substr(0, split));
 
-		pListBoxData->Items.push_back(Item);
-		pListBoxData->Lefts.push_back(0);
-		pListBoxData->Rights.push_back(Width);
-
-		if (Item.size() == Items.size())
+		if (split == Items.npos)
 			break;
-		else
-			Items = Items.substr(split+1);
+		Items.remove_prefix(split + 1);
 	}
 }
 
@@ -488,35 +524,48 @@ void XPListBoxAddItem(XPWidgetID listboxId, const char* pBuffer) {
 	XPSetWidgetProperty(listboxId, xpProperty_ListBoxAddItem, 1);
 }
 
-void XPListBoxAddItem(XPListBoxData_t *pListBoxData, char *pBuffer, int Width)
+size_t XPListBoxAddItems(XPWidgetID listboxId, const std::function<bool(std::string&)>& inNext)
 {
-	std::string	Item(pBuffer);
+	XPListBoxData_t	*pListBoxData = (XPListBoxData_t*) XPGetWidgetProperty(listboxId, xpProperty_ListBoxData, NULL);
+	if (pListBoxData == NULL)
+		return 0;
+
+	// Each item is read into Next and then swapped into its slot, so the buffers
+	// go round with the ring instead of being allocated anew.
+	size_t	Added = 0, Dropped = 0;
+	std::string&	Next = pListBoxData->Next;
+	while (Next.clear(), inNext(Next))
+	{
+		bool	dropped;
+		pListBoxData->Push(dropped).swap(Next);
+		Added++;
+		if (dropped)
+			Dropped++;
+	}
 
-	pListBoxData->Items.push_back(Item);
-	pListBoxData->Lefts.push_back(0);
-	pListBoxData->Rights.push_back(Width);
+	if (Added > 0)
+		XPListBoxUpdateScrollBar(listboxId, pListBoxData, Dropped);
+	return Added;
 }
 
-void XPListBoxClear(XPListBoxData_t *pListBoxData)
+void XPListBoxAddItem(XPListBoxData_t *pListBoxData, const char *pBuffer)
 {
-	pListBoxData->Items.clear();
-	pListBoxData->Lefts.clear();
-	pListBoxData->Rights.clear();
+	bool	dropped;
+	pListBoxData->Push(dropped).assign(pBuffer);
 }
 
-void XPListBoxInsertItem(XPListBoxData_t *pListBoxData, char *pBuffer, int Width, int CurrentItem)
+void XPListBoxClear(XPListBoxData_t *pListBoxData)
 {
-	std::string	Item(pBuffer);
+	pListBoxData->Clear();
+}
 
-	pListBoxData->Items.insert(pListBoxData->Items.begin() + CurrentItem, Item);
-	pListBoxData->Lefts.insert(pListBoxData->Lefts.begin() + CurrentItem, 0);
-	pListBoxData->Rights.insert(pListBoxData->Rights.begin() + CurrentItem, Width);
+void XPListBoxInsertItem(XPListBoxData_t *pListBoxData, const char *pBuffer, int CurrentItem)
+{
+	bool	dropped;
+	pListBoxData->Insert(CurrentItem, dropped).assign(pBuffer);
 }
 
 void XPListBoxDeleteItem(XPListBoxData_t *pListBoxData, int CurrentItem)
 {
-	pListBoxData->Items.erase(pListBoxData->Items.begin() + CurrentItem);
-	pListBoxData->Lefts.erase(pListBoxData->Lefts.begin() + CurrentItem);
-	pListBoxData->Rights.erase(pListBoxData->Rights.begin() + CurrentItem);
+	pListBoxData->Erase(CurrentItem);
 }
-
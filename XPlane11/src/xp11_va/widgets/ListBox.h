@@ -2,8 +2,15 @@
 
 #include <Widgets/XPWidgets.h>
 #include <stdlib.h>
+#include <functional>
+#include <string>
+#include <vector>
 
 #define LISTBOX_ITEM_HEIGHT 12
+// The most items a listbox holds before it starts dropping the oldest.
+#define LISTBOX_MAX_ITEMS 100000
+// How many rows one notch of the mouse wheel scrolls.
+#define LISTBOX_WHEEL_ROWS 3
 
 /************************************************************************
  * LISTBOX
@@ -70,15 +77,31 @@ enum {
 	xpMessage_ListBoxItemSelected				= 1900
 };
 
-// This structure represents a listbox internally...it consists of arrays
-// per item and some general stuff.
+// This structure represents a listbox internally. The items are kept in a ring
+// of at most Capacity; adding one to a full ring drops the oldest. Every item
+// spans the width of the list, so the item under a point follows from its row.
 struct	XPListBoxData_t {
-	// Per item:
-	std::vector<std::string>	Items;		// The name of the item
-	std::vector<int>			Lefts;		// The rectangle of the item, relative to the top left corner of the listbox/
-	std::vector<int>			Rights;
-};
+	explicit XPListBoxData_t(size_t inCapacity = LISTBOX_MAX_ITEMS) : Capacity(inCapacity) {}
+
+	size_t Size() const { return Count; }
+	// Item n, counting from the oldest.
+	std::string& Item(size_t n) { return Items[(First + n) % Items.size()]; }
+
+	// Makes room for an item after the last and returns it to be filled in.
+	// Sets outDropped if the oldest item had to go to make the room.
+	std::string& Push(bool& outDropped);
+	// Makes room for an item at n, counted before any oldest item is dropped, and returns it to be filled
+	// in. The items on whichever side of n is shorter move along by one.
+	std::string& Insert(size_t n, bool& outDropped);
+	void Erase(size_t n);
+	void Clear();
 
+	std::vector<std::string>	Items;		// The ring, grown up to Capacity as items are added
+	size_t						First = 0;	// The slot of the oldest item
+	size_t						Count = 0;
+	size_t						Capacity;
+	std::string					Next;		// Where XPListBoxAddItems reads each item to before it takes a slot
+};
 /*
  * XPCreateListBox
  *
@@ -102,10 +125,22 @@ int XPListBoxProc(
 	intptr_t				inParam2);
 
 int XPListBoxGetItemNumber(XPListBoxData_t* pListBoxData, int inX, int inY);
-void XPListBoxFillWithData(XPListBoxData_t* pListBoxData, const char* inItems, int Width);
+void XPListBoxFillWithData(XPListBoxData_t* pListBoxData, const char* inItems);
 void XPListBoxAddItem(XPWidgetID listboxId, const char* pBuffer);
-void XPListBoxAddItem(XPListBoxData_t* pListBoxData, char* pBuffer, int Width);
+void XPListBoxAddItem(XPListBoxData_t* pListBoxData, const char* pBuffer);
 void XPListBoxClear(XPListBoxData_t* pListBoxData);
-void XPListBoxInsertItem(XPListBoxData_t* pListBoxData, char* pBuffer, int Width, int CurrentItem);
+void XPListBoxInsertItem(XPListBoxData_t* pListBoxData, const char* pBuffer, int CurrentItem);
 void XPListBoxDeleteItem(XPListBoxData_t* pListBoxData, int CurrentItem);
 
+/*
+ * XPListBoxAddItems
+ *
+ * Adds items straight into the listbox's ring, without going through the
+ * descriptor, and updates the scrollbar once for the lot. inNext is called
+ * with an empty string to fill in with the next item, until it returns false.
+ * The strings' buffers are reused as the ring goes round. Returns how many
+ * items were added.
+ *
+ */
+size_t XPListBoxAddItems(XPWidgetID listboxId, const std::function<bool(std::string&)>& inNext);
+
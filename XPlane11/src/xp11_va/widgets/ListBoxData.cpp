@@ -0,0 +1,88 @@
+#include "pch.h"
+#include "ListBox.h"
+#include <algorithm>
+
+// The listbox's ring of items, kept apart from the widget and its drawing so
+// it can be built and checked on its own, see bench/ListBoxRingCheck.cpp.
+
+std::string& XPListBoxData_t::Push(bool& outDropped)
+{
+	outDropped = false;
+	if (Count == Capacity)
+	{
+		// Full, so the oldest slot becomes the newest.
+		outDropped = true;
+		std::string& Slot = Items[First];
+		First = (First + 1) % Items.size();
+		return Slot;
+	}
+
+	if (Count == Items.size())
+	{
+		// Growing at the end of the vector only works if the ring doesn't wrap around it.
+		std::rotate(Items.begin(), Items.begin() + First, Items.end());
+		First = 0;
+		Items.emplace_back();
+	}
+	return Items[(First + Count++) % Items.size()];
+}
+
+std::string& XPListBoxData_t::Insert(size_t n, bool& outDropped)
+{
+	outDropped = false;
+	if (Count == Capacity)
+	{
+		// Full, so the oldest goes and the rest move up one.
+		outDropped = true;
+		First = (First + 1) % Items.size();
+		Count--;
+		if (n > 0)
+			n--;
+	}
+	else if (Count == Items.size())
+	{
+		std::rotate(Items.begin(), Items.begin() + First, Items.end());
+		First = 0;
+		Items.emplace_back();
+	}
+
+	// There is now a free slot both just before the first item and just after the last.
+	if (n < Count / 2)
+	{
+		First = (First + Items.size() - 1) % Items.size();
+		Count++;
+		for (size_t i = 0; i < n; ++i)
+			std::swap(Item(i), Item(i + 1));
+	}
+	else
+	{
+		Count++;
+		for (size_t i = Count - 1; i > n; --i)
+			std::swap(Item(i), Item(i - 1));
+	}
+	return Item(n);
+}
+
+void XPListBoxData_t::Erase(size_t n)
+{
+	// Close the gap from whichever end is nearer.
+	if (n < Count / 2)
+	{
+		for (size_t i = n; i > 0; --i)
+			std::swap(Item(i), Item(i - 1));
+		First = (First + 1) % Items.size();
+	}
+	else
+	{
+		for (size_t i = n; i + 1 < Count; ++i)
+			std::swap(Item(i), Item(i + 1));
+	}
+	Count--;
+}
+
+void XPListBoxData_t::Clear()
+{
+	// The strings keep their buffers for the next items.
+	First = 0;
+	Count = 0;
+}
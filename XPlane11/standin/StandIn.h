@@ -0,0 +1,93 @@
+#pragma once
+
+#include <XPLM/XPLMDataAccess.h>
+#include <XPLM/XPLMUtilities.h>
+
+/*
+ * A stand-in for the parts of X-Plane the plugin talks to, so that Link can
+ * run and be measured on Linux without the sim. It implements the XPLM
+ * functions the plugin calls against an in-memory table of datarefs and
+ * commands, runs flight loops when told to, and serves Link's pipes from
+ * memory.
+ *
+ * Sim time only moves when a frame is run, by the interval given, so a run
+ * driven the same way always schedules the flight loops the same way,
+ * however fast or slow the machine is.
+ */
+namespace xp11_va::standin {
+	// adds a dataref the sim would have. types may combine int, float and double for a scalar,
+	// size is the number of elements of an array or data dataref
+	XPLMDataRef AddDataref(std::string_view name, XPLMDataTypeID types, size_t size = 1, bool writable = true);
+	XPLMCommandRef AddCommand(std::string_view name);
+	// the plugin's writes to a dataref that isn't writable are ignored, so give it its value first
+	void SetWritable(XPLMDataRef, bool);
+
+	// how often the plugin has run a command
+	struct CommandCounts {
+		uint64_t once = 0;
+		uint64_t begins = 0;
+		uint64_t ends = 0;
+	};
+	CommandCounts Counts(XPLMCommandRef);
+
+	// removes every dataref and command, including those the plugin registered
+	void Reset();
+	// copies XPLMDebugString output to stderr, off by default
+	void SetVerbose(bool);
+
+	// moves sim time on by interval seconds and runs every flight loop that is due, before flight model
+	// loops first, on the calling thread, which is the sim thread for as long as it does this
+	void RunFrame(float interval = 1.0f / 60);
+	uint64_t Frames();
+
+	/*
+	 * Runs frames on a thread of its own, hz frames per second of real time,
+	 * each moving sim time on by 1/hz. A rate of 0 runs them back to back,
+	 * moving sim time on by 1/60 each.
+	 */
+	class Driver {
+	public:
+		explicit Driver(double hz = 60);
+		~Driver();
+		Driver(const Driver&) = delete;
+		Driver& operator=(const Driver&) = delete;
+
+		// waits for the frame in progress, no frames run after it returns
+		void Stop();
+
+	private:
+		std::atomic_bool stopping;
+		std::thread thread;
+	};
+
+	/*
+	 * The client's end of one of Link's pipes. Each Send is one message, and
+	 * each Receive one write by Link, a response or a log line. Up to
+	 * QUEUED_MESSAGES may be waiting in either direction before the writer
+	 * waits. The strings they are kept in are reused, so once each has grown to
+	 * fit the messages passed through it a connection doesn't allocate.
+	 */
+	class PipeClient {
+	public:
+		static constexpr size_t QUEUED_MESSAGES = 64;
+
+		// waits for Link to pick the connection up. each queued message starts with room for messageBytes.
+		static std::shared_ptr<PipeClient> Connect(size_t messageBytes = 256);
+
+		// returns false once either end has closed the pipe
+		bool Send(std::string_view message);
+		// waits up to timeout for the next message from Link, returns false if there was none or the pipe closed
+		bool Receive(std::string& message, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
+		// returns false straight away if nothing is waiting
+		bool TryReceive(std::string& message);
+		void Close();
+
+		struct Channel;
+		PipeClient(std::shared_ptr<Channel> toLink, std::shared_ptr<Channel> fromLink);
+		~PipeClient();
+
+	private:
+		std::shared_ptr<Channel> toLink;
+		std::shared_ptr<Channel> fromLink;
+	};
+}
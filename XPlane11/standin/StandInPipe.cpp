@@ -0,0 +1,175 @@
+#include "pch.h"
+#include "StandIn.h"
+#include "xp11_va/Pipe.h"
+
+#include <deque>
+
+namespace xp11_va::standin {
+	// one direction of a pipe, a ring of messages whose strings are kept and reused
+	struct PipeClient::Channel {
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::array<std::string, QUEUED_MESSAGES> slots;
+		size_t head = 0;
+		size_t tail = 0;
+		bool closed = false;
+
+		explicit Channel(size_t messageBytes) {
+			for (auto& slot : slots) {
+				slot.reserve(messageBytes);
+			}
+		}
+
+		bool Push(std::string_view message) {
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this]() { return closed || tail - head < QUEUED_MESSAGES; });
+			if (closed) { return false; }
+			slots[tail++ % QUEUED_MESSAGES].assign(message);
+			cv.notify_all();
+			return true;
+		}
+
+		// messages already sent are still handed out after the channel is closed
+		bool Pop(std::string& message, std::optional<std::chrono::steady_clock::time_point> deadline) {
+			std::unique_lock<std::mutex> lock(mutex);
+			const auto ready = [this]() { return closed || head != tail; };
+			if (deadline) {
+				cv.wait_until(lock, *deadline, ready);
+			}
+			else {
+				cv.wait(lock, ready);
+			}
+			if (head == tail) { return false; }
+			message.assign(slots[head++ % QUEUED_MESSAGES]);
+			cv.notify_all();
+			return true;
+		}
+
+		void Close() {
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			cv.notify_all();
+		}
+
+		bool IsClosed() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return closed;
+		}
+	};
+
+	namespace {
+		struct PendingClient {
+			std::shared_ptr<PipeClient::Channel> toLink;
+			std::shared_ptr<PipeClient::Channel> fromLink;
+			bool accepted = false;
+		};
+
+		// clients waiting for Link's connect thread to pick them up
+		std::mutex listenMutex;
+		std::condition_variable listenCv;
+		std::deque<std::shared_ptr<PendingClient>> pendingClients;
+
+		/*
+		 * Link's end of a pipe. Connect waits for a client as the named pipe
+		 * does, and Abort wakes whatever is waiting on the pipe.
+		 */
+		class StandInPipe : public Pipe {
+		public:
+			void Connect() override {
+				std::unique_lock<std::mutex> lock(listenMutex);
+				listenCv.wait(lock, [this]() { return aborted || !pendingClients.empty(); });
+				if (aborted) { return; }
+
+				auto client = std::move(pendingClients.front());
+				pendingClients.pop_front();
+				toLink = client->toLink;
+				fromLink = client->fromLink;
+				client->accepted = true;
+				listenCv.notify_all();
+			}
+
+			bool IsConnected() override {
+				std::lock_guard<std::mutex> lock(listenMutex);
+				return !aborted && toLink != nullptr;
+			}
+
+			bool ReadPipe(std::string& request) override {
+				return toLink->Pop(request, std::nullopt);
+			}
+
+			bool WritePipe(std::string_view response) override {
+				return fromLink->Push(response);
+			}
+
+			// the client closes both directions at once
+			bool IsPeerConnected() override {
+				return !fromLink->IsClosed();
+			}
+
+			void Abort(std::thread::native_handle_type) override {
+				std::shared_ptr<PipeClient::Channel> to;
+				std::shared_ptr<PipeClient::Channel> from;
+				{
+					std::lock_guard<std::mutex> lock(listenMutex);
+					aborted = true;
+					to = toLink;
+					from = fromLink;
+					listenCv.notify_all();
+				}
+				if (to) {
+					to->Close();
+					from->Close();
+				}
+			}
+
+		private:
+			// both guarded by listenMutex until Connect returns
+			bool aborted = false;
+			std::shared_ptr<PipeClient::Channel> toLink;
+			std::shared_ptr<PipeClient::Channel> fromLink;
+		};
+	}
+
+	/* PUBLIC API */
+
+	std::shared_ptr<PipeClient> PipeClient::Connect(size_t messageBytes) {
+		auto pending = std::make_shared<PendingClient>();
+		pending->toLink = std::make_shared<Channel>(messageBytes);
+		pending->fromLink = std::make_shared<Channel>(messageBytes);
+
+		std::unique_lock<std::mutex> lock(listenMutex);
+		pendingClients.push_back(pending);
+		listenCv.notify_all();
+		listenCv.wait(lock, [&pending]() { return pending->accepted; });
+		return std::make_shared<PipeClient>(pending->toLink, pending->fromLink);
+	}
+
+	PipeClient::PipeClient(std::shared_ptr<Channel> to, std::shared_ptr<Channel> from) : toLink(std::move(to)), fromLink(std::move(from)) {}
+
+	PipeClient::~PipeClient() {
+		Close();
+	}
+
+	bool PipeClient::Send(std::string_view message) {
+		return toLink->Push(message);
+	}
+
+	bool PipeClient::Receive(std::string& message, std::chrono::milliseconds timeout) {
+		return fromLink->Pop(message, std::chrono::steady_clock::now() + timeout);
+	}
+
+	bool PipeClient::TryReceive(std::string& message) {
+		return fromLink->Pop(message, std::chrono::steady_clock::time_point{});
+	}
+
+	void PipeClient::Close() {
+		toLink->Close();
+		fromLink->Close();
+	}
+}
+
+namespace xp11_va {
+	std::shared_ptr<Pipe> Pipe::get() {
+		return std::make_shared<standin::StandInPipe>();
+	}
+}
@@ -0,0 +1,424 @@
+#include "pch.h"
+#include "StandIn.h"
+
+#include <XPLM/XPLMProcessing.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace xp11_va::standin {
+	namespace {
+		/*
+		 * A dataref, either one of the sim's with its value kept here, or one a
+		 * plugin registered, which is read and written through its callbacks.
+		 * Scalars of any type share one double, so a dataref that is both int
+		 * and float reads back the same value as either.
+		 */
+		struct Dataref {
+			std::string name;
+			XPLMDataTypeID types = xplmType_Unknown;
+			bool writable = false;
+			double scalar = 0;
+			std::vector<int> ints;
+			std::vector<float> floats;
+			std::vector<uint8_t> bytes;
+
+			bool registered = false;
+			XPLMGetDatai_f readInt = nullptr;
+			XPLMSetDatai_f writeInt = nullptr;
+			XPLMGetDataf_f readFloat = nullptr;
+			XPLMSetDataf_f writeFloat = nullptr;
+			XPLMGetDatad_f readDouble = nullptr;
+			XPLMSetDatad_f writeDouble = nullptr;
+			XPLMGetDatavi_f readInts = nullptr;
+			XPLMSetDatavi_f writeInts = nullptr;
+			XPLMGetDatavf_f readFloats = nullptr;
+			XPLMSetDatavf_f writeFloats = nullptr;
+			XPLMGetDatab_f readBytes = nullptr;
+			XPLMSetDatab_f writeBytes = nullptr;
+			void* readRefcon = nullptr;
+			void* writeRefcon = nullptr;
+		};
+
+		struct Command {
+			std::string name;
+			std::atomic<uint64_t> once{ 0 };
+			std::atomic<uint64_t> begins{ 0 };
+			std::atomic<uint64_t> ends{ 0 };
+		};
+
+		struct FlightLoop {
+			XPLMCreateFlightLoop_t params;
+			bool scheduled = false;
+			// a loop is due on the frame numbered nextFrame, or once sim time reaches nextTime, whichever is set
+			uint64_t nextFrame = 0;
+			double nextTime = 0;
+			double lastCalled = 0;
+		};
+
+		// entries are never moved, so the refs handed out stay valid until Reset
+		std::mutex tableMutex;
+		std::map<std::string, std::unique_ptr<Dataref>, std::less<>> datarefs;
+		std::map<std::string, std::unique_ptr<Command>, std::less<>> commands;
+
+		// held by RunFrame for the whole frame, so a loop destroyed from another thread is never called after
+		std::recursive_mutex loopMutex;
+		std::vector<std::unique_ptr<FlightLoop>> flightLoops;
+		std::atomic<uint64_t> frames{ 0 };
+		double simTime = 0;
+		double lastFrameTime = 0;
+
+		std::atomic_bool verbose{ false };
+
+		Dataref* asDataref(XPLMDataRef ref) { return static_cast<Dataref*>(ref); }
+		Command* asCommand(XPLMCommandRef ref) { return static_cast<Command*>(ref); }
+
+		// what X-Plane's array accessors return: the size when there is nowhere to copy to, else how many were copied
+		template <typename T>
+		int readArray(const std::vector<T>& from, T* to, int offset, int max) {
+			if (!to) { return static_cast<int>(from.size()); }
+			if (offset < 0 || static_cast<size_t>(offset) >= from.size() || max <= 0) { return 0; }
+			const int count = std::min(max, static_cast<int>(from.size()) - offset);
+			std::memcpy(to, from.data() + offset, count * sizeof(T));
+			return count;
+		}
+
+		template <typename T>
+		void writeArray(std::vector<T>& to, const T* from, int offset, int count) {
+			if (!from || offset < 0 || static_cast<size_t>(offset) >= to.size() || count <= 0) { return; }
+			count = std::min(count, static_cast<int>(to.size()) - offset);
+			std::memcpy(to.data() + offset, from, count * sizeof(T));
+		}
+
+		void schedule(FlightLoop& loop, float interval) {
+			// as in X-Plane, a positive interval is seconds, a negative one frames, and 0 stops the loop
+			loop.scheduled = interval != 0;
+			if (interval > 0) {
+				loop.nextFrame = 0;
+				loop.nextTime = simTime + interval;
+			}
+			else if (interval < 0) {
+				loop.nextFrame = frames.load() + static_cast<uint64_t>(-interval);
+				loop.nextTime = 0;
+			}
+		}
+	}
+
+	/* PUBLIC API */
+
+	XPLMDataRef AddDataref(std::string_view name, XPLMDataTypeID types, size_t size, bool writable) {
+		auto dataref = std::make_unique<Dataref>();
+		dataref->name = name;
+		dataref->types = types;
+		dataref->writable = writable;
+		if (types & xplmType_IntArray) { dataref->ints.resize(size); }
+		if (types & xplmType_FloatArray) { dataref->floats.resize(size); }
+		if (types & xplmType_Data) { dataref->bytes.resize(size); }
+
+		std::lock_guard<std::mutex> lock(tableMutex);
+		auto& entry = datarefs[std::string(name)];
+		entry = std::move(dataref);
+		return entry.get();
+	}
+
+	void SetWritable(XPLMDataRef ref, bool writable) {
+		asDataref(ref)->writable = writable;
+	}
+
+	XPLMCommandRef AddCommand(std::string_view name) {
+		std::lock_guard<std::mutex> lock(tableMutex);
+		auto& entry = commands[std::string(name)];
+		if (!entry) {
+			entry = std::make_unique<Command>();
+			entry->name = name;
+		}
+		return entry.get();
+	}
+
+	CommandCounts Counts(XPLMCommandRef ref) {
+		const auto* command = asCommand(ref);
+		return { command->once.load(), command->begins.load(), command->ends.load() };
+	}
+
+	void Reset() {
+		std::lock_guard<std::mutex> lock(tableMutex);
+		datarefs.clear();
+		commands.clear();
+	}
+
+	void SetVerbose(bool on) {
+		verbose = on;
+	}
+
+	void RunFrame(float interval) {
+		std::lock_guard<std::recursive_mutex> lock(loopMutex);
+		// loops destroyed since the last frame, which nothing is walking now
+		flightLoops.erase(std::remove_if(flightLoops.begin(), flightLoops.end(), [](const auto& loop) { return !loop->params.callbackFunc; }), flightLoops.end());
+		simTime += interval;
+		const uint64_t frame = ++frames;
+		const float since_last_frame = static_cast<float>(simTime - lastFrameTime);
+		lastFrameTime = simTime;
+
+		for (const auto phase : { xplm_FlightLoop_Phase_BeforeFlightModel, xplm_FlightLoop_Phase_AfterFlightModel }) {
+			// by index, a loop may create another, which is first looked at next frame
+			const size_t count = flightLoops.size();
+			for (size_t i = 0; i < count; i++) {
+				auto& loop = *flightLoops[i];
+				if (!loop.scheduled || !loop.params.callbackFunc || loop.params.phase != phase) { continue; }
+				const bool due = loop.nextTime > 0 ? simTime >= loop.nextTime : frame >= loop.nextFrame;
+				if (!due) { continue; }
+
+				const float since_last_call = static_cast<float>(simTime - loop.lastCalled);
+				loop.lastCalled = simTime;
+				const float next = loop.params.callbackFunc(since_last_call, since_last_frame, static_cast<int>(frame), loop.params.refcon);
+				// unless the callback destroyed its own loop
+				if (loop.params.callbackFunc) {
+					schedule(loop, next);
+				}
+			}
+		}
+	}
+
+	uint64_t Frames() {
+		return frames.load();
+	}
+
+	Driver::Driver(double hz) : stopping(false) {
+		thread = std::thread([this, hz]() {
+			const float interval = hz > 0 ? static_cast<float>(1 / hz) : 1.0f / 60;
+			const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(hz > 0 ? 1 / hz : 0));
+			auto next = std::chrono::steady_clock::now();
+			while (!stopping) {
+				RunFrame(interval);
+				if (hz > 0) {
+					// paced from when frames were due rather than when the last one ended, so the rate doesn't drift
+					next += period;
+					std::this_thread::sleep_until(next);
+				}
+			}
+		});
+	}
+
+	Driver::~Driver() {
+		Stop();
+	}
+
+	void Driver::Stop() {
+		stopping = true;
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+}
+
+using namespace xp11_va::standin;
+
+extern "C" {
+	/* XPLMDataAccess */
+
+	XPLMDataRef XPLMFindDataRef(const char* name) {
+		std::lock_guard<std::mutex> lock(tableMutex);
+		const auto it = datarefs.find(std::string_view(name));
+		return it == datarefs.end() ? nullptr : it->second.get();
+	}
+
+	int XPLMCanWriteDataRef(XPLMDataRef ref) {
+		const auto* dataref = asDataref(ref);
+		return dataref && dataref->writable ? 1 : 0;
+	}
+
+	XPLMDataTypeID XPLMGetDataRefTypes(XPLMDataRef ref) {
+		return ref ? asDataref(ref)->types : xplmType_Unknown;
+	}
+
+	int XPLMGetDatai(XPLMDataRef ref) {
+		const auto* dataref = asDataref(ref);
+		if (dataref->registered) { return dataref->readInt ? dataref->readInt(dataref->readRefcon) : 0; }
+		return static_cast<int>(dataref->scalar);
+	}
+
+	void XPLMSetDatai(XPLMDataRef ref, int value) {
+		auto* dataref = asDataref(ref);
+		if (dataref->registered) {
+			if (dataref->writeInt) { dataref->writeInt(dataref->writeRefcon, value); }
+		}
+		else if (dataref->writable) {
+			dataref->scalar = value;
+		}
+	}
+
+	float XPLMGetDataf(XPLMDataRef ref) {
+		const auto* dataref = asDataref(ref);
+		if (dataref->registered) { return dataref->readFloat ? dataref->readFloat(dataref->readRefcon) : 0; }
+		return static_cast<float>(dataref->scalar);
+	}
+
+	void XPLMSetDataf(XPLMDataRef ref, float value) {
+		auto* dataref = asDataref(ref);
+		if (dataref->registered) {
+			if (dataref->writeFloat) { dataref->writeFloat(dataref->writeRefcon, value); }
+		}
+		else if (dataref->writable) {
+			dataref->scalar = value;
+		}
+	}
+
+	double XPLMGetDatad(XPLMDataRef ref) {
+		const auto* dataref = asDataref(ref);
+		if (dataref->registered) { return dataref->readDouble ? dataref->readDouble(dataref->readRefcon) : 0; }
+		return dataref->scalar;
+	}
+
+	void XPLMSetDatad(XPLMDataRef ref, double value) {
+		auto* dataref = asDataref(ref);
+		if (dataref->registered) {
+			if (dataref->writeDouble) { dataref->writeDouble(dataref->writeRefcon, value); }
+		}
+		else if (dataref->writable) {
+			dataref->scalar = value;
+		}
+	}
+
+	int XPLMGetDatavi(XPLMDataRef ref, int* values, int offset, int max) {
+		const auto* dataref = asDataref(ref);
+		if (dataref->registered) { return dataref->readInts ? dataref->readInts(dataref->readRefcon, values, offset, max) : 0; }
+		return readArray(dataref->ints, values, offset, max);
+	}
+
+	void XPLMSetDatavi(XPLMDataRef ref, int* values, int offset, int count) {
+		auto* dataref = asDataref(ref);
+		if (dataref->registered) {
+			if (dataref->writeInts) { dataref->writeInts(dataref->writeRefcon, values, offset, count); }
+		}
+		else if (dataref->writable) {
+			writeArray(dataref->ints, values, offset, count);
+		}
+	}
+
+	int XPLMGetDatavf(XPLMDataRef ref, float* values, int offset, int max) {
+		const auto* dataref = asDataref(ref);
+		if (dataref->registered) { return dataref->readFloats ? dataref->readFloats(dataref->readRefcon, values, offset, max) : 0; }
+		return readArray(dataref->floats, values, offset, max);
+	}
+
+	void XPLMSetDatavf(XPLMDataRef ref, float* values, int offset, int count) {
+		auto* dataref = asDataref(ref);
+		if (dataref->registered) {
+			if (dataref->writeFloats) { dataref->writeFloats(dataref->writeRefcon, values, offset, count); }
+		}
+		else if (dataref->writable) {
+			writeArray(dataref->floats, values, offset, count);
+		}
+	}
+
+	int XPLMGetDatab(XPLMDataRef ref, void* values, int offset, int max) {
+		const auto* dataref = asDataref(ref);
+		if (dataref->registered) { return dataref->readBytes ? dataref->readBytes(dataref->readRefcon, values, offset, max) : 0; }
+		return readArray(dataref->bytes, static_cast<uint8_t*>(values), offset, max);
+	}
+
+	void XPLMSetDatab(XPLMDataRef ref, void* values, int offset, int count) {
+		auto* dataref = asDataref(ref);
+		if (dataref->registered) {
+			if (dataref->writeBytes) { dataref->writeBytes(dataref->writeRefcon, values, offset, count); }
+		}
+		else if (dataref->writable) {
+			writeArray(dataref->bytes, static_cast<const uint8_t*>(values), offset, count);
+		}
+	}
+
+	XPLMDataRef XPLMRegisterDataAccessor(const char* name, XPLMDataTypeID types, int writable,
+		XPLMGetDatai_f readInt, XPLMSetDatai_f writeInt, XPLMGetDataf_f readFloat, XPLMSetDataf_f writeFloat,
+		XPLMGetDatad_f readDouble, XPLMSetDatad_f writeDouble, XPLMGetDatavi_f readInts, XPLMSetDatavi_f writeInts,
+		XPLMGetDatavf_f readFloats, XPLMSetDatavf_f writeFloats, XPLMGetDatab_f readBytes, XPLMSetDatab_f writeBytes,
+		void* readRefcon, void* writeRefcon) {
+		auto dataref = std::make_unique<Dataref>();
+		dataref->name = name;
+		dataref->types = types;
+		dataref->writable = writable != 0;
+		dataref->registered = true;
+		dataref->readInt = readInt;
+		dataref->writeInt = writeInt;
+		dataref->readFloat = readFloat;
+		dataref->writeFloat = writeFloat;
+		dataref->readDouble = readDouble;
+		dataref->writeDouble = writeDouble;
+		dataref->readInts = readInts;
+		dataref->writeInts = writeInts;
+		dataref->readFloats = readFloats;
+		dataref->writeFloats = writeFloats;
+		dataref->readBytes = readBytes;
+		dataref->writeBytes = writeBytes;
+		dataref->readRefcon = readRefcon;
+		dataref->writeRefcon = writeRefcon;
+
+		std::lock_guard<std::mutex> lock(tableMutex);
+		auto& entry = datarefs[dataref->name];
+		entry = std::move(dataref);
+		return entry.get();
+	}
+
+	void XPLMUnregisterDataAccessor(XPLMDataRef ref) {
+		std::lock_guard<std::mutex> lock(tableMutex);
+		for (auto it = datarefs.begin(); it != datarefs.end(); ++it) {
+			if (it->second.get() == ref) {
+				datarefs.erase(it);
+				return;
+			}
+		}
+	}
+
+	/* XPLMUtilities */
+
+	XPLMCommandRef XPLMFindCommand(const char* name) {
+		std::lock_guard<std::mutex> lock(tableMutex);
+		const auto it = commands.find(std::string_view(name));
+		return it == commands.end() ? nullptr : it->second.get();
+	}
+
+	void XPLMCommandOnce(XPLMCommandRef ref) { asCommand(ref)->once++; }
+	void XPLMCommandBegin(XPLMCommandRef ref) { asCommand(ref)->begins++; }
+	void XPLMCommandEnd(XPLMCommandRef ref) { asCommand(ref)->ends++; }
+
+	void XPLMDebugString(const char* text) {
+		if (verbose) { std::fputs(text, stderr); }
+	}
+
+	/* XPLMPlugin, there are no other plugins */
+
+	XPLMPluginID XPLMFindPluginBySignature(const char*) { return XPLM_NO_PLUGIN_ID; }
+	void XPLMSendMessageToPlugin(XPLMPluginID, int, void*) {}
+
+	/* XPLMProcessing */
+
+	float XPLMGetElapsedTime() {
+		std::lock_guard<std::recursive_mutex> lock(loopMutex);
+		return static_cast<float>(simTime);
+	}
+
+	XPLMFlightLoopID XPLMCreateFlightLoop(XPLMCreateFlightLoop_t* params) {
+		auto loop = std::make_unique<FlightLoop>();
+		loop->params = *params;
+
+		std::lock_guard<std::recursive_mutex> lock(loopMutex);
+		loop->lastCalled = simTime;
+		flightLoops.push_back(std::move(loop));
+		return flightLoops.back().get();
+	}
+
+	void XPLMDestroyFlightLoop(XPLMFlightLoopID id) {
+		std::lock_guard<std::recursive_mutex> lock(loopMutex);
+		const auto it = std::find_if(flightLoops.begin(), flightLoops.end(), [id](const auto& loop) { return loop.get() == id; });
+		if (it != flightLoops.end()) {
+			// only unscheduled, a frame in progress on this thread may still be walking the list, the next frame removes it
+			(*it)->scheduled = false;
+			(*it)->params.callbackFunc = nullptr;
+		}
+	}
+
+	void XPLMScheduleFlightLoop(XPLMFlightLoopID id, float interval, int /*relativeToNow*/) {
+		std::lock_guard<std::recursive_mutex> lock(loopMutex);
+		schedule(*static_cast<FlightLoop*>(id), interval);
+	}
+}